@@ -0,0 +1,172 @@
+// gl_state.cpp
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+#include "gl_state.h"
+
+GlState gl_state;
+
+/***************************************************************************\
+ * gl_supports                                                             *
+\***************************************************************************/
+bool gl_supports(int major, int minor, const char *extension)
+{
+  const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  int v_major = 0, v_minor = 0;
+  if (version && std::sscanf(version, "%d.%d", &v_major, &v_minor) == 2 &&
+      (v_major > major || (v_major == major && v_minor >= minor)))
+    return true;
+
+  const char *extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+  if (!extensions)
+    return false;
+
+  std::istringstream iss(extensions);
+  std::string name;
+  while (iss >> name)
+    if (name == extension)
+      return true;
+  return false;
+}
+
+/***************************************************************************\
+ * GlState::GlState                                                        *
+\***************************************************************************/
+GlState::GlState() : issued(0), elided(0)
+{
+  invalidate();
+}
+
+/***************************************************************************\
+ * GlState::invalidate                                                     *
+\***************************************************************************/
+void GlState::invalidate()
+{
+  for (long &cap : caps)
+    cap = UNKNOWN;
+  tex_env_mode = depth_func = front_face = texture = program = array_buffer = UNKNOWN;
+}
+
+/*-------------------------------------------------------------------------*\
+ * GlState::index                                                          *
+\*-------------------------------------------------------------------------*/
+int GlState::index(GLenum cap)
+{
+  switch (cap)
+  {
+    case GL_BLEND:               return BLEND;
+    case GL_TEXTURE_2D:          return TEXTURE_2D;
+    case GL_DEPTH_TEST:          return DEPTH_TEST;
+    case GL_CULL_FACE:           return CULL_FACE;
+    case GL_STENCIL_TEST:        return STENCIL_TEST;
+    case GL_VERTEX_ARRAY:        return VERTEX_ARRAY;
+    case GL_TEXTURE_COORD_ARRAY: return TEXTURE_COORD_ARRAY;
+    case GL_COLOR_ARRAY:         return COLOR_ARRAY;
+    default:                     return -1;
+  }
+}
+
+/*-------------------------------------------------------------------------*\
+ * GlState::change                                                         *
+ * Record 'value' and tell whether the GL call is needed.                  *
+\*-------------------------------------------------------------------------*/
+bool GlState::change(long &cached, long value)
+{
+  if (cached == value)
+  {
+    elided++;
+    return false;
+  }
+
+  cached = value;
+  issued++;
+  return true;
+}
+
+/***************************************************************************\
+ * GlState::enable                                                         *
+\***************************************************************************/
+void GlState::enable(GLenum cap, bool on)
+{
+  int i = index(cap);
+
+  if (i < 0 || change(caps[i], on))
+  {
+    if (on)
+      glEnable(cap);
+    else
+      glDisable(cap);
+  }
+}
+
+/***************************************************************************\
+ * GlState::client_state                                                   *
+\***************************************************************************/
+void GlState::client_state(GLenum array, bool on)
+{
+  int i = index(array);
+
+  if (i < 0 || change(caps[i], on))
+  {
+    if (on)
+      glEnableClientState(array);
+    else
+      glDisableClientState(array);
+  }
+}
+
+/***************************************************************************\
+ * GlState::tex_env                                                        *
+\***************************************************************************/
+void GlState::tex_env(GLint mode)
+{
+  if (change(tex_env_mode, mode))
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, mode);
+}
+
+/***************************************************************************\
+ * GlState::set_depth_func                                                 *
+\***************************************************************************/
+void GlState::set_depth_func(GLenum func)
+{
+  if (change(depth_func, func))
+    glDepthFunc(func);
+}
+
+/***************************************************************************\
+ * GlState::set_front_face                                                 *
+\***************************************************************************/
+void GlState::set_front_face(GLenum mode)
+{
+  if (change(front_face, mode))
+    glFrontFace(mode);
+}
+
+/***************************************************************************\
+ * GlState::bind_texture                                                   *
+\***************************************************************************/
+void GlState::bind_texture(GLuint tex)
+{
+  if (change(texture, tex))
+    glBindTexture(GL_TEXTURE_2D, tex);
+}
+
+/***************************************************************************\
+ * GlState::use_program                                                    *
+\***************************************************************************/
+void GlState::use_program(GLuint prog)
+{
+  if (change(program, prog))
+    glUseProgram(prog);
+}
+
+/***************************************************************************\
+ * GlState::bind_buffer                                                    *
+\***************************************************************************/
+void GlState::bind_buffer(GLuint buffer)
+{
+  if (change(array_buffer, buffer))
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+}
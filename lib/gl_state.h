@@ -0,0 +1,61 @@
+// gl_state.h
+
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/gl.h>
+
+// Shadow copy of the GL state changed on every draw, so that redundant
+// calls are skipped.  Anything unknown (after invalidate()) is issued.
+// State changed behind its back must be followed by invalidate(): in
+// particular, calls made through the cache between glPushAttrib and
+// glPopAttrib are undone by the pop without the cache knowing.
+class GlState
+{
+  enum Cap { BLEND, TEXTURE_2D, DEPTH_TEST, CULL_FACE, STENCIL_TEST,
+             VERTEX_ARRAY, TEXTURE_COORD_ARRAY, COLOR_ARRAY, CAP_COUNT };
+
+  // Cached values, UNKNOWN until first set
+  static const long UNKNOWN = -1;
+  long caps[CAP_COUNT];
+  long tex_env_mode;
+  long depth_func;
+  long front_face;
+  long texture;
+  long program;
+  long array_buffer;
+
+  unsigned long issued;
+  unsigned long elided;
+
+  static int index(GLenum cap);
+  bool change(long &cached, long value);
+public:
+  GlState();
+
+  void invalidate();
+
+  void enable(GLenum cap, bool on = true);
+  void disable(GLenum cap) { enable(cap, false); }
+  // GL_VERTEX_ARRAY, GL_TEXTURE_COORD_ARRAY or GL_COLOR_ARRAY
+  void client_state(GLenum array, bool on);
+  void tex_env(GLint mode);
+  void set_depth_func(GLenum func);
+  void set_front_face(GLenum mode);
+  void bind_texture(GLuint tex);
+  void use_program(GLuint prog);
+  // GL_ARRAY_BUFFER; 0 for client side arrays
+  void bind_buffer(GLuint buffer);
+
+  // Calls issued and skipped since the last reset
+  unsigned long get_issued() const { return issued; }
+  unsigned long get_elided() const { return elided; }
+  void reset_counters() { issued = elided = 0; }
+};
+
+extern GlState gl_state;
+
+// True if the GL is at least version 'major'.'minor' or has 'extension'
+bool gl_supports(int major, int minor, const char *extension);
+
+#endif
@@ -0,0 +1,184 @@
+// gpu_profiler.cpp
+
+#include "gl_state.h"
+#include "gpu_profiler.h"
+
+/***************************************************************************\
+ * GpuProfiler::GpuProfiler                                                *
+\***************************************************************************/
+GpuProfiler::GpuProfiler() : frame(0), open(-1), available(false)
+{
+  for (Slot &slot : slots)
+  {
+    slot.frame = 0;
+    slot.timestamps[0] = slot.timestamps[1] = 0;
+  }
+}
+
+/***************************************************************************\
+ * GpuProfiler::init                                                       *
+\***************************************************************************/
+bool GpuProfiler::init(const std::vector<std::string> &sections)
+{
+  release();
+
+  names = sections;
+  if (!gl_supports(3, 3, "GL_ARB_timer_query"))
+    return false;
+
+  for (Slot &slot : slots)
+    glGenQueries(2, slot.timestamps);
+
+  available = true;
+  return true;
+}
+
+/***************************************************************************\
+ * GpuProfiler::release                                                    *
+\***************************************************************************/
+void GpuProfiler::release()
+{
+  if (available)
+    for (Slot &slot : slots)
+    {
+      glDeleteQueries(2, slot.timestamps);
+      if (!slot.pool.empty())
+        glDeleteQueries(slot.pool.size(), slot.pool.data());
+      slot.pool.clear();
+      slot.sections.clear();
+      slot.frame = 0;
+    }
+
+  available = false;
+  open = -1;
+  results.clear();
+}
+
+/*-------------------------------------------------------------------------*\
+ * GpuProfiler::read_back                                                  *
+ * Results of the frame held by 'slot', which is freed.  The queries      *
+ * complete in order: once the last timestamp is there, all are.           *
+\*-------------------------------------------------------------------------*/
+void GpuProfiler::read_back(Slot &slot, bool wait)
+{
+  if (!slot.frame)
+    return;
+
+  GLint ready = 0;
+  if (!wait)
+    glGetQueryObjectiv(slot.timestamps[1], GL_QUERY_RESULT_AVAILABLE, &ready);
+
+  if (wait || ready)
+  {
+    Result result;
+    result.frame = slot.frame;
+    result.section_ms.assign(names.size(), 0);
+
+    for (size_t i = 0; i < slot.sections.size(); i++)
+    {
+      GLuint64 ns = 0;
+      glGetQueryObjectui64v(slot.pool[i], GL_QUERY_RESULT, &ns);
+      result.section_ms[slot.sections[i]] += ns * 1e-6;
+    }
+
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(slot.timestamps[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(slot.timestamps[1], GL_QUERY_RESULT, &end);
+    result.frame_ms = (end - begin) * 1e-6;
+
+    results.push_back(result);
+  }
+
+  slot.frame = 0;
+  slot.sections.clear();
+}
+
+/***************************************************************************\
+ * GpuProfiler::begin_frame                                                *
+\***************************************************************************/
+void GpuProfiler::begin_frame()
+{
+  frame++;
+  if (!available)
+    return;
+
+  // The slot of frame - LATENCY, reused for this one
+  Slot &slot = slots[frame % LATENCY];
+  read_back(slot, false);
+
+  slot.frame = frame;
+  glQueryCounter(slot.timestamps[0], GL_TIMESTAMP);
+}
+
+/***************************************************************************\
+ * GpuProfiler::end_frame                                                  *
+\***************************************************************************/
+void GpuProfiler::end_frame()
+{
+  if (!available)
+    return;
+
+  end();
+  glQueryCounter(slots[frame % LATENCY].timestamps[1], GL_TIMESTAMP);
+}
+
+/***************************************************************************\
+ * GpuProfiler::begin                                                      *
+\***************************************************************************/
+void GpuProfiler::begin(int section)
+{
+  if (!available || section < 0 || section >= static_cast<int>(names.size()))
+    return;
+
+  end();
+
+  Slot &slot = slots[frame % LATENCY];
+  if (slot.sections.size() == slot.pool.size())
+  {
+    GLuint query;
+    glGenQueries(1, &query);
+    slot.pool.push_back(query);
+  }
+
+  glBeginQuery(GL_TIME_ELAPSED, slot.pool[slot.sections.size()]);
+  slot.sections.push_back(section);
+  open = section;
+}
+
+/***************************************************************************\
+ * GpuProfiler::end                                                        *
+\***************************************************************************/
+void GpuProfiler::end()
+{
+  if (open < 0)
+    return;
+
+  glEndQuery(GL_TIME_ELAPSED);
+  open = -1;
+}
+
+/***************************************************************************\
+ * GpuProfiler::finish                                                     *
+\***************************************************************************/
+void GpuProfiler::finish()
+{
+  if (!available)
+    return;
+
+  // Oldest frame first
+  for (int i = 1; i <= LATENCY; i++)
+    read_back(slots[(frame + i) % LATENCY], true);
+}
+
+/***************************************************************************\
+ * GpuProfiler::pop_result                                                 *
+\***************************************************************************/
+bool GpuProfiler::pop_result(Result &result)
+{
+  if (results.empty())
+    return false;
+
+  result = results.front();
+  results.pop_front();
+  return true;
+}
@@ -0,0 +1,77 @@
+// gpu_profiler.h
+
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <GL/gl.h>
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// class GpuProfiler -- GPU time of the sections of a frame.
+//
+// Sections are timed with GL_TIME_ELAPSED queries, the whole frame with a
+// pair of GL_TIMESTAMP queries.  Queries come from a pool per frame in
+// flight and are read back LATENCY frames later, when the GL is normally
+// done with them, so profiling never stalls the pipeline; a frame whose
+// results aren't ready by then is dropped.  A section may be timed several
+// times in a frame, the intervals add up, but sections can't nest.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+class GpuProfiler
+{
+public:
+  static const int LATENCY = 3;
+
+  // Times of one frame, in milliseconds
+  struct Result
+  {
+    unsigned long frame;
+    std::vector<double> section_ms;
+    double frame_ms;
+  };
+private:
+  struct Slot
+  {
+    unsigned long frame;        // 0: free
+    GLuint timestamps[2];       // frame begin and end
+    std::vector<GLuint> pool;   // GL_TIME_ELAPSED queries
+    std::vector<int> sections;  // section of each query used this frame
+  };
+  Slot slots[LATENCY];
+  std::vector<std::string> names;
+  unsigned long frame;
+  int open;                     // section being timed, or -1
+  bool available;
+
+  std::deque<Result> results;
+
+  void read_back(Slot &slot, bool wait);
+public:
+  GpuProfiler();
+
+  // Returns false if the GL implementation has no timer queries
+  bool init(const std::vector<std::string> &sections);
+  void release();
+  bool ready() const { return available; }
+
+  void begin_frame();
+  void end_frame();
+  void begin(int section);
+  void end();
+  // Read back every frame still in flight, waiting for the GL
+  void finish();
+
+  // Oldest result not yet taken; false if none
+  bool pop_result(Result &result);
+
+  const std::vector<std::string> &get_sections() const { return names; }
+  // Number given to the current frame, never 0
+  unsigned long get_frame() const { return frame; }
+};
+
+#endif
@@ -1,68 +1,77 @@
 // image.cpp
 
-#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 
 #include "image.h"
+#include "trace.h"
 
 /***************************************************************************\
  * Image::Image                                                            *
 \***************************************************************************/
-Image::Image(const std::string &filename)
+Image::Image(const std::string &name, const FileSpan &data)
 {
+  Trace::Scope trace("Image::Image");
   std::string ext;
-  size_t length;
-  std::vector<unsigned char> data;
 
   // Extract file extension
-  ext.assign(filename, filename.find_last_of ('.') + 1, std::string::npos);
+  ext.assign(name, name.find_last_of ('.') + 1, std::string::npos);
 
   if (ext.compare("pcx") != 0)
   {
     // problemo
   }
-  // Open file
-  std::ifstream ifs(filename);
 
-  if (ifs.fail())
+  std::string error = check(name, data);
+  if (!error.empty())
   {
-    std::cerr << "Couldn't open file: " << filename << std::endl;
+    std::cerr << error << std::endl;
     exit(-1);
   }
 
-  // Get file length
-  ifs.seekg(0, std::ios::end);
-  length = ifs.tellg();
-  ifs.seekg(0, std::ios::beg);
-
-  data.resize(length);
-
-  // Read whole file data
-  ifs.read(reinterpret_cast<char*>(data.data()), length);
-  ifs.close();
-
-  const unsigned char *data_ptr = data.data();
+  // The PCX data is decoded straight from the (mapped) file
+  const unsigned char *data_ptr = data.data;
 
   // Read PCX header
   header = reinterpret_cast<const PCX_Header *>(data_ptr);
   data_ptr += sizeof(PCX_Header);
 
-  // Check if is valid PCX file
-  if (header->manufacturer != 0x0a)
-  {
-    std::cerr << "Bad version number: " << filename << std::endl;
-    exit(-1);
-  }
-
   // Initialize image variables
   width  = header->xmax - header->xmin + 1;
   height = header->ymax - header->ymin + 1;
   pixels.resize(width * height * 3);
 
-  int palette_pos = data.size() - 768;
-  readPCX8bits(data_ptr, data.data() + palette_pos);
+  int palette_pos = data.size - 768;
+  readPCX8bits(data_ptr, data.data + palette_pos - 1, data.data + palette_pos);
+}
+
+/***************************************************************************\
+ * Image::check                                                            *
+ * Header and size checks only, safe on any thread.                        *
+\***************************************************************************/
+std::string Image::check(const std::string &name, const FileSpan &data)
+{
+  if (data.empty())
+    return "Couldn't open file: " + name;
+
+  if (data.size < sizeof(PCX_Header) + 769)
+    return "Truncated file: " + name;
+
+  // Check if is valid PCX file
+  const PCX_Header *header = reinterpret_cast<const PCX_Header *>(data.data);
+  if (header->manufacturer != 0x0a)
+    return "Bad version number: " + name;
+
+  // Only 8 bits paletted images are decoded
+  if (header->bitsPerPixel != 8 || header->numColorPlanes != 1)
+    return "Unsupported PCX format: " + name;
+
+  if (header->xmax < header->xmin || header->ymax < header->ymin ||
+      header->bytesPerScanLine < header->xmax - header->xmin + 1)
+    return "Bad image size: " + name;
+
+  return std::string();
 }
 
 int Image::rgbTable[3] = { 0, 1, 2 };
@@ -71,7 +80,8 @@ int Image::rgbTable[3] = { 0, 1, 2 };
  * Image::readPCX8bits                                                     *
  * Read 8 bits PCX image.                                                  *
 \*-------------------------------------------------------------------------*/
-void Image::readPCX8bits(const unsigned char *data, const unsigned char *palette)
+void Image::readPCX8bits(const unsigned char *data, const unsigned char *end,
+                         const unsigned char *palette)
 {
   const unsigned char *pData = data;
   int rle_count = 0, rle_value = 0;
@@ -92,22 +102,26 @@ void Image::readPCX8bits(const unsigned char *data, const unsigned char *palette
     ptr = &pixels[(height - (y + 1)) * width * 3];
     int bytes = header->bytesPerScanLine;
 
-    // Decode line number y
-    while (bytes--)
+    // Decode line number y; the padding past the width is skipped, and
+    // truncated data reads as 0
+    for (int x = 0; x < bytes; x++)
     {
       if (rle_count == 0)
       {
-        if( (rle_value = *(pData++)) < 0xc0)
+        rle_value = pData < end ? *(pData++) : 0;
+        if (rle_value < 0xc0)
           rle_count = 1;
         else
         {
           rle_count = rle_value - 0xc0;
-          rle_value = *(pData++);
+          rle_value = pData < end ? *(pData++) : 0;
         }
       }
 
       rle_count--;
 
+      if (static_cast<unsigned>(x) >= width)
+        continue;
       ptr[0] = palette[rle_value * 3 + compTable[0]];
       ptr[1] = palette[rle_value * 3 + compTable[1]];
       ptr[2] = palette[rle_value * 3 + compTable[2]];
@@ -4,20 +4,26 @@
 #include <string>
 #include <vector>
 
+#include "mem_stats.h"
+#include "vfs.h"
+
 class Image
 {
   unsigned width;
   unsigned height;
-  std::vector<unsigned char> pixels;
+  MemStats::vector<unsigned char, MemStats::TEXTURE_CPU> pixels;
 public:
-  Image(const std::string &filename);
+  Image(const std::string &name, const FileSpan &data);
+  // Why 'data' can't be decoded, empty if it can.  The constructor exits
+  // on such files: check them first off the main thread.
+  static std::string check(const std::string &name, const FileSpan &data);
   unsigned get_width()  const { return width; }
   unsigned get_height() const { return height; }
   const unsigned char *get_pixels() const { return pixels.data(); }
 
 private:
   // Internal functions
-  void readPCX8bits (const unsigned char *data,
+  void readPCX8bits (const unsigned char *data, const unsigned char *end,
                      const unsigned char *palette);
 
 private:
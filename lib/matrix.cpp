@@ -1,5 +1,11 @@
 // matrix.cpp
 
+#include <cmath>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include "matrix.h"
 
 /**************************************************************************\
@@ -32,22 +38,217 @@ matrix::matrix(const vec4 &v0, const vec4 &v1, const vec4 &v2, const vec4 &v3)
   m[12] = v0.w; m[13] = v1.w; m[14] = v2.w; m[15] = v3.w;
 }
 
+#ifdef __SSE__
+/*------------------------------------------------------------------------*\
+ * mul_column                                                             *
+ * c0 * x + c1 * y + c2 * z + c3 * w, one column per register.            *
+\*------------------------------------------------------------------------*/
+static inline __m128 mul_column(const __m128 c[4], float x, float y, float z, float w)
+{
+  __m128 r = _mm_mul_ps(c[0], _mm_set1_ps(x));
+  r = _mm_add_ps(r, _mm_mul_ps(c[1], _mm_set1_ps(y)));
+  r = _mm_add_ps(r, _mm_mul_ps(c[2], _mm_set1_ps(z)));
+  return _mm_add_ps(r, _mm_mul_ps(c[3], _mm_set1_ps(w)));
+}
+
+static inline void load_columns(const float *m, __m128 c[4])
+{
+  c[0] = _mm_loadu_ps(m);
+  c[1] = _mm_loadu_ps(m + 4);
+  c[2] = _mm_loadu_ps(m + 8);
+  c[3] = _mm_loadu_ps(m + 12);
+}
+#endif
+
 /**************************************************************************\
  * matrix::operator*                                                      *
 \**************************************************************************/
-vec4 matrix::operator*(const vec4 &v)
+vec4 matrix::operator*(const vec4 &v) const
 {
-return vec4(v.x * m[ 0] + v.y * m[ 4] + v.z * m[ 8] + v.w * m[12],
-            v.x * m[ 1] + v.y * m[ 5] + v.z * m[ 9] + v.w * m[13],
-            v.x * m[ 2] + v.y * m[ 6] + v.z * m[10] + v.w * m[14],
-            v.x * m[ 3] + v.y * m[ 7] + v.z * m[11] + v.w * m[15]);
+  return vec4(v.x * m[ 0] + v.y * m[ 4] + v.z * m[ 8] + v.w * m[12],
+              v.x * m[ 1] + v.y * m[ 5] + v.z * m[ 9] + v.w * m[13],
+              v.x * m[ 2] + v.y * m[ 6] + v.z * m[10] + v.w * m[14],
+              v.x * m[ 3] + v.y * m[ 7] + v.z * m[11] + v.w * m[15]);
 }
+
 /**************************************************************************\
- * matrix::operator                                                       *
+ * matrix::operator*                                                      *
 \**************************************************************************/
-vec3 matrix::operator*(const vec3 &v)
+vec3 matrix::operator*(const vec3 &v) const
 {
   vec4 ret = operator*(vec4(v.x, v.y, v.z, 1.0));
-  ret /= ret.w;
-  return vec3(ret.x, ret.y, ret.z);
+  float inv_w = 1.0f / ret.w;
+  return vec3(ret.x * inv_w, ret.y * inv_w, ret.z * inv_w);
+}
+
+/**************************************************************************\
+ * matrix::operator*                                                      *
+\**************************************************************************/
+matrix matrix::operator*(const matrix &b) const
+{
+#ifdef __SSE__
+  matrix r;
+  __m128 c[4];
+  load_columns(m, c);
+  for (int j = 0; j < 4; j++)
+  {
+    const float *bc = b.m + 4 * j;
+    _mm_storeu_ps(r.m + 4 * j, mul_column(c, bc[0], bc[1], bc[2], bc[3]));
+  }
+  return r;
+#else
+  return multiply_scalar(b);
+#endif
+}
+
+/**************************************************************************\
+ * matrix::multiply_scalar                                                *
+\**************************************************************************/
+matrix matrix::multiply_scalar(const matrix &b) const
+{
+  matrix r;
+  for (int j = 0; j < 4; j++)
+    for (int i = 0; i < 4; i++)
+      r.m[4 * j + i] = m[i     ] * b.m[4 * j    ] + m[i +  4] * b.m[4 * j + 1] +
+                       m[i +  8] * b.m[4 * j + 2] + m[i + 12] * b.m[4 * j + 3];
+  return r;
+}
+
+/**************************************************************************\
+ * matrix::transpose                                                      *
+\**************************************************************************/
+matrix matrix::transpose() const
+{
+  matrix r;
+  for (int j = 0; j < 4; j++)
+    for (int i = 0; i < 4; i++)
+      r.m[4 * i + j] = m[4 * j + i];
+  return r;
+}
+
+/**************************************************************************\
+ * matrix::inverse                                                        *
+ * Cofactor expansion; the layout does not matter since                   *
+ * inverse(transpose(M)) == transpose(inverse(M)).                         *
+\**************************************************************************/
+bool matrix::inverse(matrix &out) const
+{
+  float inv[16];
+
+  inv[ 0] =  m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+  inv[ 4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+  inv[ 8] =  m[4]*m[ 9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[ 9];
+  inv[12] = -m[4]*m[ 9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[ 9];
+  inv[ 1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+  inv[ 5] =  m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+  inv[ 9] = -m[0]*m[ 9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[ 9];
+  inv[13] =  m[0]*m[ 9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[ 9];
+  inv[ 2] =  m[1]*m[ 6]*m[15] - m[1]*m[ 7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[ 7] - m[13]*m[3]*m[ 6];
+  inv[ 6] = -m[0]*m[ 6]*m[15] + m[0]*m[ 7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[ 7] + m[12]*m[3]*m[ 6];
+  inv[10] =  m[0]*m[ 5]*m[15] - m[0]*m[ 7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[ 7] - m[12]*m[3]*m[ 5];
+  inv[14] = -m[0]*m[ 5]*m[14] + m[0]*m[ 6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[ 6] + m[12]*m[2]*m[ 5];
+  inv[ 3] = -m[1]*m[ 6]*m[11] + m[1]*m[ 7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[ 9]*m[2]*m[ 7] + m[ 9]*m[3]*m[ 6];
+  inv[ 7] =  m[0]*m[ 6]*m[11] - m[0]*m[ 7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[ 8]*m[2]*m[ 7] - m[ 8]*m[3]*m[ 6];
+  inv[11] = -m[0]*m[ 5]*m[11] + m[0]*m[ 7]*m[ 9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[ 9] - m[ 8]*m[1]*m[ 7] + m[ 8]*m[3]*m[ 5];
+  inv[15] =  m[0]*m[ 5]*m[10] - m[0]*m[ 6]*m[ 9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[ 9] + m[ 8]*m[1]*m[ 6] - m[ 8]*m[2]*m[ 5];
+
+  float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+  if (std::fabs(det) < 1e-12f)
+    return false;
+
+  det = 1.0f / det;
+  for (int i = 0; i < 16; i++)
+    out.m[i] = inv[i] * det;
+  return true;
+}
+
+/**************************************************************************\
+ * matrix::transform_points                                               *
+\**************************************************************************/
+void matrix::transform_points(const vec3 *in, vec3 *out, size_t n) const
+{
+#ifdef __SSE__
+  __m128 c[4];
+  load_columns(m, c);
+  float r[4];
+  for (size_t i = 0; i < n; i++)
+  {
+    _mm_storeu_ps(r, mul_column(c, in[i].x, in[i].y, in[i].z, 1.0f));
+    out[i] = vec3(r[0], r[1], r[2]);
+  }
+#else
+  transform_points_scalar(in, out, n);
+#endif
+}
+
+/**************************************************************************\
+ * matrix::transform_points_scalar                                        *
+\**************************************************************************/
+void matrix::transform_points_scalar(const vec3 *in, vec3 *out, size_t n) const
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    const vec3 v = in[i];
+    out[i] = vec3(v.x * m[0] + v.y * m[4] + v.z * m[ 8] + m[12],
+                  v.x * m[1] + v.y * m[5] + v.z * m[ 9] + m[13],
+                  v.x * m[2] + v.y * m[6] + v.z * m[10] + m[14]);
+  }
+}
+
+/**************************************************************************\
+ * matrix::project_points                                                 *
+\**************************************************************************/
+void matrix::project_points(const vec3 *in, vec3 *out, size_t n) const
+{
+#ifdef __SSE__
+  __m128 c[4];
+  load_columns(m, c);
+  float r[4];
+  for (size_t i = 0; i < n; i++)
+  {
+    __m128 p = mul_column(c, in[i].x, in[i].y, in[i].z, 1.0f);
+    p = _mm_div_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3)));
+    _mm_storeu_ps(r, p);
+    out[i] = vec3(r[0], r[1], r[2]);
+  }
+#else
+  project_points_scalar(in, out, n);
+#endif
+}
+
+/**************************************************************************\
+ * matrix::project_points_scalar                                          *
+\**************************************************************************/
+void matrix::project_points_scalar(const vec3 *in, vec3 *out, size_t n) const
+{
+  for (size_t i = 0; i < n; i++)
+    out[i] = operator*(in[i]);
+}
+
+/**************************************************************************\
+ * matrix::transform                                                      *
+\**************************************************************************/
+void matrix::transform(const vec4 *in, vec4 *out, size_t n) const
+{
+#ifdef __SSE__
+  __m128 c[4];
+  load_columns(m, c);
+  float r[4];
+  for (size_t i = 0; i < n; i++)
+  {
+    _mm_storeu_ps(r, mul_column(c, in[i].x, in[i].y, in[i].z, in[i].w));
+    out[i] = vec4(r[0], r[1], r[2], r[3]);
+  }
+#else
+  transform_scalar(in, out, n);
+#endif
+}
+
+/**************************************************************************\
+ * matrix::transform_scalar                                               *
+\**************************************************************************/
+void matrix::transform_scalar(const vec4 *in, vec4 *out, size_t n) const
+{
+  for (size_t i = 0; i < n; i++)
+    out[i] = operator*(in[i]);
 }
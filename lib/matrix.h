@@ -3,17 +3,41 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <cstddef>
+
 #include "vec3.h"
 #include "vec4.h"
 
+// 4x4 matrix, column-major storage (OpenGL layout).  The vec4 constructor
+// takes the four rows.  Products and batched transforms use SSE when the
+// compiler targets it and fall back to scalar code otherwise.
 struct matrix
 {
   float m[16];
   matrix();
   matrix(const float *s);
   matrix(const vec4 &v0, const vec4 &v1, const vec4 &v2, const vec4 &v3);
-  vec4 operator*(const vec4 &v);
-  vec3 operator*(const vec3 &v);
+  vec4 operator*(const vec4 &v) const;
+  vec3 operator*(const vec3 &v) const;
+  matrix operator*(const matrix &b) const;
+
+  matrix transpose() const;
+  // Returns false (and leaves 'out' untouched) if the matrix is singular
+  bool inverse(matrix &out) const;
+
+  // Batched kernels.  transform_points assumes an affine matrix (w = 1, no
+  // divide); project_points performs the full homogeneous divide.
+  // 'in' and 'out' may alias.
+  void transform_points(const vec3 *in, vec3 *out, size_t n) const;
+  void project_points(const vec3 *in, vec3 *out, size_t n) const;
+  void transform(const vec4 *in, vec4 *out, size_t n) const;
+
+  // Scalar versions of the product and of the kernels, what they compute
+  // without SSE; kept in every build for the tests (tests/matrix_test.cpp)
+  matrix multiply_scalar(const matrix &b) const;
+  void transform_points_scalar(const vec3 *in, vec3 *out, size_t n) const;
+  void project_points_scalar(const vec3 *in, vec3 *out, size_t n) const;
+  void transform_scalar(const vec4 *in, vec4 *out, size_t n) const;
 };
 
 #endif
@@ -0,0 +1,126 @@
+// mem_stats.cpp
+
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <ostream>
+
+#include "mem_stats.h"
+
+namespace
+{
+  std::atomic<long> resident[MemStats::TAG_COUNT];
+  std::atomic<long> peak[MemStats::TAG_COUNT];
+  std::atomic<unsigned long> tag_allocations[MemStats::TAG_COUNT];
+  std::atomic<unsigned long> allocations(0);
+
+  const char *TAG_NAMES[MemStats::TAG_COUNT] =
+  {
+    "geometry", "keyframes", "texture_cpu", "texture_gpu", "gpu_buffers", "scratch"
+  };
+}
+
+/***************************************************************************\
+ * operator new, operator delete                                           *
+ * Replaced to count every heap allocation.                                *
+\***************************************************************************/
+void *operator new(size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+
+  void *p = std::malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  std::free(p);
+}
+
+/***************************************************************************\
+ * MemStats::tag_name                                                      *
+\***************************************************************************/
+const char *MemStats::tag_name(Tag tag)
+{
+  return TAG_NAMES[tag];
+}
+
+/***************************************************************************\
+ * MemStats::account                                                       *
+\***************************************************************************/
+void MemStats::account(Tag tag, long bytes)
+{
+  long now = resident[tag].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  if (bytes > 0)
+    tag_allocations[tag].fetch_add(1, std::memory_order_relaxed);
+
+  long high = peak[tag].load(std::memory_order_relaxed);
+  while (now > high && !peak[tag].compare_exchange_weak(high, now, std::memory_order_relaxed))
+    ;
+}
+
+/***************************************************************************\
+ * MemStats::get_resident                                                  *
+\***************************************************************************/
+size_t MemStats::get_resident(Tag tag)
+{
+  return resident[tag].load(std::memory_order_relaxed);
+}
+
+/***************************************************************************\
+ * MemStats::get_peak                                                      *
+\***************************************************************************/
+size_t MemStats::get_peak(Tag tag)
+{
+  return peak[tag].load(std::memory_order_relaxed);
+}
+
+/***************************************************************************\
+ * MemStats::get_allocations                                               *
+\***************************************************************************/
+unsigned long MemStats::get_allocations()
+{
+  return allocations.load(std::memory_order_relaxed);
+}
+
+unsigned long MemStats::get_allocations(Tag tag)
+{
+  return tag_allocations[tag].load(std::memory_order_relaxed);
+}
+
+/***************************************************************************\
+ * MemStats::report                                                        *
+\***************************************************************************/
+void MemStats::report(std::ostream &os)
+{
+  std::ios::fmtflags flags = os.flags();
+  std::streamsize precision = os.precision();
+
+  os << std::left << std::setw(12) << "memory" << std::right
+     << std::setw(12) << "KiB" << std::setw(12) << "peak KiB" << std::setw(12) << "allocs" << '\n';
+
+  size_t total = 0;
+  for (int i = 0; i < TAG_COUNT; i++)
+  {
+    Tag tag = static_cast<Tag>(i);
+    total += get_resident(tag);
+    os << std::left << std::setw(12) << tag_name(tag) << std::right << std::fixed << std::setprecision(1)
+       << std::setw(12) << get_resident(tag) / 1024.0
+       << std::setw(12) << get_peak(tag) / 1024.0
+       << std::setw(12) << get_allocations(tag) << '\n';
+  }
+
+  os << std::left << std::setw(12) << "total" << std::right
+     << std::setw(12) << total / 1024.0 << '\n'
+     << "heap allocations: " << get_allocations() << std::endl;
+
+  os.flags(flags);
+  os.precision(precision);
+}
@@ -0,0 +1,73 @@
+// mem_stats.h
+
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <new>
+#include <vector>
+
+// Memory accounting by subsystem.  Containers use MemStats::vector with
+// the tag of what they hold; memory outside the heap (GL objects) is
+// accounted with account().  Every heap allocation of the program is also
+// counted, tagged or not, for the allocations per frame.  Thread safe.
+namespace MemStats
+{
+  enum Tag
+  {
+    GEOMETRY,      // model topology, texture coordinates, simplified meshes
+    KEYFRAMES,     // decoded frame vertices
+    TEXTURE_CPU,   // decoded images
+    TEXTURE_GPU,   // textures, estimated
+    GPU_BUFFERS,   // vertex buffers
+    SCRATCH,       // geometry rebuilt for each frame
+    TAG_COUNT
+  };
+
+  const char *tag_name(Tag tag);
+
+  // 'bytes' more (or less, if negative) resident under 'tag'
+  void account(Tag tag, long bytes);
+
+  size_t get_resident(Tag tag);
+  size_t get_peak(Tag tag);
+  // Heap allocations since the start, all of them or under 'tag'
+  unsigned long get_allocations();
+  unsigned long get_allocations(Tag tag);
+
+  // Table of the above, one line per tag
+  void report(std::ostream &os);
+
+  // Allocator accounting its memory under TAG
+  template <typename T, Tag TAG> struct Allocator
+  {
+    typedef T value_type;
+
+    Allocator() {}
+    template <typename U> Allocator(const Allocator<U, TAG> &) {}
+    template <typename U> struct rebind { typedef Allocator<U, TAG> other; };
+
+    T *allocate(size_t n)
+    {
+      T *p = static_cast<T *>(::operator new(n * sizeof(T)));
+      account(TAG, n * sizeof(T));
+      return p;
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+      account(TAG, -static_cast<long>(n * sizeof(T)));
+      ::operator delete(p);
+    }
+  };
+
+  template <typename T, typename U, Tag TAG>
+  bool operator==(const Allocator<T, TAG> &, const Allocator<U, TAG> &) { return true; }
+  template <typename T, typename U, Tag TAG>
+  bool operator!=(const Allocator<T, TAG> &, const Allocator<U, TAG> &) { return false; }
+
+  template <typename T, Tag TAG> using vector = std::vector<T, Allocator<T, TAG> >;
+}
+
+#endif
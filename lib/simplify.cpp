@@ -0,0 +1,330 @@
+// simplify.cpp
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+#include <utility>
+
+#include "simplify.h"
+
+namespace
+{
+  // Boundary edges get a plane orthogonal to their face, weighted so that
+  // open borders keep their outline
+  const double BOUNDARY_WEIGHT = 10.0;
+
+  // Cosine of the largest turn of a kept triangle from its input triangle,
+  // so that small turns can't add up to a face standing edge-on
+  const float MIN_TURN_COS = 0.2f;
+
+  // Symmetric 4x4 error quadric, upper triangle
+  struct Quadric
+  {
+    double q[10];
+
+    Quadric() { for (double &v : q) v = 0; }
+
+    void add_plane(double a, double b, double c, double d, double w)
+    {
+      q[0] += w * a * a; q[1] += w * a * b; q[2] += w * a * c; q[3] += w * a * d;
+      q[4] += w * b * b; q[5] += w * b * c; q[6] += w * b * d;
+      q[7] += w * c * c; q[8] += w * c * d;
+      q[9] += w * d * d;
+    }
+
+    Quadric &operator+=(const Quadric &o)
+    {
+      for (int i = 0; i < 10; i++)
+        q[i] += o.q[i];
+      return *this;
+    }
+
+    double error(const vec3 &p) const
+    {
+      double x = p.x, y = p.y, z = p.z;
+      return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+           + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+           + q[7] * z * z + 2 * q[8] * z
+           + q[9];
+    }
+  };
+
+  // Collapse of 'from' onto 'to', valid while neither end has changed
+  struct Collapse
+  {
+    double cost;
+    unsigned from, to;
+    unsigned stamp_from, stamp_to;
+
+    bool operator<(const Collapse &o) const { return cost > o.cost; }
+  };
+
+  class Simplifier
+  {
+    const vec3 *positions;
+    std::vector<unsigned> tris;
+    std::vector<bool> tri_alive;
+    std::vector<vec3> tri_normals;
+    std::vector<std::vector<unsigned> > vert_tris;
+    std::vector<Quadric> quadrics;
+    std::vector<unsigned> stamp;
+    std::vector<bool> removed;
+    std::priority_queue<Collapse> heap;
+    size_t live;
+
+    vec3 normal(unsigned t, unsigned from, unsigned to) const;
+    void push_edge(unsigned a, unsigned b);
+    bool flips(unsigned from, unsigned to) const;
+    void collapse(unsigned from, unsigned to);
+  public:
+    Simplifier(const vec3 *positions, size_t num_vertices, const std::vector<unsigned> &indices);
+
+    bool step();
+    size_t live_tris() const { return live; }
+    std::vector<unsigned> snapshot(std::vector<unsigned> *sources) const;
+  };
+}
+
+/*-------------------------------------------------------------------------*\
+ * Simplifier::Simplifier                                                  *
+\*-------------------------------------------------------------------------*/
+Simplifier::Simplifier(const vec3 *positions, size_t num_vertices,
+                       const std::vector<unsigned> &indices)
+  : positions(positions), tris(indices), tri_alive(indices.size() / 3, true),
+    tri_normals(indices.size() / 3), vert_tris(num_vertices), quadrics(num_vertices),
+    stamp(num_vertices, 0), removed(num_vertices, false), live(indices.size() / 3)
+{
+  // Count the undirected edges to find the boundaries
+  std::map<std::pair<unsigned, unsigned>, int> edge_use;
+
+  for (size_t t = 0; t < live; t++)
+  {
+    const unsigned *v = &tris[t * 3];
+    const vec3 &a = positions[v[0]], &b = positions[v[1]], &c = positions[v[2]];
+    vec3 n = (b - a) ^ (c - a);
+    double area2 = std::sqrt(n.dot(n));
+    tri_normals[t] = n;
+
+    for (int j = 0; j < 3; j++)
+    {
+      vert_tris[v[j]].push_back(t);
+      unsigned e0 = std::min(v[j], v[(j + 1) % 3]), e1 = std::max(v[j], v[(j + 1) % 3]);
+      edge_use[std::make_pair(e0, e1)]++;
+    }
+
+    if (area2 <= 0)
+      continue;
+
+    // Plane of the face, weighted by its area
+    double nx = n.x / area2, ny = n.y / area2, nz = n.z / area2;
+    double d = -(nx * a.x + ny * a.y + nz * a.z);
+    for (int j = 0; j < 3; j++)
+      quadrics[v[j]].add_plane(nx, ny, nz, d, area2 * 0.5);
+  }
+
+  for (size_t t = 0; t < tri_alive.size(); t++)
+  {
+    const unsigned *v = &tris[t * 3];
+    const vec3 &a = positions[v[0]], &b = positions[v[1]], &c = positions[v[2]];
+    vec3 n = (b - a) ^ (c - a);
+
+    for (int j = 0; j < 3; j++)
+    {
+      unsigned i0 = v[j], i1 = v[(j + 1) % 3];
+      if (edge_use[std::make_pair(std::min(i0, i1), std::max(i0, i1))] != 1)
+        continue;
+
+      vec3 e = positions[i1] - positions[i0];
+      vec3 p = e ^ n;
+      double len = std::sqrt(p.dot(p));
+      if (len <= 0)
+        continue;
+
+      double px = p.x / len, py = p.y / len, pz = p.z / len;
+      double d = -(px * positions[i0].x + py * positions[i0].y + pz * positions[i0].z);
+      double w = BOUNDARY_WEIGHT * e.dot(e);
+      quadrics[i0].add_plane(px, py, pz, d, w);
+      quadrics[i1].add_plane(px, py, pz, d, w);
+    }
+  }
+
+  for (auto &edge : edge_use)
+    push_edge(edge.first.first, edge.first.second);
+}
+
+/*-------------------------------------------------------------------------*\
+ * Simplifier::push_edge                                                   *
+ * Queue the cheapest direction of the collapse of edge (a, b).            *
+\*-------------------------------------------------------------------------*/
+void Simplifier::push_edge(unsigned a, unsigned b)
+{
+  Quadric q = quadrics[a];
+  q += quadrics[b];
+
+  double cost_ab = q.error(positions[b]);
+  double cost_ba = q.error(positions[a]);
+
+  if (cost_ab <= cost_ba)
+    heap.push(Collapse{cost_ab, a, b, stamp[a], stamp[b]});
+  else
+    heap.push(Collapse{cost_ba, b, a, stamp[b], stamp[a]});
+}
+
+/*-------------------------------------------------------------------------*\
+ * Simplifier::normal                                                      *
+ * Normal of triangle t once 'from' is replaced by 'to'.                   *
+\*-------------------------------------------------------------------------*/
+vec3 Simplifier::normal(unsigned t, unsigned from, unsigned to) const
+{
+  vec3 p[3];
+  for (int j = 0; j < 3; j++)
+  {
+    unsigned v = tris[t * 3 + j];
+    p[j] = positions[v == from ? to : v];
+  }
+  return (p[1] - p[0]) ^ (p[2] - p[0]);
+}
+
+/*-------------------------------------------------------------------------*\
+ * Simplifier::flips                                                       *
+ * True if moving 'from' onto 'to' would turn over or flatten one of the   *
+ * triangles which survive the collapse, or turn it too far from the input *
+ * triangle it comes from.                                                 *
+\*-------------------------------------------------------------------------*/
+bool Simplifier::flips(unsigned from, unsigned to) const
+{
+  for (unsigned t : vert_tris[from])
+  {
+    if (!tri_alive[t])
+      continue;
+
+    const unsigned *v = &tris[t * 3];
+    if (v[0] == to || v[1] == to || v[2] == to)
+      continue;
+
+    vec3 before = normal(t, from, from);
+    vec3 after = normal(t, from, to);
+    if (before.dot(before) > 0 && (after.dot(after) <= 0 || before.dot(after) <= 0))
+      return true;
+
+    const vec3 &input = tri_normals[t];
+    float lengths = std::sqrt(input.dot(input) * after.dot(after));
+    if (lengths > 0 && input.dot(after) <= MIN_TURN_COS * lengths)
+      return true;
+  }
+  return false;
+}
+
+/*-------------------------------------------------------------------------*\
+ * Simplifier::collapse                                                    *
+\*-------------------------------------------------------------------------*/
+void Simplifier::collapse(unsigned from, unsigned to)
+{
+  for (unsigned t : vert_tris[from])
+  {
+    if (!tri_alive[t])
+      continue;
+
+    unsigned *v = &tris[t * 3];
+    if (v[0] == to || v[1] == to || v[2] == to)
+    {
+      tri_alive[t] = false;
+      live--;
+      continue;
+    }
+
+    for (int j = 0; j < 3; j++)
+      if (v[j] == from)
+        v[j] = to;
+    vert_tris[to].push_back(t);
+  }
+
+  std::vector<unsigned>().swap(vert_tris[from]);
+  quadrics[to] += quadrics[from];
+  removed[from] = true;
+  stamp[to]++;
+
+  // The costs of the edges around 'to' have changed
+  std::vector<unsigned> &around = vert_tris[to];
+  size_t kept = 0;
+  for (unsigned t : around)
+  {
+    if (!tri_alive[t])
+      continue;
+    around[kept++] = t;
+
+    const unsigned *v = &tris[t * 3];
+    for (int j = 0; j < 3; j++)
+      if (v[j] != to)
+        push_edge(to, v[j]);
+  }
+  around.resize(kept);
+}
+
+/*-------------------------------------------------------------------------*\
+ * Simplifier::step                                                        *
+ * Perform the cheapest valid collapse.  False once none is left.          *
+\*-------------------------------------------------------------------------*/
+bool Simplifier::step()
+{
+  while (!heap.empty())
+  {
+    Collapse c = heap.top();
+    heap.pop();
+
+    if (removed[c.from] || removed[c.to] ||
+        stamp[c.from] != c.stamp_from || stamp[c.to] != c.stamp_to)
+      continue;
+
+    if (flips(c.from, c.to))
+      continue;
+
+    collapse(c.from, c.to);
+    return true;
+  }
+  return false;
+}
+
+/*-------------------------------------------------------------------------*\
+ * Simplifier::snapshot                                                    *
+\*-------------------------------------------------------------------------*/
+std::vector<unsigned> Simplifier::snapshot(std::vector<unsigned> *sources) const
+{
+  std::vector<unsigned> indices;
+  indices.reserve(live * 3);
+
+  for (size_t t = 0; t < tri_alive.size(); t++)
+    if (tri_alive[t])
+    {
+      indices.insert(indices.end(), &tris[t * 3], &tris[t * 3] + 3);
+      if (sources)
+        sources->push_back(t);
+    }
+
+  return indices;
+}
+
+/***************************************************************************\
+ * simplify_mesh                                                           *
+\***************************************************************************/
+std::vector<std::vector<unsigned> > simplify_mesh(const vec3 *positions, size_t num_vertices,
+                                                  const std::vector<unsigned> &indices,
+                                                  const std::vector<size_t> &targets,
+                                                  std::vector<std::vector<unsigned> > *sources)
+{
+  std::vector<std::vector<unsigned> > levels;
+  Simplifier simplifier(positions, num_vertices, indices);
+
+  if (sources)
+    sources->assign(targets.size(), std::vector<unsigned>());
+
+  for (size_t i = 0; i < targets.size(); i++)
+  {
+    while (simplifier.live_tris() > targets[i] && simplifier.step())
+      ;
+    levels.push_back(simplifier.snapshot(sources ? &(*sources)[i] : nullptr));
+  }
+
+  return levels;
+}
@@ -0,0 +1,27 @@
+// simplify.h
+
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <cstddef>
+#include <vector>
+
+#include "vec3.h"
+
+// Quadric error edge collapse (Garland & Heckbert).  Vertices are never
+// moved: an edge collapses onto one of its ends, so the simplified index
+// arrays stay valid for any positions sharing the topology, such as every
+// frame of an animation.
+//
+// 'indices' holds the triangles, three per triangle.  One index array is
+// returned per entry of 'targets' (triangle counts, decreasing).  A level
+// may keep more triangles than asked when no collapse is left that doesn't
+// flip a face.  Kept triangles retain the order of their corners; if
+// 'sources' is given it receives, per level, the input triangle each one
+// comes from (to carry per-corner attributes over).
+std::vector<std::vector<unsigned> > simplify_mesh(const vec3 *positions, size_t num_vertices,
+                                                  const std::vector<unsigned> &indices,
+                                                  const std::vector<size_t> &targets,
+                                                  std::vector<std::vector<unsigned> > *sources = nullptr);
+
+#endif
@@ -0,0 +1,157 @@
+// stream_buffer.cpp
+
+#include "gl_state.h"
+#include "mem_stats.h"
+#include "stream_buffer.h"
+
+StreamBuffer stream_buffer;
+
+namespace
+{
+  // Offsets are kept aligned for any vertex attribute
+  const size_t ALIGNMENT = 16;
+}
+
+/***************************************************************************\
+ * StreamBuffer::StreamBuffer                                              *
+\***************************************************************************/
+StreamBuffer::StreamBuffer() : buffer(0), segment_size(0), persistent(false), mapping(nullptr),
+    segment(0), used(0), frame(1)
+{
+  for (GLsync &fence : fences)
+    fence = nullptr;
+}
+
+/***************************************************************************\
+ * StreamBuffer::init                                                      *
+\***************************************************************************/
+bool StreamBuffer::init(size_t bytes)
+{
+  release();
+
+  if (!gl_supports(3, 2, "GL_ARB_sync") || !gl_supports(3, 0, "GL_ARB_map_buffer_range"))
+    return false;
+
+  segment_size = bytes / SEGMENTS / ALIGNMENT * ALIGNMENT;
+  if (segment_size == 0)
+    return false;
+
+  persistent = gl_supports(4, 4, "GL_ARB_buffer_storage");
+
+  glGenBuffers(1, &buffer);
+  gl_state.bind_buffer(buffer);
+
+  if (persistent)
+  {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_ARRAY_BUFFER, segment_size * SEGMENTS, nullptr, flags);
+    mapping = static_cast<char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, segment_size * SEGMENTS, flags));
+  }
+  else
+    glBufferData(GL_ARRAY_BUFFER, segment_size * SEGMENTS, nullptr, GL_STREAM_DRAW);
+
+  gl_state.bind_buffer(0);
+  MemStats::account(MemStats::GPU_BUFFERS, segment_size * SEGMENTS);
+
+  if (persistent && !mapping)
+  {
+    release();
+    return false;
+  }
+
+  segment = 0;
+  used = 0;
+  return true;
+}
+
+/***************************************************************************\
+ * StreamBuffer::release                                                   *
+\***************************************************************************/
+void StreamBuffer::release()
+{
+  for (GLsync &fence : fences)
+  {
+    if (fence)
+      glDeleteSync(fence);
+    fence = nullptr;
+  }
+
+  if (buffer)
+  {
+    if (mapping)
+    {
+      gl_state.bind_buffer(buffer);
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    gl_state.bind_buffer(0);
+    glDeleteBuffers(1, &buffer);
+    MemStats::account(MemStats::GPU_BUFFERS, -static_cast<long>(segment_size * SEGMENTS));
+  }
+
+  buffer = 0;
+  mapping = nullptr;
+}
+
+/***************************************************************************\
+ * StreamBuffer::begin_frame                                               *
+ * Move to the next segment, waiting for the GL to be done with it.        *
+\***************************************************************************/
+void StreamBuffer::begin_frame()
+{
+  frame++;
+  segment = (segment + 1) % SEGMENTS;
+  used = 0;
+
+  GLsync &fence = fences[segment];
+  if (!fence)
+    return;
+
+  // Normally long signaled, SEGMENTS - 1 frames later
+  while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+    ;
+
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+/***************************************************************************\
+ * StreamBuffer::end_frame                                                 *
+\***************************************************************************/
+void StreamBuffer::end_frame()
+{
+  if (buffer && used > 0)
+    fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/***************************************************************************\
+ * StreamBuffer::map                                                       *
+\***************************************************************************/
+void *StreamBuffer::map(size_t bytes, GLintptr &offset)
+{
+  size_t aligned = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  if (!buffer || bytes == 0 || used + aligned > segment_size)
+    return nullptr;
+
+  offset = segment * segment_size + used;
+  used += aligned;
+
+  if (persistent)
+    return mapping + offset;
+
+  // The segment isn't in use by the GL: no need to synchronize
+  gl_state.bind_buffer(buffer);
+  return glMapBufferRange(GL_ARRAY_BUFFER, offset, bytes, GL_MAP_WRITE_BIT |
+                          GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+}
+
+/***************************************************************************\
+ * StreamBuffer::unmap                                                     *
+\***************************************************************************/
+void StreamBuffer::unmap()
+{
+  if (persistent)
+    return;
+
+  gl_state.bind_buffer(buffer);
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+}
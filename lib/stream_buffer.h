@@ -0,0 +1,62 @@
+// stream_buffer.h
+
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <cstddef>
+
+#include <GL/gl.h>
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// class StreamBuffer -- vertex buffer ring for data rebuilt every frame.
+//
+// The buffer is split in segments, one per frame in flight.  Each frame
+// writes into its own segment, then a fence is inserted; a segment is
+// reused only once its fence has passed, so writes never wait on the GL
+// nor make it copy.  With GL_ARB_buffer_storage the buffer stays mapped
+// (persistent, coherent); otherwise each range is mapped unsynchronized.
+// Data written in a frame is valid for the draws of that frame only.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+class StreamBuffer
+{
+  static const int SEGMENTS = 3;
+
+  GLuint buffer;
+  size_t segment_size;
+  GLsync fences[SEGMENTS];
+  bool persistent;
+  char *mapping;          // whole buffer, when persistent
+
+  int segment;            // written this frame
+  size_t used;            // bytes of it
+  unsigned long frame;
+public:
+  StreamBuffer();
+
+  // 'bytes' for all the segments.  Returns false if the GL implementation
+  // lacks buffer objects or fences.
+  bool init(size_t bytes);
+  void release();
+  bool ready() const { return buffer != 0; }
+
+  // Frame boundaries: draws using the buffer go between these calls
+  void begin_frame();
+  void end_frame();
+
+  // Room for 'bytes' in this frame's segment: returns where to write them,
+  // and their offset in the buffer in 'offset', or null when the segment is
+  // full.  Writes must be done before unmap(), itself before the draws.
+  void *map(size_t bytes, GLintptr &offset);
+  void unmap();
+
+  GLuint get_buffer() const { return buffer; }
+  // Frame number, never 0
+  unsigned long get_frame() const { return frame; }
+};
+
+extern StreamBuffer stream_buffer;
+
+#endif
@@ -3,24 +3,42 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 
+#include "gl_state.h"
 #include "texture.h"
 #include "image.h"
+#include "mem_stats.h"
+#include "trace.h"
 
 /***************************************************************************\
  * TextureManager::get_texture                                             *
 \***************************************************************************/
-GLuint TextureManager::get_texture(const std::string &filename)
+GLuint TextureManager::get_texture(const std::string &name, const FileSpan &data)
 {
-  auto it = registred_textures.find(filename);
+  Trace::Scope trace("TextureManager::get_texture");
+  auto it = registred_textures.find(name);
+  if (it != registred_textures.end())
+    return it->second;
+
+  return add_texture(name, Image(name, data));
+}
+
+/***************************************************************************\
+ * TextureManager::add_texture                                             *
+ * Upload an image decoded beforehand (possibly on another thread).  The   *
+ * texture is bound through gl_state, so this is safe within a frame.      *
+\***************************************************************************/
+GLuint TextureManager::add_texture(const std::string &name, const Image &image)
+{
+  Trace::Scope trace("TextureManager::add_texture");
+  auto it = registred_textures.find(name);
   if (it != registred_textures.end())
     return it->second;
 
-  Image  image(filename);
   GLuint texture;
 
   // Generate a texture name
   glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
+  gl_state.bind_texture(texture);
 
   // Setup texture filters
   glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -30,7 +48,10 @@ GLuint TextureManager::get_texture(const std::string &filename)
 
   gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGB, image.get_width(), image.get_height(), GL_RGB,
                      GL_UNSIGNED_BYTE, image.get_pixels());
-  registred_textures[filename] = texture;
+  // Estimate: drivers store RGB as 4 bytes per texel, plus a third for the
+  // mipmaps.  Textures are never deleted (see below).
+  MemStats::account(MemStats::TEXTURE_GPU, image.get_width() * image.get_height() * 4 * 4 / 3);
+  registred_textures[name] = texture;
   return texture;
 }
 
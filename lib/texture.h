@@ -8,12 +8,17 @@
 
 #include <GL/gl.h>
 
+#include "vfs.h"
+
+class Image;
+
 class TextureManager
 {
   std::map<std::string, GLuint> registred_textures;
 public:
   ~TextureManager();
-  GLuint get_texture(const std::string &filename);
+  GLuint get_texture(const std::string &name, const FileSpan &data);
+  GLuint add_texture(const std::string &name, const Image &image);
 };
 
 #endif
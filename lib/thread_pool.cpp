@@ -0,0 +1,97 @@
+// thread_pool.cpp
+
+#include "thread_pool.h"
+
+/***************************************************************************\
+ * ThreadPool::ThreadPool                                                  *
+\***************************************************************************/
+ThreadPool::ThreadPool(int threads) : pending(0), stopping(false)
+{
+  if (threads < 0)
+    threads = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+
+  for (int i = 0; i < threads; i++)
+    workers.push_back(std::thread(&ThreadPool::worker_loop, this));
+}
+
+/***************************************************************************\
+ * ThreadPool::~ThreadPool                                                 *
+\***************************************************************************/
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  work_available.notify_all();
+
+  for (auto &worker : workers)
+    worker.join();
+}
+
+/***************************************************************************\
+ * ThreadPool::submit                                                      *
+\***************************************************************************/
+void ThreadPool::submit(const std::function<void()> &task)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    tasks.push_back(task);
+    pending++;
+  }
+  work_available.notify_one();
+}
+
+/***************************************************************************\
+ * ThreadPool::wait                                                        *
+\***************************************************************************/
+void ThreadPool::wait()
+{
+  std::unique_lock<std::mutex> guard(lock);
+
+  while (pending > 0)
+  {
+    if (tasks.empty())
+    {
+      work_done.wait(guard);
+      continue;
+    }
+
+    std::function<void()> task = std::move(tasks.front());
+    tasks.pop_front();
+
+    guard.unlock();
+    task();
+    guard.lock();
+
+    if (--pending == 0)
+      work_done.notify_all();
+  }
+}
+
+/*-------------------------------------------------------------------------*\
+ * ThreadPool::worker_loop                                                 *
+\*-------------------------------------------------------------------------*/
+void ThreadPool::worker_loop()
+{
+  std::unique_lock<std::mutex> guard(lock);
+
+  for (;;)
+  {
+    while (tasks.empty() && !stopping)
+      work_available.wait(guard);
+
+    if (tasks.empty())
+      return;
+
+    std::function<void()> task = std::move(tasks.front());
+    tasks.pop_front();
+
+    guard.unlock();
+    task();
+    guard.lock();
+
+    if (--pending == 0)
+      work_done.notify_all();
+  }
+}
@@ -0,0 +1,41 @@
+// thread_pool.h
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads consuming a FIFO of tasks.  wait() blocks
+// until every submitted task has run; the waiting thread runs queued tasks
+// itself meanwhile, so a pool of size 0 executes everything in wait().
+class ThreadPool
+{
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()> > tasks;
+  std::mutex lock;
+  std::condition_variable work_available;
+  std::condition_variable work_done;
+  size_t pending;
+  bool stopping;
+
+  void worker_loop();
+public:
+  // Defaults to one worker per hardware thread, minus the caller's
+  ThreadPool(int threads = -1);
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  void submit(const std::function<void()> &task);
+  void wait();
+
+  // Number of threads running tasks during wait(), caller included
+  unsigned concurrency() const { return workers.size() + 1; }
+};
+
+#endif
@@ -0,0 +1,194 @@
+// trace.cpp
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+
+namespace
+{
+  struct Event
+  {
+    const char *name;
+    long long start_ns;
+    long long duration_ns;
+  };
+
+  // Events of a thread, in fixed size chunks.  Only the owning thread
+  // appends; the reader follows 'size' and 'next', published with release.
+  struct Chunk
+  {
+    static const int CAPACITY = 4096;
+    Event events[CAPACITY];
+    std::atomic<int> size;
+    std::atomic<Chunk *> next;
+
+    Chunk() : size(0), next(nullptr) {}
+  };
+
+  struct ThreadBuffer
+  {
+    int tid;
+    unsigned generation;  // recording the chunks belong to
+    Chunk *first;
+    Chunk *last;
+
+    ThreadBuffer(int tid) : tid(tid), generation(0), first(nullptr), last(nullptr) {}
+  };
+
+  std::atomic<bool> recording(false);
+  std::atomic<unsigned> generation(0);
+
+  // Buffers are registered once per thread and kept until exit, as
+  // threads may end before the trace is written
+  std::mutex registry_lock;
+  std::vector<ThreadBuffer *> registry;
+
+  long long now_ns()
+  {
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - epoch).count();
+  }
+
+  void free_chunks(ThreadBuffer *buffer)
+  {
+    for (Chunk *chunk = buffer->first; chunk; )
+    {
+      Chunk *next = chunk->next.load(std::memory_order_relaxed);
+      delete chunk;
+      chunk = next;
+    }
+    buffer->first = buffer->last = nullptr;
+  }
+
+  ThreadBuffer *thread_buffer()
+  {
+    static thread_local ThreadBuffer *buffer = nullptr;
+    if (!buffer)
+    {
+      std::lock_guard<std::mutex> guard(registry_lock);
+      buffer = new ThreadBuffer(registry.size() + 1);
+      registry.push_back(buffer);
+    }
+    return buffer;
+  }
+
+  /*-----------------------------------------------------------------------*\
+   * record                                                                *
+   * Chunks left from a previous recording are dropped by their thread,   *
+   * under the registry lock like any change to the chunk list head.       *
+  \*-----------------------------------------------------------------------*/
+  void record(const Event &event)
+  {
+    ThreadBuffer *buffer = thread_buffer();
+    unsigned current = generation.load(std::memory_order_acquire);
+
+    if (buffer->generation != current)
+    {
+      std::lock_guard<std::mutex> guard(registry_lock);
+      free_chunks(buffer);
+      buffer->generation = current;
+    }
+
+    Chunk *chunk = buffer->last;
+    if (!chunk || chunk->size.load(std::memory_order_relaxed) == Chunk::CAPACITY)
+    {
+      Chunk *fresh = new Chunk;
+      if (chunk)
+        chunk->next.store(fresh, std::memory_order_release);
+      else
+      {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        buffer->first = fresh;
+      }
+      buffer->last = chunk = fresh;
+    }
+
+    int size = chunk->size.load(std::memory_order_relaxed);
+    chunk->events[size] = event;
+    chunk->size.store(size + 1, std::memory_order_release);
+  }
+}
+
+/***************************************************************************\
+ * Trace::start                                                            *
+\***************************************************************************/
+void Trace::start()
+{
+  now_ns();
+  generation.fetch_add(1, std::memory_order_release);
+  recording.store(true, std::memory_order_relaxed);
+}
+
+/***************************************************************************\
+ * Trace::stop                                                             *
+\***************************************************************************/
+bool Trace::stop(const std::string &filename)
+{
+  recording.store(false, std::memory_order_relaxed);
+
+  std::ofstream ofs(filename.c_str());
+  if (ofs.fail())
+    return false;
+
+  unsigned current = generation.load(std::memory_order_relaxed);
+  bool first_event = true;
+
+  // Microseconds, to the nanosecond
+  ofs << std::fixed << std::setprecision(3);
+  ofs << "{\"traceEvents\":[";
+
+  std::lock_guard<std::mutex> guard(registry_lock);
+  for (ThreadBuffer *buffer : registry)
+  {
+    if (buffer->generation != current)
+      continue;
+
+    for (Chunk *chunk = buffer->first; chunk; chunk = chunk->next.load(std::memory_order_acquire))
+    {
+      int size = chunk->size.load(std::memory_order_acquire);
+      for (int i = 0; i < size; i++)
+      {
+        const Event &event = chunk->events[i];
+        ofs << (first_event ? "\n" : ",\n")
+            << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+            << ",\"ts\":" << event.start_ns / 1000.0 << ",\"dur\":" << event.duration_ns / 1000.0 << '}';
+        first_event = false;
+      }
+    }
+  }
+
+  ofs << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return !ofs.fail();
+}
+
+/***************************************************************************\
+ * Trace::is_recording                                                     *
+\***************************************************************************/
+bool Trace::is_recording()
+{
+  return recording.load(std::memory_order_relaxed);
+}
+
+/***************************************************************************\
+ * Trace::Scope::Scope                                                     *
+\***************************************************************************/
+Trace::Scope::Scope(const char *name) : name(name), start_ns(-1)
+{
+  if (recording.load(std::memory_order_relaxed))
+    start_ns = now_ns();
+}
+
+/***************************************************************************\
+ * Trace::Scope::~Scope                                                    *
+\***************************************************************************/
+Trace::Scope::~Scope()
+{
+  if (start_ns >= 0)
+    record(Event{name, start_ns, now_ns() - start_ns});
+}
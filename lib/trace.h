@@ -0,0 +1,33 @@
+// trace.h
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+// Scoped markers written as a Chrome trace (chrome://tracing, Perfetto).
+// Each thread records into its own buffer, without locks; start() and
+// stop() are called from one thread, and stop() writes the JSON file.
+// While not recording a marker costs a relaxed atomic load.
+namespace Trace
+{
+  void start();
+  // Write the events recorded since start() to 'filename'
+  bool stop(const std::string &filename);
+  bool is_recording();
+
+  // Records a complete event from construction to destruction.  'name'
+  // must outlive the recording (string literals).
+  class Scope
+  {
+    const char *name;
+    long long start_ns;  // -1 when not recording
+  public:
+    explicit Scope(const char *name);
+    ~Scope();
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+  };
+}
+
+#endif
@@ -20,6 +20,9 @@ struct vec3
   vec3& operator*=(const vec3&v){x*=v.x;y*=v.y;z*=v.z;return*this;}
   vec3& operator/=(const vec3&v){x/=v.x;y/=v.y;z/=v.z;return*this;}
 
+  bool operator==(const vec3&v)const{return x==v.x&&y==v.y&&z==v.z;}
+  bool operator!=(const vec3&v)const{return !(*this==v);}
+
   vec3 operator-()const{return vec3(-x,-y,-z);}
   vec3 operator*(float f)const{return vec3(x*f,y*f,z*f);}
   vec3 operator/(float f)const{return vec3(x/f,y/f,z/f);}
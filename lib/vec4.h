@@ -22,7 +22,7 @@ struct vec4
 
   vec4 operator-()const{return vec4(-x,-y,-z,-w);}
   vec4 operator*(float f)const{return vec4(x*f,y*f,z*f,w*f);}
-  vec4 operator/(float f)const{return vec4(x/f,y/f,z/f,w*f);}
+  vec4 operator/(float f)const{return vec4(x/f,y/f,z/f,w/f);}
 
   vec4& operator*=(float f){x*=f;y*=f;z*=f;w*=f;return*this;}
   vec4& operator/=(float f){x/=f;y/=f;z/=f;w/=f;return*this;}
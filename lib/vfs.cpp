@@ -0,0 +1,271 @@
+// vfs.cpp
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vfs.h"
+
+namespace
+{
+#pragma pack(push, 1)
+  // Quake pak header
+  struct PakHeader
+  {
+    char ident[4];    // "PACK"
+    int  dir_offset;  // offset to the directory
+    int  dir_length;  // directory size, in bytes
+  };
+
+  // Quake pak directory entry
+  struct PakEntry
+  {
+    char name[56];
+    int  filepos;
+    int  filelen;
+  };
+#pragma pack(pop)
+
+  std::string normalize(const std::string &name)
+  {
+    std::string::size_type p = 0;
+    while (name.compare(p, 2, "./") == 0)
+      p += 2;
+    while (p < name.length() && name[p] == '/')
+      p++;
+    return name.substr(p);
+  }
+}
+
+/***************************************************************************\
+ * Vfs::~Vfs                                                               *
+\***************************************************************************/
+Vfs::~Vfs()
+{
+  for (auto &mount : mounts)
+    if (mount.archive.addr)
+      munmap(mount.archive.addr, mount.archive.size);
+
+  for (auto &file : loose_files)
+    munmap(file.second.addr, file.second.size);
+}
+
+/***************************************************************************\
+ * Vfs::join                                                               *
+\***************************************************************************/
+std::string Vfs::join(const std::string &dirname, const std::string &name)
+{
+  if (dirname.empty())
+    return name;
+  if (dirname[dirname.length() - 1] == '/')
+    return dirname + name;
+  return dirname + "/" + name;
+}
+
+/*-------------------------------------------------------------------------*\
+ * Vfs::map_file                                                           *
+ * Map a whole file read-only.  Empty files cannot be mapped.              *
+\*-------------------------------------------------------------------------*/
+bool Vfs::map_file(const std::string &filename, Mapping &mapping)
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (addr == MAP_FAILED)
+    return false;
+
+  mapping.addr = addr;
+  mapping.size = st.st_size;
+  return true;
+}
+
+/***************************************************************************\
+ * Vfs::mount                                                              *
+ * Mount a directory or a .pak archive.                                    *
+\***************************************************************************/
+bool Vfs::mount(const std::string &path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return false;
+
+  if (!S_ISDIR(st.st_mode))
+    return mount_pak(path);
+
+  Mount m;
+  m.root = path;
+  m.archive.addr = nullptr;
+  m.archive.size = 0;
+  mounts.push_back(std::move(m));
+  return true;
+}
+
+/*-------------------------------------------------------------------------*\
+ * Vfs::mount_pak                                                          *
+ * Map the archive and build its hashed directory index.                   *
+\*-------------------------------------------------------------------------*/
+bool Vfs::mount_pak(const std::string &filename)
+{
+  Mount m;
+  if (!map_file(filename, m.archive))
+    return false;
+
+  const unsigned char *base = static_cast<const unsigned char *>(m.archive.addr);
+  size_t size = m.archive.size;
+  PakHeader header;
+
+  if (size < sizeof(PakHeader))
+    goto bad_archive;
+
+  std::memcpy(&header, base, sizeof(PakHeader));
+  if (std::memcmp(header.ident, "PACK", 4) != 0 ||
+      header.dir_offset < 0 || header.dir_length < 0 ||
+      static_cast<size_t>(header.dir_offset) + header.dir_length > size)
+    goto bad_archive;
+
+  for (size_t i = 0; i < header.dir_length / sizeof(PakEntry); i++)
+  {
+    PakEntry entry;
+    std::memcpy(&entry, base + header.dir_offset + i * sizeof(PakEntry), sizeof(PakEntry));
+
+    if (entry.filepos < 0 || entry.filelen < 0 ||
+        static_cast<size_t>(entry.filepos) + entry.filelen > size)
+      goto bad_archive;
+
+    std::string name = normalize(std::string(entry.name, strnlen(entry.name, sizeof(entry.name))));
+    Entry e = { static_cast<size_t>(entry.filepos), static_cast<size_t>(entry.filelen) };
+    m.index[name] = e;
+
+    std::string::size_type slash = name.find_last_of('/');
+    if (slash == std::string::npos)
+      m.dirs[""].push_back(name);
+    else
+      m.dirs[name.substr(0, slash)].push_back(name.substr(slash + 1));
+  }
+
+  mounts.push_back(std::move(m));
+  return true;
+
+bad_archive:
+  std::cerr << "Bad pak archive: " << filename << std::endl;
+  munmap(m.archive.addr, m.archive.size);
+  return false;
+}
+
+/***************************************************************************\
+ * Vfs::open                                                               *
+ * Return a view on the file data, or an empty span if it is not found.    *
+\***************************************************************************/
+FileSpan Vfs::open(const std::string &name) const
+{
+  const std::string key = normalize(name);
+
+  for (auto m = mounts.rbegin(); m != mounts.rend(); ++m)
+  {
+    if (m->archive.addr)
+    {
+      auto it = m->index.find(key);
+      if (it != m->index.end())
+        return FileSpan(static_cast<const unsigned char *>(m->archive.addr) + it->second.offset,
+                        it->second.size);
+      continue;
+    }
+
+    const std::string path = join(m->root, key);
+    std::lock_guard<std::mutex> guard(loose_lock);
+
+    auto it = loose_files.find(path);
+    if (it == loose_files.end())
+    {
+      Mapping mapping;
+      if (!map_file(path, mapping))
+        continue;
+      it = loose_files.insert(std::make_pair(path, mapping)).first;
+    }
+    return FileSpan(static_cast<const unsigned char *>(it->second.addr), it->second.size);
+  }
+
+  return FileSpan();
+}
+
+/***************************************************************************\
+ * Vfs::exists                                                             *
+\***************************************************************************/
+bool Vfs::exists(const std::string &name) const
+{
+  const std::string key = normalize(name);
+
+  for (auto m = mounts.rbegin(); m != mounts.rend(); ++m)
+  {
+    struct stat st;
+    if (m->archive.addr ? m->index.count(key) != 0
+                        : stat(join(m->root, key).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+      return true;
+  }
+
+  return false;
+}
+
+/***************************************************************************\
+ * Vfs::list                                                               *
+\***************************************************************************/
+std::vector<std::string> Vfs::list(const std::string &dirname) const
+{
+  std::string key = normalize(dirname);
+  std::set<std::string> names;
+
+  while (!key.empty() && key[key.length() - 1] == '/')
+    key.erase(key.length() - 1);
+
+  for (auto &m : mounts)
+  {
+    if (m.archive.addr)
+    {
+      auto it = m.dirs.find(key);
+      if (it != m.dirs.end())
+        names.insert(it->second.begin(), it->second.end());
+      continue;
+    }
+
+    const std::string path = join(m.root, key);
+    DIR *dd = opendir(path.c_str());
+    if (!dd)
+      continue;
+
+    dirent *dit;
+    while ((dit = readdir(dd)) != nullptr)
+    {
+      // The type from readdir spares a stat per entry; file systems which
+      // don't fill it, and links, still need one
+      bool file = dit->d_type == DT_REG;
+      if (dit->d_type == DT_UNKNOWN || dit->d_type == DT_LNK)
+      {
+        struct stat st;
+        file = stat(join(path, dit->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode);
+      }
+      if (file)
+        names.insert(dit->d_name);
+    }
+    closedir(dd);
+  }
+
+  return std::vector<std::string>(names.begin(), names.end());
+}
@@ -0,0 +1,75 @@
+// vfs.h
+
+#ifndef VFS_H
+#define VFS_H
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Read-only view on the bytes of a file.  It points into a mapping owned by
+// the Vfs which returned it and stays valid as long as that Vfs lives.
+struct FileSpan
+{
+  const unsigned char *data;
+  size_t size;
+  FileSpan():data(nullptr),size(0){}
+  FileSpan(const unsigned char *d, size_t s):data(d),size(s){}
+  bool empty() const { return data == nullptr; }
+};
+
+// Virtual file system.  Mounts plain directories and Quake .pak archives;
+// archives are mapped once and looked up through a hashed directory index,
+// files of plain directories are mapped on first open.  Names use '/' as
+// separator and are relative to the mount point.  Later mounts shadow
+// earlier ones, like Quake's search path.
+class Vfs
+{
+  struct Mapping
+  {
+    void  *addr;
+    size_t size;
+  };
+
+  struct Entry
+  {
+    size_t offset;
+    size_t size;
+  };
+
+  struct Mount
+  {
+    std::string root;   // directory mounts only
+    Mapping archive;    // archive mounts only
+    std::unordered_map<std::string, Entry> index;
+    std::unordered_map<std::string, std::vector<std::string> > dirs;
+  };
+
+  std::vector<Mount> mounts;
+
+  // Mapped files of directory mounts, by full path
+  mutable std::mutex loose_lock;
+  mutable std::unordered_map<std::string, Mapping> loose_files;
+
+  bool mount_pak(const std::string &filename);
+  static bool map_file(const std::string &filename, Mapping &mapping);
+public:
+  Vfs() {}
+  Vfs(const Vfs &) = delete;
+  Vfs &operator=(const Vfs &) = delete;
+  ~Vfs();
+
+  bool mount(const std::string &path);
+
+  FileSpan open(const std::string &name) const;
+  bool exists(const std::string &name) const;
+
+  // Sorted names of the files directly inside 'dirname'
+  std::vector<std::string> list(const std::string &dirname) const;
+
+  static std::string join(const std::string &dirname, const std::string &name);
+};
+
+#endif
@@ -0,0 +1,221 @@
+// anorms.cpp
+
+#include <algorithm>
+#include <cmath>
+
+#include "anorms.h"
+
+namespace
+{
+  // Quantization of the light direction
+  const int YAW_STEPS = 16;
+  const int PITCH_STEPS = 9;
+
+  struct DotTable
+  {
+    unsigned char dots[PITCH_STEPS][YAW_STEPS][Md2::NUM_ANORMS];
+
+    DotTable()
+    {
+      for (int p = 0; p < PITCH_STEPS; p++)
+        for (int y = 0; y < YAW_STEPS; y++)
+        {
+          float pitch = static_cast<float>(M_PI) * (static_cast<float>(p) / (PITCH_STEPS - 1) - 0.5f);
+          float yaw = 2 * static_cast<float>(M_PI) * y / YAW_STEPS;
+          vec3 light(std::cos(pitch) * std::cos(yaw), std::cos(pitch) * std::sin(yaw), std::sin(pitch));
+
+          for (int n = 0; n < Md2::NUM_ANORMS; n++)
+          {
+            float shade = Md2::LIGHT_AMBIENT +
+              (1 - Md2::LIGHT_AMBIENT) * std::max(Md2::anorms[n].dot(light), 0.0f);
+            dots[p][y][n] = static_cast<unsigned char>(shade * 255 + 0.5f);
+          }
+        }
+    }
+  };
+}
+
+const vec3 Md2::anorms[NUM_ANORMS] =
+  {
+    vec3(-0.525731, 0.000000, 0.850651),
+    vec3(-0.442863, 0.238856, 0.864188),
+    vec3(-0.295242, 0.000000, 0.955423),
+    vec3(-0.309017, 0.500000, 0.809017),
+    vec3(-0.162460, 0.262866, 0.951056),
+    vec3(0.000000, 0.000000, 1.000000),
+    vec3(0.000000, 0.850651, 0.525731),
+    vec3(-0.147621, 0.716567, 0.681718),
+    vec3(0.147621, 0.716567, 0.681718),
+    vec3(0.000000, 0.525731, 0.850651),
+    vec3(0.309017, 0.500000, 0.809017),
+    vec3(0.525731, 0.000000, 0.850651),
+    vec3(0.295242, 0.000000, 0.955423),
+    vec3(0.442863, 0.238856, 0.864188),
+    vec3(0.162460, 0.262866, 0.951056),
+    vec3(-0.681718, 0.147621, 0.716567),
+    vec3(-0.809017, 0.309017, 0.500000),
+    vec3(-0.587785, 0.425325, 0.688191),
+    vec3(-0.850651, 0.525731, 0.000000),
+    vec3(-0.864188, 0.442863, 0.238856),
+    vec3(-0.716567, 0.681718, 0.147621),
+    vec3(-0.688191, 0.587785, 0.425325),
+    vec3(-0.500000, 0.809017, 0.309017),
+    vec3(-0.238856, 0.864188, 0.442863),
+    vec3(-0.425325, 0.688191, 0.587785),
+    vec3(-0.716567, 0.681718, -0.147621),
+    vec3(-0.500000, 0.809017, -0.309017),
+    vec3(-0.525731, 0.850651, 0.000000),
+    vec3(0.000000, 0.850651, -0.525731),
+    vec3(-0.238856, 0.864188, -0.442863),
+    vec3(0.000000, 0.955423, -0.295242),
+    vec3(-0.262866, 0.951056, -0.162460),
+    vec3(0.000000, 1.000000, 0.000000),
+    vec3(0.000000, 0.955423, 0.295242),
+    vec3(-0.262866, 0.951056, 0.162460),
+    vec3(0.238856, 0.864188, 0.442863),
+    vec3(0.262866, 0.951056, 0.162460),
+    vec3(0.500000, 0.809017, 0.309017),
+    vec3(0.238856, 0.864188, -0.442863),
+    vec3(0.262866, 0.951056, -0.162460),
+    vec3(0.500000, 0.809017, -0.309017),
+    vec3(0.850651, 0.525731, 0.000000),
+    vec3(0.716567, 0.681718, 0.147621),
+    vec3(0.716567, 0.681718, -0.147621),
+    vec3(0.525731, 0.850651, 0.000000),
+    vec3(0.425325, 0.688191, 0.587785),
+    vec3(0.864188, 0.442863, 0.238856),
+    vec3(0.688191, 0.587785, 0.425325),
+    vec3(0.809017, 0.309017, 0.500000),
+    vec3(0.681718, 0.147621, 0.716567),
+    vec3(0.587785, 0.425325, 0.688191),
+    vec3(0.955423, 0.295242, 0.000000),
+    vec3(1.000000, 0.000000, 0.000000),
+    vec3(0.951056, 0.162460, 0.262866),
+    vec3(0.850651, -0.525731, 0.000000),
+    vec3(0.955423, -0.295242, 0.000000),
+    vec3(0.864188, -0.442863, 0.238856),
+    vec3(0.951056, -0.162460, 0.262866),
+    vec3(0.809017, -0.309017, 0.500000),
+    vec3(0.681718, -0.147621, 0.716567),
+    vec3(0.850651, 0.000000, 0.525731),
+    vec3(0.864188, 0.442863, -0.238856),
+    vec3(0.809017, 0.309017, -0.500000),
+    vec3(0.951056, 0.162460, -0.262866),
+    vec3(0.525731, 0.000000, -0.850651),
+    vec3(0.681718, 0.147621, -0.716567),
+    vec3(0.681718, -0.147621, -0.716567),
+    vec3(0.850651, 0.000000, -0.525731),
+    vec3(0.809017, -0.309017, -0.500000),
+    vec3(0.864188, -0.442863, -0.238856),
+    vec3(0.951056, -0.162460, -0.262866),
+    vec3(0.147621, 0.716567, -0.681718),
+    vec3(0.309017, 0.500000, -0.809017),
+    vec3(0.425325, 0.688191, -0.587785),
+    vec3(0.442863, 0.238856, -0.864188),
+    vec3(0.587785, 0.425325, -0.688191),
+    vec3(0.688191, 0.587785, -0.425325),
+    vec3(-0.147621, 0.716567, -0.681718),
+    vec3(-0.309017, 0.500000, -0.809017),
+    vec3(0.000000, 0.525731, -0.850651),
+    vec3(-0.525731, 0.000000, -0.850651),
+    vec3(-0.442863, 0.238856, -0.864188),
+    vec3(-0.295242, 0.000000, -0.955423),
+    vec3(-0.162460, 0.262866, -0.951056),
+    vec3(0.000000, 0.000000, -1.000000),
+    vec3(0.295242, 0.000000, -0.955423),
+    vec3(0.162460, 0.262866, -0.951056),
+    vec3(-0.442863, -0.238856, -0.864188),
+    vec3(-0.309017, -0.500000, -0.809017),
+    vec3(-0.162460, -0.262866, -0.951056),
+    vec3(0.000000, -0.850651, -0.525731),
+    vec3(-0.147621, -0.716567, -0.681718),
+    vec3(0.147621, -0.716567, -0.681718),
+    vec3(0.000000, -0.525731, -0.850651),
+    vec3(0.309017, -0.500000, -0.809017),
+    vec3(0.442863, -0.238856, -0.864188),
+    vec3(0.162460, -0.262866, -0.951056),
+    vec3(0.238856, -0.864188, -0.442863),
+    vec3(0.500000, -0.809017, -0.309017),
+    vec3(0.425325, -0.688191, -0.587785),
+    vec3(0.716567, -0.681718, -0.147621),
+    vec3(0.688191, -0.587785, -0.425325),
+    vec3(0.587785, -0.425325, -0.688191),
+    vec3(0.000000, -0.955423, -0.295242),
+    vec3(0.000000, -1.000000, 0.000000),
+    vec3(0.262866, -0.951056, -0.162460),
+    vec3(0.000000, -0.850651, 0.525731),
+    vec3(0.000000, -0.955423, 0.295242),
+    vec3(0.238856, -0.864188, 0.442863),
+    vec3(0.262866, -0.951056, 0.162460),
+    vec3(0.500000, -0.809017, 0.309017),
+    vec3(0.716567, -0.681718, 0.147621),
+    vec3(0.525731, -0.850651, 0.000000),
+    vec3(-0.238856, -0.864188, -0.442863),
+    vec3(-0.500000, -0.809017, -0.309017),
+    vec3(-0.262866, -0.951056, -0.162460),
+    vec3(-0.850651, -0.525731, 0.000000),
+    vec3(-0.716567, -0.681718, -0.147621),
+    vec3(-0.716567, -0.681718, 0.147621),
+    vec3(-0.525731, -0.850651, 0.000000),
+    vec3(-0.500000, -0.809017, 0.309017),
+    vec3(-0.238856, -0.864188, 0.442863),
+    vec3(-0.262866, -0.951056, 0.162460),
+    vec3(-0.864188, -0.442863, 0.238856),
+    vec3(-0.809017, -0.309017, 0.500000),
+    vec3(-0.688191, -0.587785, 0.425325),
+    vec3(-0.681718, -0.147621, 0.716567),
+    vec3(-0.442863, -0.238856, 0.864188),
+    vec3(-0.587785, -0.425325, 0.688191),
+    vec3(-0.309017, -0.500000, 0.809017),
+    vec3(-0.147621, -0.716567, 0.681718),
+    vec3(-0.425325, -0.688191, 0.587785),
+    vec3(-0.162460, -0.262866, 0.951056),
+    vec3(0.442863, -0.238856, 0.864188),
+    vec3(0.162460, -0.262866, 0.951056),
+    vec3(0.309017, -0.500000, 0.809017),
+    vec3(0.147621, -0.716567, 0.681718),
+    vec3(0.000000, -0.525731, 0.850651),
+    vec3(0.425325, -0.688191, 0.587785),
+    vec3(0.587785, -0.425325, 0.688191),
+    vec3(0.688191, -0.587785, 0.425325),
+    vec3(-0.955423, 0.295242, 0.000000),
+    vec3(-0.951056, 0.162460, 0.262866),
+    vec3(-1.000000, 0.000000, 0.000000),
+    vec3(-0.850651, 0.000000, 0.525731),
+    vec3(-0.955423, -0.295242, 0.000000),
+    vec3(-0.951056, -0.162460, 0.262866),
+    vec3(-0.864188, 0.442863, -0.238856),
+    vec3(-0.951056, 0.162460, -0.262866),
+    vec3(-0.809017, 0.309017, -0.500000),
+    vec3(-0.864188, -0.442863, -0.238856),
+    vec3(-0.951056, -0.162460, -0.262866),
+    vec3(-0.809017, -0.309017, -0.500000),
+    vec3(-0.681718, 0.147621, -0.716567),
+    vec3(-0.681718, -0.147621, -0.716567),
+    vec3(-0.850651, 0.000000, -0.525731),
+    vec3(-0.688191, 0.587785, -0.425325),
+    vec3(-0.587785, 0.425325, -0.688191),
+    vec3(-0.425325, 0.688191, -0.587785),
+    vec3(-0.425325, -0.688191, -0.587785),
+    vec3(-0.587785, -0.425325, -0.688191),
+    vec3(-0.688191, -0.587785, -0.425325)
+  };
+
+/***************************************************************************\
+ * Md2::anorms_dots                                                        *
+\***************************************************************************/
+const unsigned char *Md2::anorms_dots(const vec3 &light)
+{
+  static const DotTable table;
+
+  float horizontal = std::sqrt(light.x * light.x + light.y * light.y);
+  float pitch = std::atan2(light.z, horizontal);
+  float yaw = std::atan2(light.y, light.x);
+
+  int p = static_cast<int>(std::floor((pitch / static_cast<float>(M_PI) + 0.5f) * (PITCH_STEPS - 1) + 0.5f));
+  int y = static_cast<int>(std::floor(yaw / (2 * static_cast<float>(M_PI)) * YAW_STEPS + 0.5f));
+  p = std::min(std::max(p, 0), PITCH_STEPS - 1);
+  y = ((y % YAW_STEPS) + YAW_STEPS) % YAW_STEPS;
+
+  return table.dots[p][y];
+}
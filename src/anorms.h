@@ -0,0 +1,24 @@
+// anorms.h
+
+#ifndef ANORMS_H
+#define ANORMS_H
+
+#include "vec3.h"
+
+namespace Md2
+{
+  // The normals MD2 vertices refer to by index (Quake's anorms.h)
+  const int NUM_ANORMS = 162;
+  extern const vec3 anorms[NUM_ANORMS];
+
+  // Light of a vertex facing away from the light; facing it, 1
+  const float LIGHT_AMBIENT = 0.45f;
+
+  // Light of each of the anorms under the directional light 'light' (model
+  // space, towards the light), 0-255 from the ambient term to full white.
+  // Rows are precomputed for the light direction quantized on its yaw and
+  // pitch, as Quake's anorms_dots, so lighting a vertex is one lookup.
+  const unsigned char *anorms_dots(const vec3 &light);
+}
+
+#endif
@@ -1,10 +1,25 @@
 // main.cpp
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <cstring>
 #include <GL/glut.h>
 
+#include "gl_state.h"
+#include "gpu_profiler.h"
 #include "md2_player.h"
+#include "mem_stats.h"
+#include "occlusion.h"
+#include "player_loader.h"
+#include "render_queue.h"
+#include "session.h"
+#include "shadow_map.h"
+#include "shadow_volume.h"
+#include "stream_buffer.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "vertex_animation.h"
 
 struct mouse_input_t
 {
@@ -26,16 +41,150 @@ int modifiers;
 // Camera
 vec3 rot(0, 0, 0), eye(0, 0, 8);
 
+Vfs vfs;
+Md2::AnimCache *anim_cache = nullptr;
 Md2::Player *player = nullptr;
 
+// The player is loaded in the background, its skins uploaded within this
+// many milliseconds per frame
+PlayerLoader loader;
+double upload_budget_ms = 4;
+// Error bound of the compressed keyframes, in model units (0: none)
+float keyframe_error = 0;
+
+// Crowd of copies of the player animated on the GPU (--crowd), and its
+// clock in frames
+VertexAnimation crowd;
+int crowd_size = 0;
+float crowd_time = 0;
+
+// Workers for the shadow volume construction
+ThreadPool workers;
+
+// Views of the scene (--views): the window split in a grid, the first view
+// with the camera, the others turned around the player.  The characters are
+// skinned once per frame for all of them; each view culls with its own
+// occlusion queries and only submits the draws.
+struct View
+{
+  float yaw;               // added to the camera's rot.y
+  GLint x, y;              // viewport
+  GLsizei width, height;
+  OcclusionCuller occlusion;
+  std::vector<Md2::Object *> visible;  // this frame
+};
+std::vector<View> views(1);
+
+// Draws of the frame, sorted by state
+RenderQueue render_queue;
+
+// GPU time of the parts of a frame, logged with the replay timings
+enum { GPU_SHADOWS, GPU_CHARACTERS, GPU_CLEAR_SWAP };
+const std::vector<std::string> gpu_sections = { "shadows", "characters", "clear_swap" };
+GpuProfiler profiler;
+
+// Chrome trace, recorded from the start with --trace, toggled with 't'
+std::string trace_file = "ombre0_trace.json";
+
+// Vertex ring for the skinned geometry, set up in init (0: client arrays)
+float stream_buffer_mib = 24;
+
+// Shadow mapping, set up in init
+ShadowMap shadow_map;
+int shadow_map_size = 1024;
+int shadow_map_pcf = 3;
+
 bool animated = true;
 
 int frame_rate = 7;
+int polygon_mode = GL_FILL;
+
+// Session recording and replay
+Session::Writer recorder;
+Session::Reader replay;
+Session::TimingLog timings;
+bool replaying = false;
+bool replay_frame_pending = false;
 
 std::vector<std::string> all_skins;
 std::vector<std::string> all_anims;
 extern vec3 light_pos;
 
+/*=========================================================================*\
+ * record                                                                  *
+ *                                                                         *
+ * Log the current value of a piece of state when recording a session.    *
+\*=========================================================================*/
+static void record(Session::EventType type)
+{
+  if (!recorder.is_open())
+    return;
+
+  Session::Event ev(type, timer.current_time);
+
+  switch (type)
+  {
+    case Session::EV_CAMERA:       ev.a = eye; ev.b = rot; break;
+    case Session::EV_LIGHT:        ev.a = light_pos; break;
+    case Session::EV_ANIM:
+    case Session::EV_SKIN:
+      // Logged once the player is there
+      if (!player)
+        return;
+      ev.name = (type == Session::EV_ANIM) ? player->get_current_anim() : player->get_current_skin();
+      break;
+    case Session::EV_ANIMATED:     ev.value = animated; break;
+    case Session::EV_FRAME_RATE:   ev.value = frame_rate; break;
+    case Session::EV_POLYGON_MODE: ev.value = polygon_mode; break;
+    case Session::EV_SHADOW_MODE:  ev.value = Md2::shadow_mode; break;
+    case Session::EV_MESH_LOD:     ev.value = Md2::mesh_lod; break;
+    case Session::EV_OCCLUSION:    ev.value = views[0].occlusion.is_enabled(); break;
+    default: break;
+  }
+
+  recorder.write(ev);
+}
+
+/*=========================================================================*\
+ * set_occlusion                                                           *
+ * Occlusion culling on or off in every view.                              *
+\*=========================================================================*/
+static void set_occlusion(bool enabled)
+{
+  for (View &view : views)
+    view.occlusion.set_enabled(enabled);
+}
+
+/*=========================================================================*\
+ * apply_event                                                             *
+ *                                                                         *
+ * Apply a replayed state change.                                          *
+\*=========================================================================*/
+static void apply_event(const Session::Event &ev)
+{
+  switch (ev.type)
+  {
+    case Session::EV_CAMERA:       eye = ev.a; rot = ev.b; break;
+    case Session::EV_LIGHT:        light_pos = ev.a; break;
+    case Session::EV_ANIM:         player->set_anim(ev.name); break;
+    case Session::EV_SKIN:         player->set_skin(ev.name); break;
+    case Session::EV_ANIMATED:     animated = ev.value; break;
+    case Session::EV_FRAME_RATE:   frame_rate = ev.value; break;
+    case Session::EV_POLYGON_MODE:
+      polygon_mode = ev.value;
+      glPolygonMode(GL_FRONT_AND_BACK, polygon_mode);
+      break;
+    case Session::EV_MESH_LOD:     Md2::mesh_lod = ev.value; break;
+    case Session::EV_OCCLUSION:    set_occlusion(ev.value); break;
+    case Session::EV_SHADOW_MODE:
+      Md2::shadow_mode = static_cast<Md2::ShadowMode>(ev.value % Md2::SHADOW_MODE_COUNT);
+      if (Md2::shadow_mode == Md2::SHADOW_MAP && !shadow_map.ready())
+        Md2::shadow_mode = Md2::SHADOW_PROJECTED;
+      break;
+    default: break;
+  }
+}
+
 /*=========================================================================*\
  * anim_menu_callback                                                      *
  *                                                                         *
@@ -45,6 +194,7 @@ extern vec3 light_pos;
 static void anim_menu_callback(int item)
 {
   player->set_anim(all_anims[item]);
+  record(Session::EV_ANIM);
 
   glutPostRedisplay();
 }
@@ -58,6 +208,7 @@ static void anim_menu_callback(int item)
 static void skin_menu_callback(int item)
 {
   player->set_skin(all_skins[item]);
+  record(Session::EV_SKIN);
 
   glutPostRedisplay();
 }
@@ -102,6 +253,126 @@ static int build_anim_menu(const Md2::Model::AnimMap &anim_map)
   return menu_id;
 }
 
+/*=========================================================================*\
+ * toggle_trace                                                            *
+ * Start recording, or stop and write the trace.                           *
+\*=========================================================================*/
+static void toggle_trace()
+{
+  if (!Trace::is_recording())
+  {
+    Trace::start();
+    std::cerr << "Tracing..." << std::endl;
+  }
+  else if (Trace::stop(trace_file))
+    std::cerr << "Trace written to " << trace_file << std::endl;
+  else
+    std::cerr << "Warning: couldn't write " << trace_file << std::endl;
+}
+
+/*=========================================================================*\
+ * setup_crowd                                                             *
+ *                                                                         *
+ * Bake the animations of the player and lay out the crowd on a grid       *
+ * around it, each copy playing one of the animations from its own phase.  *
+\*=========================================================================*/
+static void setup_crowd()
+{
+  const Md2::Model *model = player->get_player_mesh();
+
+  if (!crowd.init() || !crowd.bake(model))
+  {
+    std::cerr << "Vertex animation unavailable, no crowd" << std::endl;
+    crowd.release();
+    return;
+  }
+
+  std::vector<Md2::Anim> anims;
+  for (auto &anim : model->get_anims())
+    anims.push_back(anim.second);
+  if (anims.empty())
+    anims.push_back(Md2::Anim{0, model->get_num_frames() - 1});
+
+  // Rows of 'side' copies, 4 units apart, the player keeping the center
+  const float spacing = 4;
+  int side = 1;
+  while (side * side < crowd_size + 1)
+    side += 2;
+
+  std::vector<VertexAnimation::Instance> instances;
+  for (int i = 0; static_cast<int>(instances.size()) < crowd_size; i++)
+  {
+    int x = i % side - side / 2;
+    int y = i / side - side / 2;
+    if (x == 0 && y == 0)
+      continue;
+
+    const Md2::Anim &anim = anims[i % anims.size()];
+    VertexAnimation::Instance instance;
+    instance.position = vec3(x * spacing, y * spacing, 0);
+    instance.scale = 0.1f;
+    instance.start = anim.start;
+    instance.frames = anim.end - anim.start + 1;
+    instance.phase = (i * 7) % instance.frames;
+    instances.push_back(instance);
+  }
+  crowd.set_instances(instances);
+}
+
+/*=========================================================================*\
+ * publish_players                                                         *
+ *                                                                         *
+ * Put the players handed out by the loader in the scene, and create the  *
+ * GLUT menus from the first one.                                          *
+\*=========================================================================*/
+static void publish_players(std::vector<PlayerLoader::PlayerPtr> players)
+{
+  if (players.empty() || player)
+    return;
+
+  player = players.front().release();
+  player->set_scale(0.1f);
+  player->set_anim("stand");
+
+  // Create GLUT menus
+  const Md2::Model *ref = player->get_player_mesh();
+
+  int skinMenuId = build_skin_menu(ref->get_skins());
+  int animMenuId = build_anim_menu(ref->get_anims());
+
+  glutCreateMenu(nullptr);
+  glutAddSubMenu("Skin", skinMenuId);
+  glutAddSubMenu("Animation", animMenuId);
+  if (!replaying)
+    glutAttachMenu(GLUT_RIGHT_BUTTON);
+
+  glutSetWindowTitle("Ombres, z-zero");
+  if (crowd_size > 0)
+    setup_crowd();
+  record(Session::EV_ANIM);
+  record(Session::EV_SKIN);
+}
+
+/*=========================================================================*\
+ * update_loading                                                          *
+ *                                                                         *
+ * Upload the next skins and show the progress until the player is there. *
+\*=========================================================================*/
+static void update_loading()
+{
+  publish_players(loader.update(upload_budget_ms));
+  if (player)
+    return;
+
+  PlayerLoader::Progress progress = loader.get_progress();
+  if (progress.failed == progress.queued)
+    exit(-1);
+
+  std::string title = "Ombres, z-zero (loading " +
+    std::to_string(static_cast<int>(progress.fraction * 100)) + "%)";
+  glutSetWindowTitle(title.c_str());
+}
+
 /*=========================================================================*\
  * shutdown_app                                                            *
  *                                                                         *
@@ -109,7 +380,17 @@ static int build_anim_menu(const Md2::Model::AnimMap &anim_map)
 \*=========================================================================*/
 static void shutdown_app()
 {
+  shadow_map.release();
+  stream_buffer.release();
+  profiler.release();
+  for (View &view : views)
+    view.occlusion.release();
+  crowd.release();
+  if (Trace::is_recording())
+    toggle_trace();
+  loader.release();
   delete player;
+  delete anim_cache;
 }
 
 /*=========================================================================*\
@@ -118,7 +399,7 @@ static void shutdown_app()
  * Application initialization.  Setup keyboard input, mouse input,         *
  * timer, camera and OpenGL.                                               *
 \*=========================================================================*/
-static void init(const std::string &path)
+static void init(const std::string &path, const std::string &pak_dir)
 {
   // Inititialize mouse
   mouse.buttons[GLUT_LEFT_BUTTON] = GLUT_UP;
@@ -140,35 +421,35 @@ static void init(const std::string &path)
   if (dirname.find (".md2") == dirname.length () - 4)
     dirname.assign (dirname, 0, dirname.find_last_of ('/'));
 
-  // Load MD2 models
-  try
+  // Mount the archive, or the parent of the player directory
+  bool mounted;
+  if (dirname.find (".pak") == dirname.length () - 4)
   {
-    player = new Md2::Player (dirname);
-
-    player->set_scale(0.1f);
+    mounted = vfs.mount (dirname);
+    dirname = pak_dir;
   }
-  catch (std::runtime_error &err)
+  else
   {
-    std::cerr << "Error: failed to load player from " << dirname << std::endl;
-    std::cerr << "Reason: " << err.what () << std::endl;
-
-    if (errno)
-      std::cerr << strerror(errno) << std::endl;
+    std::string::size_type slash = dirname.find_last_of ('/');
+    if (slash == std::string::npos)
+      mounted = vfs.mount (".");
+    else
+    {
+      mounted = vfs.mount (slash == 0 ? "/" : dirname.substr (0, slash));
+      dirname.erase (0, slash + 1);
+    }
+  }
 
+  if (!mounted)
+  {
+    std::cerr << "Error: failed to mount " << path << std::endl;
     exit (-1);
   }
 
-  // Create GLUT menus
-  const Md2::Model *ref = player->get_player_mesh();
-
-  int skinMenuId = build_skin_menu(ref->get_skins());
-  int animMenuId = build_anim_menu(ref->get_anims());
-
-  glutCreateMenu(nullptr);
-  glutAddSubMenu("Skin", skinMenuId);
-  glutAddSubMenu("Animation", animMenuId);
-  glutAttachMenu(GLUT_RIGHT_BUTTON);
-  player->set_anim("stand");
+  // Load MD2 models in the background, the window is drawn meanwhile
+  if (keyframe_error > 0 && anim_cache)
+    std::cerr << "Warning: paged animations are not compressed" << std::endl;
+  loader.queue(vfs, dirname, anim_cache, keyframe_error);
 
   // Initialize OpenGL
   glClearColor(0.5, 0.5, 0.5, 1);
@@ -177,6 +458,20 @@ static void init(const std::string &path)
   glEnable(GL_CULL_FACE);
   glCullFace(GL_BACK);
   glEnableClientState(GL_VERTEX_ARRAY);
+
+  shadow_map.init(shadow_map_size, shadow_map_pcf);
+  if (stream_buffer_mib > 0 && !stream_buffer.init(stream_buffer_mib * 1024 * 1024))
+    std::cerr << "Stream buffer unavailable, using client arrays" << std::endl;
+  if (!profiler.init(gpu_sections))
+    std::cerr << "GPU timer queries unavailable" << std::endl;
+
+  // Replays start with the player there, so that they draw the same frames
+  if (replaying)
+  {
+    publish_players(loader.finish());
+    if (!player)
+      exit(-1);
+  }
 }
 
 
@@ -197,9 +492,45 @@ static void reshape_callback(int w, int h)
   glMatrixMode(GL_MODELVIEW);
   glLoadIdentity();
 
+  // Grid of views, first one top left
+  int n = views.size();
+  int columns = 1;
+  while (columns * columns < n)
+    columns++;
+  int rows = (n + columns - 1) / columns;
+  for (int i = 0; i < n; i++)
+  {
+    View &view = views[i];
+    view.yaw = 360.0f * i / n;
+    view.width = std::max(w / columns, 1);
+    view.height = std::max(h / rows, 1);
+    view.x = (i % columns) * view.width;
+    view.y = h - (i / columns + 1) * view.height;
+  }
+
   glutPostRedisplay();
 }
 
+/*=========================================================================*\
+ * set_view                                                                *
+ * Viewport, projection and camera transformations of a view.              *
+\*=========================================================================*/
+static void set_view(const View &view)
+{
+  glViewport(view.x, view.y, view.width, view.height);
+
+  glMatrixMode(GL_PROJECTION);
+  glLoadIdentity();
+  gluPerspective(45, static_cast<float>(view.width) / view.height, 0.1, 1000);
+  glMatrixMode(GL_MODELVIEW);
+  glLoadIdentity();
+
+  glTranslatef(-eye.x, -eye.y, -eye.z);
+  glRotatef(rot.x, 1, 0, 0);
+  glRotatef(rot.y + view.yaw, 0, 1, 0);
+  glRotatef(rot.z, 0, 0, 1);
+}
+
 /*=========================================================================*\
  * Update the timer.                                                       *
 \*=========================================================================*/
@@ -209,36 +540,208 @@ static void update_timer(struct glut_timer_t *t)
   t->current_time = glutGet (GLUT_ELAPSED_TIME) * 0.001f;
 }
 
+/*=========================================================================*\
+ * draw_floor                                                              *
+ * Receiver for the shadow techniques which are not tied to the shadow    *
+ * plane: the ground, at the height of that plane.                         *
+\*=========================================================================*/
+static void draw_floor()
+{
+  glPushMatrix();
+  glRotatef(-90, 1, 0, 0);
+  glRotatef(-90, 0, 0, 1);
+
+  gl_state.disable(GL_TEXTURE_2D);
+  gl_state.set_front_face(GL_CCW);
+  glColor4f(0.6f, 0.6f, 0.55f, 1);
+  glBegin(GL_QUADS);
+    glVertex3f(-20, -20, -2.41f);
+    glVertex3f(-20,  20, -2.41f);
+    glVertex3f( 20,  20, -2.41f);
+    glVertex3f( 20, -20, -2.41f);
+  glEnd();
+
+  glPopMatrix();
+}
+
+/*=========================================================================*\
+ * log_gpu_times                                                           *
+ * Hand the GPU times read back so far to the replay timings.              *
+\*=========================================================================*/
+static void log_gpu_times()
+{
+  GpuProfiler::Result result;
+  while (profiler.pop_result(result))
+    if (replaying)
+      timings.gpu(result.frame, result.section_ms, result.frame_ms);
+}
+
 /*=========================================================================*\
  * display_callback                                                        *
 \*=========================================================================*/
 static void display_callback()
 {
+  // While replaying, only the logged frames are drawn
+  if (replaying && !replay_frame_pending)
+    return;
+
+  Trace::Scope trace("frame");
+
+  // Until the player is there, only the background is drawn
+  if (!player)
+  {
+    update_loading();
+    if (!player)
+    {
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+      glutSwapBuffers();
+      return;
+    }
+  }
+
+  auto frame_start = std::chrono::steady_clock::now();
+  unsigned long frame_allocations = MemStats::get_allocations();
+  record(Session::EV_FRAME);
+
+  // GLUT and the GL may have changed anything since the last frame
+  gl_state.invalidate();
+  gl_state.reset_counters();
+  stream_buffer.begin_frame();
+  profiler.begin_frame();
+
   // Animation
   if (animated)
   {
     double dt = timer.current_time - timer.last_time;
     player->animate(frame_rate * dt);
+    crowd_time += frame_rate * dt;
+  }
+
+  bool volumes = (Md2::shadow_mode == Md2::SHADOW_VOLUME);
+  bool mapped = (Md2::shadow_mode == Md2::SHADOW_MAP);
+
+  // Characters found hidden in every view on a previous frame are neither
+  // skinned nor drawn
+  std::vector<Md2::Object *> objects(1, player->get_player_object());
+  std::vector<Md2::Object *> visible;
+  for (View &view : views)
+  {
+    view.occlusion.collect();
+    view.visible.clear();
+    for (Md2::Object *object : objects)
+      if (view.occlusion.is_visible(object))
+        view.visible.push_back(object);
+  }
+  for (Md2::Object *object : objects)
+    for (const View &view : views)
+      if (std::find(view.visible.begin(), view.visible.end(), object) != view.visible.end())
+      {
+        visible.push_back(object);
+        break;
+      }
+  bool player_visible = !visible.empty();
+
+  // Shadow map: the casters seen from the light, in the same pose
+  gl_state.enable(GL_DEPTH_TEST);
+  if (mapped && player_visible)
+  {
+    profiler.begin(GPU_SHADOWS);
+    shadow_map.begin_depth_pass();
+    player->draw_player_itp(false);
+    shadow_map.end_depth_pass();
   }
 
   // Clear window
+  profiler.begin(GPU_CLEAR_SWAP);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-  glLoadIdentity();
-
-  // Perform camera transformations
-  glTranslatef(-eye.x, -eye.y, -eye.z);
-  glRotatef(rot.x, 1, 0, 0);
-  glRotatef(rot.y, 0, 1, 0);
-  glRotatef(rot.z, 0, 0, 1);
+  profiler.end();
 
-  glEnable(GL_DEPTH_TEST);
+  // Skinning and planar shadows, once for all the views, at the level of
+  // detail of the first one
+  set_view(views[0]);
+  if (player_visible)
+    player->prepare_player(animated);
+  else
+    player->get_player_object()->skip_frame(animated);
 
-  glEnable(GL_TEXTURE_2D);
+  for (size_t i = 0; i < views.size(); i++)
+  {
+    View &view = views[i];
+    set_view(view);
+
+    gl_state.enable(GL_TEXTURE_2D);
+
+    // A camera which can't be inverted draws this view without shadows
+    bool receiving = false;
+    if (mapped)
+    {
+      GLfloat camera_view[16];
+      glGetFloatv(GL_MODELVIEW_MATRIX, camera_view);
+      receiving = shadow_map.begin_receiver_pass(matrix(camera_view));
+      if (receiving)
+        shadow_map.set_textured(false);
+    }
 
-  // Draw objects
-  player->draw_player_itp(animated);
+    profiler.begin(GPU_CHARACTERS);
+    if (volumes || mapped)
+      draw_floor();
+
+    // Draw objects
+    if (receiving)
+      shadow_map.set_textured(true);
+    for (const Md2::Object *object : view.visible)
+      render_queue.add(object, receiving ? shadow_map.get_program() : 0);
+
+    profiler.begin(GPU_SHADOWS);
+    render_queue.flush(Md2::PASS_SHADOW);
+    profiler.begin(GPU_CHARACTERS);
+    render_queue.flush(Md2::PASS_OPAQUE);
+    crowd.draw(crowd_time, player->get_player_mesh()->get_texture());
+    profiler.end();
+
+    if (receiving)
+      shadow_map.end_receiver_pass();
+
+    // Test every character against the finished depth buffer of the view
+    view.occlusion.issue(objects);
+
+    // Shadow volumes need the whole scene in the depth buffer; they are
+    // built once, while the GL draws the first view
+    if (volumes)
+    {
+      if (i == 0)
+        Md2::build_shadow_volumes(visible, workers);
+      profiler.begin(GPU_SHADOWS);
+      Md2::render_shadow_volumes(view.visible);
+      profiler.end();
+    }
+  }
 
+  stream_buffer.end_frame();
+  profiler.begin(GPU_CLEAR_SWAP);
   glutSwapBuffers();
+  profiler.end_frame();
+
+  if (replaying)
+  {
+    glFinish();
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - frame_start;
+    Session::FrameStats stats;
+    stats.allocations = MemStats::get_allocations() - frame_allocations;
+    stats.drawn = 0;
+    stats.culled = 0;
+    for (const View &view : views)
+    {
+      stats.drawn += view.occlusion.get_drawn();
+      stats.culled += view.occlusion.get_culled();
+    }
+    stats.gl_issued = gl_state.get_issued();
+    stats.gl_elided = gl_state.get_elided();
+    stats.gpu_frame = profiler.ready() ? profiler.get_frame() : 0;
+    timings.frame(timer.current_time, ms.count(), stats);
+    replay_frame_pending = false;
+  }
+  log_gpu_times();
 }
 
 /*=========================================================================*\
@@ -252,18 +755,45 @@ static void keypress_callback(unsigned char key, int, int)
     case 27: exit(0);
     case 'a': case 'A':
              animated = !animated;
+             record(Session::EV_ANIMATED);
              break;
     case 's': case 'S':
-             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+             polygon_mode = GL_FILL;
+             glPolygonMode(GL_FRONT_AND_BACK, polygon_mode);
+             record(Session::EV_POLYGON_MODE);
              break;
     case 'w': case 'W':
-             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+             polygon_mode = GL_LINE;
+             glPolygonMode(GL_FRONT_AND_BACK, polygon_mode);
+             record(Session::EV_POLYGON_MODE);
+             break;
+    case 'm': case 'M':
+             Md2::shadow_mode = static_cast<Md2::ShadowMode>((Md2::shadow_mode + 1) % Md2::SHADOW_MODE_COUNT);
+             if (Md2::shadow_mode == Md2::SHADOW_MAP && !shadow_map.ready())
+               Md2::shadow_mode = static_cast<Md2::ShadowMode>((Md2::shadow_mode + 1) % Md2::SHADOW_MODE_COUNT);
+             record(Session::EV_SHADOW_MODE);
+             break;
+    case 'l': case 'L':
+             Md2::mesh_lod = !Md2::mesh_lod;
+             record(Session::EV_MESH_LOD);
+             break;
+    case 'o': case 'O':
+             set_occlusion(!views[0].occlusion.is_enabled());
+             record(Session::EV_OCCLUSION);
+             break;
+    case 'r': case 'R':
+             MemStats::report(std::cerr);
+             break;
+    case 't': case 'T':
+             toggle_trace();
              break;
     case '+': frame_rate++; break;
     case '-': frame_rate--; break;
   }
   if (frame_rate < 0)
     frame_rate = 0;
+  if (key == '+' || key == '-')
+    record(Session::EV_FRAME_RATE);
 
   glutPostRedisplay();
 }
@@ -288,6 +818,7 @@ static void special_key_press_callback(int key, int, int)
       light_pos.y -= 0.1;
       break;
   }
+  record(Session::EV_LIGHT);
 }
 
 /*=========================================================================*\
@@ -315,6 +846,7 @@ static void mouse_motion_callback(int x, int y)
 
   mouse.x = x;
   mouse.y = y;
+  record(Session::EV_CAMERA);
 
   glutPostRedisplay ();
 }
@@ -335,6 +867,43 @@ static void mouse_button_callback(int button, int state, int x, int y)
   mouse.y = y;
 }
 
+/*=========================================================================*\
+ * replay_step                                                             *
+ * Apply the logged events up to the next frame and schedule it on the     *
+ * virtual clock.  Quit at the end of the log, with a failure status if    *
+ * the log is corrupt.                                                     *
+\*=========================================================================*/
+static void replay_step()
+{
+  Session::Event ev;
+
+  if (replay_frame_pending)
+    return;
+
+  while (replay.read(ev))
+  {
+    if (ev.type == Session::EV_FRAME)
+    {
+      timer.last_time = timer.current_time;
+      timer.current_time = ev.time;
+      replay_frame_pending = true;
+      glutPostRedisplay();
+      return;
+    }
+    apply_event(ev);
+  }
+
+  // A corrupt log keeps the timings read so far, but fails the run
+  if (!replay.get_error().empty())
+    std::cerr << "Error: corrupt session, " << replay.get_error() << std::endl;
+
+  profiler.finish();
+  log_gpu_times();
+  timings.close();
+  MemStats::report(std::cerr);
+  exit(replay.get_error().empty() ? 0 : -1);
+}
+
 /*=========================================================================*\
  * idle_callback                                                           *
  * Idle glut callback function. Continuously called. Perform background    *
@@ -342,10 +911,16 @@ static void mouse_button_callback(int button, int state, int x, int y)
 \*=========================================================================*/
 static void idle_callback()
 {
+  if (replaying)
+  {
+    replay_step();
+    return;
+  }
+
   // Update the timer
   update_timer(&timer);
 
-  if (animated)
+  if (animated || loader.busy())
     glutPostRedisplay();
 }
 
@@ -366,27 +941,93 @@ static void window_status_callback(int state)
 int main(int argc, char *argv[])
 {
   std::string path = "./data/";
+  std::string pak_dir = "players/male";
+  std::string record_file, replay_file, timings_file;
   // Initialize GLUT
   glutInit (&argc, argv);
 
-  if (argc >= 2) path = argv[1];
+  // Options, then either a player directory, or a .pak archive and the
+  // player directory inside it
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "--anim-budget" && i + 1 < argc)
+      anim_cache = new Md2::AnimCache(atof(argv[++i]) * 1024 * 1024);
+    else if (arg == "--record" && i + 1 < argc)
+      record_file = argv[++i];
+    else if (arg == "--replay" && i + 1 < argc)
+      replay_file = argv[++i];
+    else if (arg == "--timings" && i + 1 < argc)
+      timings_file = argv[++i];
+    else if (arg == "--shadow-map-size" && i + 1 < argc)
+      shadow_map_size = atoi(argv[++i]);
+    else if (arg == "--pcf" && i + 1 < argc)
+      shadow_map_pcf = atoi(argv[++i]);
+    else if (arg == "--trace" && i + 1 < argc)
+    {
+      trace_file = argv[++i];
+      Trace::start();
+    }
+    else if (arg == "--stream-buffer" && i + 1 < argc)
+      stream_buffer_mib = atof(argv[++i]);
+    else if (arg == "--crowd" && i + 1 < argc)
+      crowd_size = atoi(argv[++i]);
+    else if (arg == "--upload-budget" && i + 1 < argc)
+      upload_budget_ms = atof(argv[++i]);
+    else if (arg == "--views" && i + 1 < argc)
+      views.resize(std::max(1, atoi(argv[++i])));
+    else if (arg == "--compress-keyframes" && i + 1 < argc)
+      keyframe_error = atof(argv[++i]);
+    else
+      args.push_back(arg);
+  }
+  if (args.size() >= 1) path = args[0];
+  if (args.size() >= 2) pak_dir = args[1];
 
   // create an OpenGL window
   glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH |  GLUT_STENCIL);
   glutInitWindowSize(640, 480);
   glutCreateWindow("Ombres, z-zero");
 
+  // Session replay: input is ignored and the log drives the virtual clock
+  if (!replay_file.empty())
+  {
+    if (!replay.open(replay_file))
+    {
+      std::cerr << "Error: couldn't open session " << replay_file << std::endl;
+      exit(-1);
+    }
+    timings.set_gpu_sections(gpu_sections);
+    if (!timings_file.empty() && !timings.open(timings_file))
+      std::cerr << "Warning: couldn't write " << timings_file << std::endl;
+    replaying = true;
+  }
+
   // Initialize application
   atexit(shutdown_app);
-  init(path);
+  init(path, pak_dir);
+
+  // Session recording starts with a snapshot of the whole state
+  if (!record_file.empty() && !replaying)
+  {
+    if (!recorder.open(record_file))
+      std::cerr << "Warning: couldn't write " << record_file << std::endl;
+
+    for (int type = Session::EV_CAMERA; type < Session::EV_COUNT; type++)
+      record(static_cast<Session::EventType>(type));
+  }
 
   // Setup glut callback functions
   glutReshapeFunc(reshape_callback);
   glutDisplayFunc(display_callback);
-  glutKeyboardFunc(keypress_callback);
-  glutSpecialFunc(special_key_press_callback);
-  glutMotionFunc(mouse_motion_callback);
-  glutMouseFunc(mouse_button_callback);
+  if (!replaying)
+  {
+    glutKeyboardFunc(keypress_callback);
+    glutSpecialFunc(special_key_press_callback);
+    glutMotionFunc(mouse_motion_callback);
+    glutMouseFunc(mouse_button_callback);
+  }
   glutWindowStatusFunc(window_status_callback);
   glutIdleFunc(idle_callback);
 
@@ -1,242 +1,1661 @@
 // md2_model.cpp
 
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
-#include <fstream>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <unordered_map>
 #include <vector>
 
 #include <GL/glut.h>
 
+#include "anorms.h"
 #include "md2_model.h"
 #include "vec2.h"
 #include "matrix.h"
+#include "simplify.h"
+#include "gl_state.h"
+#include "image.h"
+#include "stream_buffer.h"
+#include "trace.h"
 
 int Md2::Model::IDENT = 'I' + ('D'<<8) + ('P'<<16) + ('2'<<24);
 int Md2::Model::VERSION = 8;
 
+// Niveaux de détail: nombre de niveaux simplifiés et taille minimale d'un
+// niveau.  Rayon à l'écran (pixels) sous lequel le premier niveau est pris
+// pour l'ombre et pour le personnage, marge d'hystérésis de ce dernier, et
+// pas d'interpolation par niveau (0: continu, 1: images clés seules).
+static const int MESH_LODS = 3;
+static const int MIN_LOD_TRIS = 64;
+static const float SHADOW_LOD_PIXELS = 128;
+static const float MESH_LOD_PIXELS = 96;
+static const float LOD_HYSTERESIS = 0.15f;
+static const int ANIM_LOD_STEPS[MESH_LODS + 1] = { 0, 8, 4, 1 };
+
+/*-------------------------------------------------------------------------*\
+ * in_bounds                                                               *
+\*-------------------------------------------------------------------------*/
+static bool in_bounds(const FileSpan &data, int offset, size_t size)
+{
+  return offset >= 0 && static_cast<size_t>(offset) + size <= data.size;
+}
+
+/***************************************************************************\
+ * Md2::Model::Model                                                       *
+\***************************************************************************/
+Md2::Model::Model(const std::string &name, const FileSpan &data, AnimCache *cache)
+: radius(0), tex_coord_buffer(0), tex_coord_bytes(0), geometry_bytes(0), scale(1), tex(0), source(data), anim_cache(cache),
+  keyframe_error(0)
+{
+  Trace::Scope trace("Model::Model");
+
+  // Le fichier est lu directement depuis la projection mémoire du Vfs
+  std::string error = check(name, data);
+  if (!error.empty())
+  {
+    std::cerr << error << "\n";
+    exit(-1);
+  }
+  std::memcpy(&header, data.data, sizeof(Header));
+
+  // Allocation mémoire
+  skins.resize(header.num_skins);
+  texCoords.resize(header.num_st);
+  triangles.resize(header.num_tris);
+  frames.resize(header.num_frames);
+
+  // Lecture des noms des skins
+  std::memcpy(skins.data(), data.data + header.offset_skins, sizeof(Skin) * header.num_skins);
+
+  // Lecture des coordonnées de texture
+  std::memcpy(texCoords.data(), data.data + header.offset_st, sizeof(TexCoord) * header.num_st);
+
+  // Lecture de la connectivité
+  std::memcpy(triangles.data(), data.data + header.offset_tris, sizeof(Triangle) * header.num_tris);
+
+  // Lecture du répertoire des positions; en mode paginé les sommets ne
+  // sont décodés qu'à la première utilisation de leur animation
+  for (int i = 0; i < header.num_frames; i++)
+  {
+    const unsigned char *ptr = data.data + header.offset_frames + i * header.framesize;
+    std::memcpy(&frames[i].scale, ptr, sizeof(vec3));
+    std::memcpy(&frames[i].translate, ptr + 12, sizeof(vec3));
+    std::memcpy(frames[i].name, ptr + 24, 16);
+
+    if (!anim_cache)
+      decode_frame(i);
+  }
+
+  // Les données ne sont plus référencées en mode normal
+  if (!anim_cache)
+    source = FileSpan();
+
+  // Mise en place des animations
+  setup_animations();
+
+  // Adjacence des triangles, pour l'extraction de silhouette
+  build_adjacency();
+
+  // Coordonnées de texture, fixes pour toutes les images
+  build_tex_coords();
+
+  // Maillages simplifiés, à partir de la première image
+  bool resident = !frames.empty() && !frames[0].verts.empty();
+  if (!frames.empty() && !resident)
+    decode_frame(0);
+  build_lods();
+  if (!resident && !frames.empty())
+  {
+    Frame::Vertices().swap(frames[0].verts);
+    Frame::Normals().swap(frames[0].normals);
+  }
+
+  geometry_bytes = count_geometry();
+  MemStats::account(MemStats::GEOMETRY, geometry_bytes);
+}
+
+/***************************************************************************\
+ * Md2::Model::check                                                       *
+ * Entête, tailles et index du fichier, sans rien allouer: utilisable par  *
+ * les threads de chargement.                                              *
+\***************************************************************************/
+std::string Md2::Model::check(const std::string &name, const FileSpan &data)
+{
+  if (data.empty())
+    return "Ouverture du fichier " + name + " impossible";
+
+  // Lecture de l'entête du fichier
+  Header header;
+  if (data.size < sizeof(Header))
+    return "Fichier " + name + " tronqué";
+  std::memcpy(&header, data.data, sizeof(Header));
+
+  // Vérification de la validité du fichier
+  if (header.ident != IDENT || header.version != VERSION)
+    return "Mauvais type de fichier";
+
+  if (header.num_skins < 0 || header.num_vertices < 0 || header.num_st < 0 ||
+      header.num_tris < 0 || header.num_frames < 0)
+    return "Fichier " + name + " invalide";
+
+  const size_t frame_bytes = 40 + sizeof(CompressedVertex) * header.num_vertices;
+  if (!in_bounds(data, header.offset_skins, sizeof(Skin) * header.num_skins) ||
+      !in_bounds(data, header.offset_st, sizeof(TexCoord) * header.num_st) ||
+      !in_bounds(data, header.offset_tris, sizeof(Triangle) * header.num_tris) ||
+      header.framesize < 0 || static_cast<size_t>(header.framesize) < frame_bytes ||
+      !in_bounds(data, header.offset_frames, static_cast<size_t>(header.framesize) * header.num_frames))
+    return "Fichier " + name + " tronqué";
+
+  // Les triangles ne doivent référencer que des sommets et coordonnées de
+  // texture du fichier
+  for (int i = 0; i < header.num_tris; i++)
+  {
+    Triangle tri;
+    std::memcpy(&tri, data.data + header.offset_tris + i * sizeof(Triangle), sizeof(Triangle));
+    for (int j = 0; j < 3; j++)
+      if (tri.vertex[j] >= header.num_vertices || tri.st[j] >= header.num_st)
+        return "Fichier " + name + " invalide: triangle " + std::to_string(i);
+  }
+
+  return std::string();
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::count_geometry                                              *
+ * Mémoire des données fixes du modèle, hors sommets des images.           *
+\*-------------------------------------------------------------------------*/
+size_t Md2::Model::count_geometry() const
+{
+  size_t bytes = skins.capacity() * sizeof(Skin) + texCoords.capacity() * sizeof(TexCoord) +
+                 triangles.capacity() * sizeof(Triangle) + frames.capacity() * sizeof(Frame) +
+                 edges.capacity() * sizeof(Edge) + tex_coords.capacity() * sizeof(vec2);
+
+  for (const std::vector<unsigned> &level : lods)
+    bytes += level.capacity() * sizeof(unsigned);
+  for (const std::vector<vec2> &level : lod_tex_coords)
+    bytes += level.capacity() * sizeof(vec2);
+
+  return bytes;
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::build_lods                                                  *
+ * Simplification par contraction d'arêtes (erreur quadrique) de la        *
+ * topologie de la première image: chaque niveau garde moitié moins de     *
+ * triangles que le précédent.  Les sommets n'étant pas déplacés, les      *
+ * index valent pour toutes les images.  Chaque triangle gardé reprend les *
+ * coordonnées de texture de ses coins d'origine.                          *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::build_lods()
+{
+  radius = 0;
+  if (frames.empty() || header.num_tris < 2 * MIN_LOD_TRIS)
+    return;
+
+  const Frame &frame = frames[0];
+  std::vector<vec3> positions(header.num_vertices);
+  for (int k = 0; k < header.num_vertices; k++)
+  {
+    positions[k] = frame.scale * frame.verts[k] + frame.translate;
+    radius = std::max(radius, positions[k].length());
+  }
+
+  std::vector<unsigned> indices(header.num_tris * 3);
+  for (int i = 0; i < header.num_tris; i++)
+    for (int j = 0; j < 3; j++)
+      indices[i * 3 + j] = triangles[i].vertex[j];
+
+  std::vector<size_t> targets;
+  for (int level = 1; level <= MESH_LODS; level++)
+  {
+    int target = header.num_tris >> level;
+    if (target < MIN_LOD_TRIS)
+      break;
+    targets.push_back(target);
+  }
+
+  std::vector<std::vector<unsigned> > sources;
+  lods = simplify_mesh(positions.data(), positions.size(), indices, targets, &sources);
+
+  lod_tex_coords.resize(lods.size());
+  for (size_t l = 0; l < lods.size(); l++)
+  {
+    lod_tex_coords[l].resize(lods[l].size());
+    for (size_t t = 0; t < sources[l].size(); t++)
+      for (int j = 0; j < 3; j++)
+        lod_tex_coords[l][t * 3 + j] = tex_coords[sources[l][t] * 3 + j];
+  }
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::build_tex_coords                                            *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::build_tex_coords()
+{
+  tex_coords.resize(header.num_tris * 3);
+
+  for (int i = 0; i < header.num_tris; ++i)
+  {
+    for (int j = 0; j < 3; ++j)
+    {
+      const TexCoord *pTexCoords = &texCoords[triangles[i].st[j]];
+      float s = static_cast<float>(pTexCoords->s) / header.skinwidth;
+      float t = static_cast<float>(pTexCoords->t) / header.skinheight;
+      tex_coords[i * 3 + j] = vec2(s, 1 - t);
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::build_adjacency                                             *
+ * Apparie chaque arête orientée a -> b avec l'arête b -> a d'un triangle  *
+ * voisin.  Les arêtes sans voisin (bords, arêtes non-manifold ou mal      *
+ * orientées) restent des bords.                                           *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::build_adjacency()
+{
+  std::unordered_map<unsigned, int> open_edges;
+
+  edges.clear();
+  edges.reserve(header.num_tris * 3 / 2 + 1);
+
+  for (int i = 0; i < header.num_tris; ++i)
+  {
+    for (int j = 0; j < 3; ++j)
+    {
+      unsigned short a = triangles[i].vertex[j];
+      unsigned short b = triangles[i].vertex[(j + 1) % 3];
+      if (a == b)
+        continue;
+
+      auto it = open_edges.find((unsigned(b) << 16) | a);
+      if (it != open_edges.end())
+      {
+        edges[it->second].tri[1] = i;
+        open_edges.erase(it);
+        continue;
+      }
+
+      Edge e = { { a, b }, { i, -1 } };
+      open_edges.insert(std::make_pair((unsigned(a) << 16) | b, static_cast<int>(edges.size())));
+      edges.push_back(e);
+    }
+  }
+}
+
+/***************************************************************************\
+ * Md2::Model::~Model                                                      *
+\***************************************************************************/
+Md2::Model::~Model()
+{
+  if (anim_cache)
+    anim_cache->forget(this);
+  if (tex_coord_buffer)
+  {
+    glDeleteBuffers(1, &tex_coord_buffer);
+    MemStats::account(MemStats::GPU_BUFFERS, -static_cast<long>(tex_coord_bytes));
+  }
+  MemStats::account(MemStats::GEOMETRY, -static_cast<long>(geometry_bytes));
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::decode_frame                                                *
+ * Décompression des sommets d'une position et de l'index de leur normale. *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::decode_frame(int frame)
+{
+  const unsigned char *ptr = source.data + header.offset_frames + frame * header.framesize;
+  const CompressedVertex *compressed_verts = reinterpret_cast<const CompressedVertex *>(ptr + 40);
+  Frame::Vertices &verts = frames[frame].verts;
+  Frame::Normals &normals = frames[frame].normals;
+
+  verts.resize(header.num_vertices);
+  normals.resize(header.num_vertices);
+  for (int k = 0; k < header.num_vertices; k++)
+  {
+    verts[k] = vec3(compressed_verts[k].v[0],
+                    compressed_verts[k].v[1],
+                    compressed_verts[k].v[2]);
+    normals[k] = std::min<int>(compressed_verts[k].normalIndex, NUM_ANORMS - 1);
+  }
+}
+
+/***************************************************************************\
+ * Md2::Model::read_frame                                                  *
+ * Positions (avant mise à l'échelle) et normales d'une image, décodées    *
+ * depuis le fichier si elle n'est pas résidente (mode paginé).            *
+\***************************************************************************/
+void Md2::Model::read_frame(int frame, vec3 *positions, unsigned char *normals) const
+{
+  const Frame &f = frames[frame];
+
+  if (!f.normals.empty())
+  {
+    keyframe(frame).decode(0, header.num_vertices, positions);
+    std::copy(f.normals.begin(), f.normals.end(), normals);
+    return;
+  }
+
+  const unsigned char *ptr = source.data + header.offset_frames + frame * header.framesize;
+  const CompressedVertex *compressed_verts = reinterpret_cast<const CompressedVertex *>(ptr + 40);
+
+  for (int k = 0; k < header.num_vertices; k++)
+  {
+    vec3 v(compressed_verts[k].v[0], compressed_verts[k].v[1], compressed_verts[k].v[2]);
+    positions[k] = f.scale * v + f.translate;
+    normals[k] = std::min<int>(compressed_verts[k].normalIndex, NUM_ANORMS - 1);
+  }
+}
+
+/***************************************************************************\
+ * Md2::Model::page_in                                                     *
+ * Décode les positions d'une animation si nécessaire (mode paginé).       *
+\***************************************************************************/
+void Md2::Model::page_in(const Anim &anim)
+{
+  if (!anim_cache)
+    return;
+
+  if (frames[anim.start].verts.empty())
+    for (int i = anim.start; i <= anim.end; i++)
+      decode_frame(i);
+
+  anim_cache->touch(this, anim, (anim.end - anim.start + 1) * header.num_vertices * (sizeof(vec3) + 1));
+}
+
+/***************************************************************************\
+ * Md2::Model::page_out                                                    *
+ * Libère les sommets décodés d'une animation (appelé par AnimCache).      *
+\***************************************************************************/
+void Md2::Model::page_out(const Anim &anim)
+{
+  for (int i = anim.start; i <= anim.end; i++)
+  {
+    Frame::Vertices().swap(frames[i].verts);
+    Frame::Normals().swap(frames[i].normals);
+  }
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::require_frame                                               *
+ * Rend résidente l'animation contenant la position 'frame'.               *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::require_frame(int frame)
+{
+  if (!anim_cache)
+    return;
+
+  for (auto &anim : anims)
+    if (frame >= anim.second.start && frame <= anim.second.end)
+    {
+      page_in(anim.second);
+      return;
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::keyframe                                                    *
+ * Accès aux sommets d'une position, décodée ou compressée.                *
+\*-------------------------------------------------------------------------*/
+Md2::Model::KeyframeReader Md2::Model::keyframe(int frame) const
+{
+  if (!packed_anims.empty())
+    return keyframe(packed_anims[frame_packs[frame]], frame);
+
+  KeyframeReader reader;
+  reader.coding = KeyframeReader::RESIDENT;
+  reader.verts = frames[frame].verts.data();
+  reader.references = nullptr;
+  reader.deltas = nullptr;
+  reader.ref_size = reader.delta_size = 0;
+  reader.scale = frames[frame].scale;
+  reader.translate = frames[frame].translate;
+  return reader;
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::keyframe                                                    *
+ * Lecture d'une position d'une animation compressée.                      *
+\*-------------------------------------------------------------------------*/
+Md2::Model::KeyframeReader Md2::Model::keyframe(const PackedAnim &pack, int frame) const
+{
+  int f = frame - pack.start;
+  KeyframeReader reader;
+  reader.verts = nullptr;
+  reader.references = pack.references.data();
+  reader.deltas = pack.deltas.data() + f * pack.frame_bytes;
+  reader.ref_size = reader.delta_size = 0;
+  for (int c = 0; c < 3; c++)
+  {
+    reader.ref_bits[c] = pack.ref_bits[c];
+    reader.delta_bits[c] = pack.delta_bits[c];
+    reader.ref_size += pack.ref_bits[c];
+    reader.delta_size += pack.delta_bits[c];
+  }
+  reader.translate = pack.native ? frames[frame].translate : pack.origin;
+  reader.scale = pack.native ? frames[frame].scale : pack.step;
+
+  if (reader.ref_size > 57 || reader.delta_size > 57)
+    reader.coding = KeyframeReader::WIDE;
+  else if (reader.ref_size)
+    reader.coding = KeyframeReader::REFERENCED;
+  else if (reader.delta_bits[0] == 8 && reader.delta_bits[1] == 8 && reader.delta_bits[2] == 8)
+    reader.coding = KeyframeReader::BYTES;
+  else
+    reader.coding = KeyframeReader::PACKED;
+  return reader;
+}
+
+/*-------------------------------------------------------------------------*\
+ * read_word                                                               *
+ * Les 64 bits à partir du bit 'offset'; les tampons ont 7 octets de       *
+ * marge.                                                                  *
+\*-------------------------------------------------------------------------*/
+static inline uint64_t read_word(const unsigned char *bits, size_t offset)
+{
+  uint64_t word;
+  std::memcpy(&word, bits + (offset >> 3), sizeof(word));
+  return word >> (offset & 7);
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::KeyframeReader::decode_packed                               *
+ * Enregistrements de 57 bits au plus: une lecture par enregistrement (et  *
+ * par référence), champs extraits par décalages et masques fixes.         *
+\*-------------------------------------------------------------------------*/
+template <bool REFERENCED>
+void Md2::Model::KeyframeReader::decode_packed(int first, int count, vec3 *out) const
+{
+  const int *db = delta_bits, *rb = ref_bits;
+  const uint64_t dmask0 = (uint64_t(1) << db[0]) - 1, dmask1 = (uint64_t(1) << db[1]) - 1,
+                 dmask2 = (uint64_t(1) << db[2]) - 1;
+  const uint64_t rmask0 = (uint64_t(1) << rb[0]) - 1, rmask1 = (uint64_t(1) << rb[1]) - 1,
+                 rmask2 = (uint64_t(1) << rb[2]) - 1;
+  const int dshift1 = db[0], dshift2 = db[0] + db[1];
+  const int rshift1 = rb[0], rshift2 = rb[0] + rb[1];
+  // Copies locales: les écritures dans 'out' pourraient sinon les modifier
+  const unsigned char *dbits = deltas, *rbits = references;
+  const int dsize = delta_size, rsize = ref_size;
+  const vec3 s = scale, t = translate;
+
+  size_t delta_offset = static_cast<size_t>(first) * dsize;
+  size_t ref_offset = static_cast<size_t>(first) * rsize;
+  for (int i = 0; i < count; i++)
+  {
+    uint64_t d = read_word(dbits, delta_offset);
+    uint64_t x = d & dmask0, y = (d >> dshift1) & dmask1, z = (d >> dshift2) & dmask2;
+    delta_offset += dsize;
+    if (REFERENCED)
+    {
+      uint64_t r = read_word(rbits, ref_offset);
+      x += r & rmask0;
+      y += (r >> rshift1) & rmask1;
+      z += (r >> rshift2) & rmask2;
+      ref_offset += rsize;
+    }
+    // Moins de 2^25: conversion signée sur 32 bits, la plus rapide
+    out[i] = s * vec3(float(int(x)), float(int(y)), float(int(z))) + t;
+  }
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::KeyframeReader::decode                                      *
+ * Positions (avant mise à l'échelle) des sommets first..first+count-1.    *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::KeyframeReader::decode(int first, int count, vec3 *out) const
+{
+  const vec3 s = scale, t = translate;
+
+  switch (coding)
+  {
+    case RESIDENT:
+    {
+      const vec3 *in = verts + first;
+      for (int i = 0; i < count; i++)
+        out[i] = s * in[i] + t;
+      break;
+    }
+
+    case BYTES:
+    {
+      // Les octets du MD2, sans la normale
+      const unsigned char *bytes = deltas + 3 * static_cast<size_t>(first);
+      for (int i = 0; i < count; i++, bytes += 3)
+        out[i] = s * vec3(bytes[0], bytes[1], bytes[2]) + t;
+      break;
+    }
+
+    case PACKED:
+      decode_packed<false>(first, count, out);
+      break;
+
+    case REFERENCED:
+      decode_packed<true>(first, count, out);
+      break;
+
+    case WIDE:
+      // Champ par champ
+      for (int i = 0; i < count; i++)
+      {
+        size_t delta_offset = static_cast<size_t>(first + i) * delta_size;
+        size_t ref_offset = static_cast<size_t>(first + i) * ref_size;
+        float v[3];
+        for (int c = 0; c < 3; c++)
+        {
+          uint64_t value = read_word(deltas, delta_offset) & ((uint64_t(1) << delta_bits[c]) - 1);
+          if (ref_size)
+            value += read_word(references, ref_offset) & ((uint64_t(1) << ref_bits[c]) - 1);
+          delta_offset += delta_bits[c];
+          ref_offset += ref_bits[c];
+          v[c] = float(int(value));
+        }
+        out[i] = s * vec3(v[0], v[1], v[2]) + t;
+      }
+      break;
+  }
+}
+
+/*-------------------------------------------------------------------------*\
+ * bits_for                                                                *
+ * Nombre de bits pour écrire les valeurs de 0 à 'max'.                    *
+\*-------------------------------------------------------------------------*/
+static int bits_for(long max)
+{
+  int bits = 0;
+  while (bits < 31 && (1L << bits) <= max)
+    bits++;
+  return bits;
+}
+
+/*-------------------------------------------------------------------------*\
+ * put_field                                                               *
+ * Écriture d'un champ de 24 bits au plus dans un tampon mis à zéro.       *
+\*-------------------------------------------------------------------------*/
+static void put_field(unsigned char *bits, unsigned offset, unsigned value)
+{
+  uint32_t word;
+  std::memcpy(&word, bits + (offset >> 3), sizeof(word));
+  word |= value << (offset & 7);
+  std::memcpy(bits + (offset >> 3), &word, sizeof(word));
+}
+
+/***************************************************************************\
+ * Md2::Model::compress                                                    *
+ * Chaque animation est quantifiée sur une grille de pas 2 * max_error,    *
+ * donc à max_error près sur chaque axe, et chaque axe n'a que les bits    *
+ * que demande son amplitude.  Trois codages sont comparés, le plus petit  *
+ * est gardé:                                                              *
+ * - la grille seule, depuis le coin minimal de l'animation;               *
+ * - la grille en écart au minimum de chaque sommet sur l'animation (la    *
+ *   référence, codée une fois), quand les sommets bougent peu;           *
+ * - les octets du MD2 (sans perte), quand aucun n'est plus petit.         *
+ * Les positions hors de toute animation forment chacune la leur.          *
+\***************************************************************************/
+bool Md2::Model::compress(float max_error)
+{
+  if (anim_cache || max_error <= 0 || frames.empty() || is_compressed())
+    return false;
+
+  Trace::Scope trace("Model::compress");
+  const int num_vertices = header.num_vertices;
+  const int MAX_BITS = 24;
+
+  // Découpage des positions en animations, sans chevauchement
+  std::vector<Anim> sorted;
+  for (const auto &anim : anims)
+    sorted.push_back(anim.second);
+  std::sort(sorted.begin(), sorted.end(),
+            [](const Anim &a, const Anim &b) { return a.start < b.start; });
+
+  std::vector<Anim> spans;
+  int next = 0;
+  for (const Anim &anim : sorted)
+  {
+    if (anim.start < next || anim.end >= header.num_frames)
+      continue;
+    for (; next < anim.start; next++)
+      spans.push_back(Anim { next, next });
+    spans.push_back(anim);
+    next = anim.end + 1;
+  }
+  for (; next < header.num_frames; next++)
+    spans.push_back(Anim { next, next });
+
+  std::vector<PackedAnim> packs(spans.size());
+  std::vector<int> owners(header.num_frames);
+  float error = 0;
+
+  for (size_t a = 0; a < spans.size(); a++)
+  {
+    const Anim &span = spans[a];
+    const int count = span.end - span.start + 1;
+    PackedAnim &pack = packs[a];
+    pack.start = span.start;
+
+    // Positions d'origine, bornes de l'animation et de chaque sommet
+    std::vector<vec3> positions(static_cast<size_t>(count) * num_vertices);
+    std::vector<vec3> lowest(num_vertices);
+    vec3 lo, hi;
+    for (int f = 0; f < count; f++)
+    {
+      keyframe(span.start + f).decode(0, num_vertices, &positions[f * num_vertices]);
+      for (int k = 0; k < num_vertices; k++)
+      {
+        const vec3 v = positions[f * num_vertices + k];
+        if (f == 0)
+          lowest[k] = v;
+        if (f == 0 && k == 0)
+          lo = hi = v;
+        lowest[k] = vec3(std::min(lowest[k].x, v.x), std::min(lowest[k].y, v.y), std::min(lowest[k].z, v.z));
+        lo = vec3(std::min(lo.x, v.x), std::min(lo.y, v.y), std::min(lo.z, v.z));
+        hi = vec3(std::max(hi.x, v.x), std::max(hi.y, v.y), std::max(hi.z, v.z));
+      }
+      owners[span.start + f] = a;
+    }
+
+    // Pas de la grille, moins l'arrondi des flottants au codage et au
+    // décodage (quelques ulp de la plus grande coordonnée).  S'il ne reste
+    // rien, seuls les octets du MD2 tiennent la borne.
+    const float magnitude = std::max(std::max(std::max(std::fabs(lo.x), std::fabs(hi.x)),
+                                              std::max(std::fabs(lo.y), std::fabs(hi.y))),
+                                     std::max(std::fabs(lo.z), std::fabs(hi.z)));
+    const float step = 2 * (max_error * 0.9999f - 8 * FLT_EPSILON * magnitude);
+    const bool on_grid = step > 0;
+
+    // Valeurs entières sur la grille, par axe
+    auto grid = [&](const vec3 &v, int c) -> long
+    {
+      const float d[3] = { v.x - lo.x, v.y - lo.y, v.z - lo.z };
+      return std::lround(d[c] / step);
+    };
+
+    // Largeur des champs de chaque codage (sur la grille: sans puis avec
+    // référence; MD2: 8 bits)
+    int flat_bits[3] = { 0, 0, 0 }, ref_bits[3] = { 0, 0, 0 }, delta_bits[3] = { 0, 0, 0 };
+    if (on_grid)
+    {
+      long ref_max[3] = { 0, 0, 0 }, delta_max[3] = { 0, 0, 0 };
+      for (int k = 0; k < num_vertices; k++)
+        for (int c = 0; c < 3; c++)
+          ref_max[c] = std::max(ref_max[c], grid(lowest[k], c));
+      for (int f = 0; f < count; f++)
+        for (int k = 0; k < num_vertices; k++)
+          for (int c = 0; c < 3; c++)
+            delta_max[c] = std::max(delta_max[c], grid(positions[f * num_vertices + k], c) - grid(lowest[k], c));
+      for (int c = 0; c < 3; c++)
+      {
+        const float extent[3] = { hi.x - lo.x, hi.y - lo.y, hi.z - lo.z };
+        flat_bits[c] = bits_for(std::lround(extent[c] / step));
+        ref_bits[c] = bits_for(ref_max[c]);
+        delta_bits[c] = bits_for(delta_max[c]);
+      }
+    }
+
+    auto bytes = [&](const int *refs, const int *deltas) -> size_t
+    {
+      if (std::max(refs[0], std::max(refs[1], refs[2])) > MAX_BITS ||
+          std::max(deltas[0], std::max(deltas[1], deltas[2])) > MAX_BITS)
+        return static_cast<size_t>(-1);
+      size_t ref_size = static_cast<size_t>(num_vertices) * (refs[0] + refs[1] + refs[2]);
+      size_t delta_size = static_cast<size_t>(num_vertices) * (deltas[0] + deltas[1] + deltas[2]);
+      return (ref_size + 7) / 8 + count * ((delta_size + 7) / 8);
+    };
+
+    const int none[3] = { 0, 0, 0 };
+    const int native[3] = { 8, 8, 8 };
+    enum { NATIVE, FLAT, REFERENCED } coding = NATIVE;
+    size_t best = bytes(none, native);
+    if (on_grid && bytes(none, flat_bits) < best)
+    {
+      coding = FLAT;
+      best = bytes(none, flat_bits);
+    }
+    if (on_grid && bytes(ref_bits, delta_bits) < best)
+      coding = REFERENCED;
+
+    // Codage, puis mesure de l'erreur sur les positions d'origine; les
+    // octets du MD2 (sans perte) si l'arrondi dépasse quand même la borne
+    float anim_error;
+    std::vector<vec3> decoded(num_vertices);
+    for (;;)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        pack.ref_bits[c] = coding == REFERENCED ? ref_bits[c] : 0;
+        pack.delta_bits[c] = coding == NATIVE ? 8 : coding == FLAT ? flat_bits[c] : delta_bits[c];
+      }
+      int ref_size = pack.ref_bits[0] + pack.ref_bits[1] + pack.ref_bits[2];
+      int delta_size = pack.delta_bits[0] + pack.delta_bits[1] + pack.delta_bits[2];
+      pack.frame_bytes = (static_cast<size_t>(num_vertices) * delta_size + 7) / 8;
+
+      pack.native = (coding == NATIVE);
+      pack.origin = lo;
+      pack.step = vec3(step, step, step);
+
+      // Écriture des champs; 7 octets de marge pour les lectures de 64 bits
+      if (ref_size)
+        pack.references.assign((static_cast<size_t>(num_vertices) * ref_size + 7) / 8 + 7, 0);
+      else
+        decltype(pack.references)().swap(pack.references);
+      pack.deltas.assign(count * pack.frame_bytes + 7, 0);
+
+      if (coding == REFERENCED)
+        for (int k = 0; k < num_vertices; k++)
+        {
+          unsigned offset = k * ref_size;
+          for (int c = 0; c < 3; offset += pack.ref_bits[c], c++)
+            put_field(pack.references.data(), offset, grid(lowest[k], c));
+        }
+
+      for (int f = 0; f < count; f++)
+      {
+        const Frame &frame = frames[span.start + f];
+        unsigned char *deltas = pack.deltas.data() + f * pack.frame_bytes;
+
+        for (int k = 0; k < num_vertices; k++)
+        {
+          unsigned offset = k * delta_size;
+          for (int c = 0; c < 3; offset += pack.delta_bits[c], c++)
+          {
+            long value;
+            if (coding == NATIVE)
+            {
+              const float v[3] = { frame.verts[k].x, frame.verts[k].y, frame.verts[k].z };
+              value = std::lround(v[c]);
+            }
+            else
+            {
+              value = grid(positions[f * num_vertices + k], c);
+              if (coding == REFERENCED)
+                value -= grid(lowest[k], c);
+            }
+            put_field(deltas, offset, value);
+          }
+        }
+      }
+
+      anim_error = 0;
+      for (int f = 0; f < count; f++)
+      {
+        keyframe(pack, span.start + f).decode(0, num_vertices, decoded.data());
+        for (int k = 0; k < num_vertices; k++)
+        {
+          vec3 d = decoded[k] - positions[f * num_vertices + k];
+          anim_error = std::max(anim_error, std::max(std::fabs(d.x), std::max(std::fabs(d.y), std::fabs(d.z))));
+        }
+      }
+      if (anim_error <= max_error || coding == NATIVE)
+        break;
+      coding = NATIVE;
+    }
+    error = std::max(error, anim_error);
+  }
+
+  // Remplacement des positions décodées
+  for (Frame &frame : frames)
+    Frame::Vertices().swap(frame.verts);
+  packed_anims.swap(packs);
+  frame_packs.swap(owners);
+  keyframe_error = error;
+  return true;
+}
+
+/***************************************************************************\
+ * Md2::Model::load_texture                                                *
+ * Charge une texture depuis un fichier et l'ajoute à la liste des skins   *
+\***************************************************************************/
+bool Md2::Model::load_texture(const std::string &filename, const FileSpan &data)
+{
+  std::string error = Image::check(filename, data);
+  if (!error.empty())
+  {
+    std::cerr << error << "\n";
+    return false;
+  }
+
+  GLuint tex = texture_manager.get_texture(filename, data);
+
+  skin_ids[filename] = tex;
+  skin_files.erase(filename);
+
+  return true;
+}
+
+/***************************************************************************\
+ * Md2::Model::add_skin                                                    *
+ * Ajoute un skin à la liste sans le charger : il sera décodé et envoyé à  *
+ * OpenGL la première fois qu'il sera choisi                               *
+\***************************************************************************/
+void Md2::Model::add_skin(const std::string &filename, const FileSpan &data)
+{
+  if (skin_ids.insert(SkinMap::value_type(filename, 0)).second)
+    skin_files[filename] = data;
+}
+
+/***************************************************************************\
+ * Md2::Model::add_texture                                                 *
+ * Ajoute aux skins une image déjà décodée (par le chargeur en tâche de    *
+ * fond)                                                                   *
+\***************************************************************************/
+void Md2::Model::add_texture(const std::string &filename, const Image &image)
+{
+  GLuint tex = texture_manager.add_texture(filename, image);
+
+  skin_ids[filename] = tex;
+  skin_files.erase(filename);
+}
+
+/***************************************************************************\
+ * Md2::Model::set_texture                                                 *
+ * Choisit une texture comme skin courante, en la chargeant si besoin     *
+\***************************************************************************/
+void Md2::Model::set_texture(const std::string &filename)
+{
+  auto iter = skin_ids.find(filename);
+
+  if (iter == skin_ids.end())
+  {
+    tex = 0;
+    return;
+  }
+
+  // Premier choix de ce skin : décodage et envoi à OpenGL.  Un fichier
+  // corrompu garde la texture courante au lieu d'arrêter le programme
+  auto file = skin_files.find(filename);
+  if (file != skin_files.end())
+  {
+    std::string error = Image::check(filename, file->second);
+    if (!error.empty())
+    {
+      std::cerr << error << "\n";
+      return;
+    }
+    iter->second = texture_manager.get_texture(filename, file->second);
+    skin_files.erase(file);
+  }
+
+  tex = iter->second;
+}
+
+/***************************************************************************\
+ * Md2::Model::setup_animations                                            *
+ * Crée la liste des animations.                                           *
+\***************************************************************************/
+void Md2::Model::setup_animations()
+{
+  std::string current_anim;
+  Anim anim_info = { 0, 0 };
+
+  for (int i = 0; i < header.num_frames; i++)
+  {
+    std::string frame_name = frames[i].name;
+    std::string frame_anim;
+
+    // Extraction des noms d'animations à partir des noms des positions
+    std::string::size_type len = frame_name.find_first_of("0123456789");
+    if ((len == frame_name.length () - 3) &&
+        (frame_name[len] != '0'))
+      len++;
+
+    frame_anim.assign(frame_name, 0, len);
+
+    if (current_anim != frame_anim)
+    {
+      if (i > 0)
+        anims.insert(AnimMap::value_type(current_anim, anim_info));
+      // Passage à l'animation suivante
+      anim_info.start = i;
+      anim_info.end = i;
+
+      current_anim = frame_anim;
+    }
+    else
+      anim_info.end = i;
+  }
+
+  // Ajout de la dernière animation
+  anims.insert(AnimMap::value_type(current_anim, anim_info));
+}
+
+// Position de la lumière
+vec3 light_pos{ 0, -2, 10 };
+
+// Mode de calcul de l'ombre
+Md2::ShadowMode Md2::shadow_mode = Md2::SHADOW_PROJECTED;
+
+// Niveaux de détail des personnages
+bool Md2::mesh_lod = true;
+
+// Plan recevant l'ombre (z = -2.41)
+static const vec4 shadow_plane(0, 0, 1, 2.41);
+
+/*-------------------------------------------------------------------------*\
+ * shadow_matrix                                                           *
+ * Matrice de projection centrale sur le plan de l'ombre depuis la         *
+ * lumière directionnelle light_pos (M = (P.L) I - L P^T).                 *
+\*-------------------------------------------------------------------------*/
+static matrix shadow_matrix()
+{
+  const vec4 &P = shadow_plane;
+  vec4 light(light_pos.x, light_pos.y, light_pos.z, 0);
+  float d = P.dot(light);
+  vec4 v0(d - light.x * P.x, -light.x * P.y, -light.x * P.z, -light.x * P.w);
+  vec4 v1(-light.y * P.x, d - light.y * P.y, -light.y * P.z, -light.y * P.w);
+  vec4 v2(-light.z * P.x, -light.z * P.y, d - light.z * P.z, -light.z * P.w);
+  vec4 v3(-light.w * P.x, -light.w * P.y, -light.w * P.z, d - light.w * P.w);
+
+  return matrix(v0, v1, v2, v3);
+}
+
+/*-------------------------------------------------------------------------*\
+ * light_facing                                                            *
+ * Vrai si le triangle (a, b, c) fait face à la lumière directionnelle     *
+ * light.  Les triangles MD2 sont orientés dans le sens horaire, la        *
+ * normale sortante est donc (c - a) ^ (b - a).                            *
+\*-------------------------------------------------------------------------*/
+static inline bool light_facing(const vec3 &a, const vec3 &b, const vec3 &c, const vec3 &light)
+{
+  return ((c - a) ^ (b - a)).dot(light) > 0;
+}
+
+/*-------------------------------------------------------------------------*\
+ * vertex_pointer                                                          *
+ * Positions copiées dans le stream buffer si 'offset' est valide, sinon   *
+ * tableau côté client.                                                    *
+\*-------------------------------------------------------------------------*/
+static void vertex_pointer(GLint size, GLintptr offset, const void *data)
+{
+  if (offset >= 0)
+  {
+    gl_state.bind_buffer(stream_buffer.get_buffer());
+    glVertexPointer(size, GL_FLOAT, 0, reinterpret_cast<const GLvoid *>(offset));
+  }
+  else
+  {
+    gl_state.bind_buffer(0);
+    glVertexPointer(size, GL_FLOAT, 0, data);
+  }
+}
+
+/*-------------------------------------------------------------------------*\
+ * color_pointer                                                           *
+ * Couleurs RGBA, comme vertex_pointer.                                    *
+\*-------------------------------------------------------------------------*/
+static void color_pointer(GLintptr offset, const void *data)
+{
+  if (offset >= 0)
+  {
+    gl_state.bind_buffer(stream_buffer.get_buffer());
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, reinterpret_cast<const GLvoid *>(offset));
+  }
+  else
+  {
+    gl_state.bind_buffer(0);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, data);
+  }
+}
+
+/*-------------------------------------------------------------------------*\
+ * draw_box                                                                *
+\*-------------------------------------------------------------------------*/
+static void draw_box(const vec3 &lo, const vec3 &hi)
+{
+  glBegin(GL_QUAD_STRIP);
+    glVertex3f(lo.x, lo.y, lo.z); glVertex3f(lo.x, lo.y, hi.z);
+    glVertex3f(hi.x, lo.y, lo.z); glVertex3f(hi.x, lo.y, hi.z);
+    glVertex3f(hi.x, hi.y, lo.z); glVertex3f(hi.x, hi.y, hi.z);
+    glVertex3f(lo.x, hi.y, lo.z); glVertex3f(lo.x, hi.y, hi.z);
+    glVertex3f(lo.x, lo.y, lo.z); glVertex3f(lo.x, lo.y, hi.z);
+  glEnd();
+
+  glBegin(GL_QUADS);
+    glVertex3f(lo.x, lo.y, lo.z); glVertex3f(hi.x, lo.y, lo.z);
+    glVertex3f(hi.x, hi.y, lo.z); glVertex3f(lo.x, hi.y, lo.z);
+    glVertex3f(lo.x, lo.y, hi.z); glVertex3f(lo.x, hi.y, hi.z);
+    glVertex3f(hi.x, hi.y, hi.z); glVertex3f(hi.x, lo.y, hi.z);
+  glEnd();
+}
+
+/*-------------------------------------------------------------------------*\
+ * screen_radius                                                           *
+ * Rayon à l'écran, en pixels, d'une sphère du repère courant avec les     *
+ * matrices de GL.  Négatif si la projection n'est pas en perspective ou   *
+ * si la sphère est derrière la caméra.                                    *
+\*-------------------------------------------------------------------------*/
+static float screen_radius(const vec3 &center, float radius)
+{
+  GLfloat modelview[16], projection[16];
+  GLint viewport[4];
+  glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+  glGetFloatv(GL_PROJECTION_MATRIX, projection);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  vec3 eye_center = matrix(modelview) * center;
+  if (projection[15] != 0 || eye_center.z >= 0)
+    return -1;
+
+  return radius * projection[5] * viewport[3] * 0.5f / -eye_center.z;
+}
+
+/***************************************************************************\
+ * Md2::Model::get_frame_bounds                                            *
+ * Les sommets compressés vont de 0 à 255 sur chaque axe.                  *
+\***************************************************************************/
+void Md2::Model::get_frame_bounds(int frame, vec3 &lo, vec3 &hi) const
+{
+  lo = frames[frame].translate;
+  hi = frames[frame].translate + frames[frame].scale * 255.0f;
+}
+
+/***************************************************************************\
+ * Md2::Model::get_screen_radius                                           *
+\***************************************************************************/
+float Md2::Model::get_screen_radius() const
+{
+  return screen_radius(vec3(0, 0, 0), radius * scale);
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::select_shadow_lod                                           *
+ * Niveau d'après le rayon à l'écran de l'empreinte de l'ombre (le rayon   *
+ * du modèle autour de la projection de son origine): un niveau de plus à  *
+ * chaque division par deux sous SHADOW_LOD_PIXELS.                        *
+\*-------------------------------------------------------------------------*/
+int Md2::Model::select_shadow_lod() const
+{
+  if (lods.empty())
+    return 0;
+
+  float pixels = screen_radius(shadow_matrix() * vec3(0, 0, 0), radius * scale);
+  if (pixels < 0)
+    return 0;
+
+  int lod = 0;
+  for (float limit = SHADOW_LOD_PIXELS; pixels < limit && lod < static_cast<int>(lods.size()); limit *= 0.5f)
+    lod++;
+  return lod;
+}
+
+/***************************************************************************\
+ * Md2::Model::draw_model                                                  *
+\***************************************************************************/
+void Md2::Model::draw_model(int frameA, int frameB, float interp, PoseCache &pose, int lod)
+{
+  Trace::Scope trace("Model::draw_model");
+  prepare(frameA, frameB, interp, pose, lod);
+  draw_shadow(pose);
+  draw_character(pose);
+  gl_state.client_state(GL_TEXTURE_COORD_ARRAY, false);
+  gl_state.client_state(GL_COLOR_ARRAY, false);
+}
+
+/***************************************************************************\
+ * Md2::Model::prepare                                                     *
+\***************************************************************************/
+void Md2::Model::prepare(int frameA, int frameB, float interp, PoseCache &pose, int lod)
+{
+  Trace::Scope trace("Model::prepare");
+  lod = std::min(std::max(lod, 0), static_cast<int>(lods.size()));
+
+  // Pose: rien à refaire si les images, l'interpolation, l'échelle, le
+  // niveau de détail et la lumière (éclairage des sommets) n'ont pas
+  // changé depuis le dernier dessin
+  if (!pose.pose_valid || pose.model != this || pose.frameA != frameA ||
+      pose.frameB != frameB || pose.interp != interp || pose.scale != scale ||
+      pose.lod != lod || pose.light != light_pos)
+  {
+    update_pose(frameA, frameB, interp, lod, pose);
+    pose.shadow_valid = false;
+    pose.stream_frame = 0;
+    pose.serial++;
+  }
+
+  // Ombre: refaite si la pose, la lumière ou la technique ont changé
+  if (pose.light != light_pos)
+  {
+    pose.light = light_pos;
+    pose.shadow_valid = false;
+    pose.serial++;
+  }
+  // Niveau de détail des ombres projetées selon leur taille à l'écran,
+  // jamais plus fin que celui du personnage
+  int shadow_lod = lod;
+  if (shadow_mode == SHADOW_PROJECTED || shadow_mode == SHADOW_GPU_PROJECTED)
+    shadow_lod = std::max(select_shadow_lod(), lod);
+
+  if (!pose.shadow_valid || pose.shadow_mode != shadow_mode || pose.shadow_lod != shadow_lod)
+  {
+    pose.shadow.clear();
+    if (shadow_mode == SHADOW_PROJECTED)
+      build_projected_shadow(pose, shadow_lod, pose.shadow);
+    else if (shadow_mode == SHADOW_SILHOUETTE)
+      build_silhouette_fan(pose.vertices, pose.shadow);
+    pose.shadow_mode = shadow_mode;
+    pose.shadow_lod = shadow_lod;
+    pose.shadow_valid = true;
+    pose.stream_frame = 0;
+  }
+
+  stream_pose(pose);
+
+  if (anim_cache)
+    anim_cache->trim();
+}
+
+/***************************************************************************\
+ * Md2::Model::draw_shadow                                                 *
+ * Ombres planes; les autres techniques sont dessinées hors du modèle.     *
+\***************************************************************************/
+void Md2::Model::draw_shadow(const PoseCache &pose)
+{
+  gl_state.disable(GL_BLEND);
+  gl_state.set_depth_func(GL_LESS);
+  gl_state.client_state(GL_TEXTURE_COORD_ARRAY, false);
+  gl_state.client_state(GL_COLOR_ARRAY, false);
+  gl_state.disable(GL_TEXTURE_2D);
+
+  switch (pose.shadow_mode)
+  {
+    case SHADOW_PROJECTED:     draw_projected_shadow(pose); break;
+    case SHADOW_SILHOUETTE:    draw_silhouette_shadow(pose); break;
+    case SHADOW_GPU_PROJECTED: draw_gpu_projected_shadow(pose, pose.shadow_lod); break;
+    default:                   break; // volume ou carte d'ombre
+  }
+}
+
 /***************************************************************************\
- * Md2::Model::Model                                                       *
+ * Md2::Model::draw_character                                              *
 \***************************************************************************/
-Md2::Model::Model(const std::string &filename) : scale(1), tex(0)
+void Md2::Model::draw_character(const PoseCache &pose)
 {
-  // ouverture du fichier
-  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  int lod = pose.lod;
+
+  gl_state.disable(GL_BLEND);
+  gl_state.set_depth_func(GL_LESS);
+  gl_state.client_state(GL_TEXTURE_COORD_ARRAY, true);
+  gl_state.client_state(GL_COLOR_ARRAY, true);
+  gl_state.tex_env(GL_MODULATE);
+  gl_state.bind_texture(tex);
+  gl_state.enable(GL_TEXTURE_2D);
 
-  if (ifs.fail())
+  if (stream_buffer.ready() && !tex_coord_buffer)
+    upload_tex_coords();
+  if (tex_coord_buffer)
   {
-    std::cerr << "Ouverture du fichier " + filename + " impossible\n";
-    exit(-1);
+    gl_state.bind_buffer(tex_coord_buffer);
+    glTexCoordPointer(2, GL_FLOAT, 0, reinterpret_cast<const GLvoid *>(tex_coord_offsets[lod]));
+  }
+  else
+  {
+    gl_state.bind_buffer(0);
+    glTexCoordPointer(2, GL_FLOAT, 0, lod ? lod_tex_coords[lod - 1].data() : tex_coords.data());
   }
+  color_pointer(pose.colors_offset, pose.colors.data());
+  vertex_pointer(3, pose.positions_offset, pose.positions.data());
+  glDrawArrays(GL_TRIANGLES, 0, num_corners(lod));
+}
 
-  // Lecture de l'entête du fichier
-  ifs.read(reinterpret_cast<char *>(&header), sizeof(Header));
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::upload_tex_coords                                           *
+ * Coordonnées de texture de tous les niveaux, à la suite dans un buffer.  *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::upload_tex_coords()
+{
+  size_t total = tex_coords.size();
+  for (const std::vector<vec2> &level : lod_tex_coords)
+    total += level.size();
 
-  // Vérification de la validité du fichier
-  if (header.ident != IDENT || header.version != VERSION)
+  glGenBuffers(1, &tex_coord_buffer);
+  gl_state.bind_buffer(tex_coord_buffer);
+  glBufferData(GL_ARRAY_BUFFER, total * sizeof(vec2), nullptr, GL_STATIC_DRAW);
+  tex_coord_bytes = total * sizeof(vec2);
+  MemStats::account(MemStats::GPU_BUFFERS, tex_coord_bytes);
+
+  GLintptr offset = 0;
+  tex_coord_offsets.clear();
+  for (int lod = 0; lod < get_num_lods(); lod++)
   {
-    std::cerr << "Mauvais type de fichier\n";
-    exit(-1);
+    const std::vector<vec2> &level = lod ? lod_tex_coords[lod - 1] : tex_coords;
+    glBufferSubData(GL_ARRAY_BUFFER, offset, level.size() * sizeof(vec2), level.data());
+    tex_coord_offsets.push_back(offset);
+    offset += level.size() * sizeof(vec2);
   }
+}
 
-  // Allocation mémoire
-  skins.resize(header.num_skins);
-  texCoords.resize(header.num_st);
-  triangles.resize(header.num_tris);
-  frames.resize(header.num_frames);
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::stream_pose                                                 *
+ * Copie de la pose et de l'ombre dans le stream buffer, une fois par      *
+ * image: les positions y sont écrites directement depuis les sommets      *
+ * interpolés.  Sans place, les positions restent côté client.             *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::stream_pose(PoseCache &pose)
+{
+  if (!stream_buffer.ready() || pose.stream_frame == stream_buffer.get_frame())
+    return;
 
-  // Lecture des noms des skins
-  ifs.seekg(header.offset_skins, std::ios::beg);
-  ifs.read(reinterpret_cast<char *>(skins.data()), sizeof(Skin) *header.num_skins);
+  pose.positions_offset = pose.colors_offset = pose.shadow_offset = pose.vertices_offset = -1;
 
-  // Lecture des coordonnées de texture
-  ifs.seekg(header.offset_st, std::ios::beg);
-  ifs.read(reinterpret_cast<char *>(texCoords.data()), sizeof(TexCoord) * header.num_st);
+  size_t corners = num_corners(pose.lod);
+  void *dst = stream_buffer.map(corners * sizeof(vec3), pose.positions_offset);
+  if (dst)
+  {
+    gather_positions(pose.vertices, pose.lod, static_cast<vec3 *>(dst));
+    stream_buffer.unmap();
+  }
+  else
+  {
+    pose.positions_offset = -1;
+    pose.positions.resize(corners);
+    gather_positions(pose.vertices, pose.lod, pose.positions.data());
+  }
 
-  // Lecture de la connectivité
-  ifs.seekg(header.offset_tris, std::ios::beg);
-  ifs.read(reinterpret_cast<char *>(triangles.data()), sizeof(Triangle) * header.num_tris);
+  dst = stream_buffer.map(corners * 4, pose.colors_offset);
+  if (dst)
+  {
+    gather_colors(pose.shades, pose.lod, static_cast<unsigned char *>(dst));
+    stream_buffer.unmap();
+  }
+  else
+  {
+    pose.colors_offset = -1;
+    pose.colors.resize(corners * 4);
+    gather_colors(pose.shades, pose.lod, pose.colors.data());
+  }
 
-  // Lecture des positions pour chaque animation
-  ifs.seekg(header.offset_frames, std::ios::beg);
-  std::vector<CompressedVertex> compressed_verts;
-  for (int i = 0; i < header.num_frames; i++)
+  if (!pose.shadow.empty() &&
+      (dst = stream_buffer.map(pose.shadow.size() * sizeof(vec3), pose.shadow_offset)))
   {
-    ifs.read(reinterpret_cast<char *>(&frames[i].scale), sizeof(vec3));
-    ifs.read(reinterpret_cast<char *>(&frames[i].translate), sizeof(vec3));
-    ifs.read(reinterpret_cast<char *>(&frames[i].name), 16);
-    compressed_verts.resize(header.num_vertices);
-    ifs.read(reinterpret_cast<char *>(compressed_verts.data()), sizeof(CompressedVertex) * header.num_vertices);
-    for (int k = 0; k < header.num_vertices; k++)
-      frames[i].verts.push_back(vec3(compressed_verts[k].v[0],
-                                     compressed_verts[k].v[1],
-                                     compressed_verts[k].v[2]));
+    std::memcpy(dst, pose.shadow.data(), pose.shadow.size() * sizeof(vec3));
+    stream_buffer.unmap();
   }
+  else
+    pose.shadow_offset = -1;
 
-  ifs.close();
+  // Ombre projetée par GL à un niveau plus simple: sommets indexés
+  if (pose.shadow_mode == SHADOW_GPU_PROJECTED && pose.shadow_lod != pose.lod &&
+      (dst = stream_buffer.map(pose.vertices.size() * sizeof(vec3), pose.vertices_offset)))
+  {
+    std::memcpy(dst, pose.vertices.data(), pose.vertices.size() * sizeof(vec3));
+    stream_buffer.unmap();
+  }
+  else
+    pose.vertices_offset = -1;
 
-  // Mise en place des animations
-  setup_animations();
+  pose.stream_frame = stream_buffer.get_frame();
 }
 
-/***************************************************************************\
- * Md2::Model::load_texture                                                *
- * Charge une texture depuis un fichier et l'ajoute à la liste des skins   *
-\***************************************************************************/
-bool Md2::Model::load_texture(const std::string &filename)
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::update_pose                                                 *
+ * Interpolation des sommets et positions de chaque coin de triangle.      *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::update_pose(int frameA, int frameB, float interp, int lod, PoseCache &pose)
 {
-  GLuint tex = texture_manager.get_texture(filename);
+  Vec3Array &vertices = pose.vertices;
+  ByteArray &shades = pose.shades;
+  Vec3Array &positions = pose.positions;
 
-  skin_ids.insert(SkinMap::value_type(filename, tex));
+  // positions interpolées de chaque sommet du modèle, et leur éclairage
+  vertices.resize(header.num_vertices);
+  shades.resize(header.num_vertices);
 
-  return true;
+  // Mode paginé: les deux positions doivent être décodées
+  require_frame(frameA);
+  if (interp != 0)
+    require_frame(frameB);
+
+  const Frame *pFrameA = &frames[frameA];
+  const Frame *pFrameB = &frames[frameB];
+  KeyframeReader vertsA = keyframe(frameA);
+  KeyframeReader vertsB = keyframe(frameB);
+
+  // Éclairage par sommet: une lecture dans la table de la lumière, avec la
+  // normale de l'image clé la plus proche
+  const unsigned char *dots = anorms_dots(light_pos);
+  const Frame::Normals &normals = (interp < 0.5f ? pFrameA : pFrameB)->normals;
+
+  // Décompression par blocs de sommets, dans des tampons qui restent dans
+  // le cache; une seule boucle spécialisée par bloc
+  const int BLOCK = 256;
+  vec3 blockA[BLOCK], blockB[BLOCK];
+
+  for (int first = 0; first < header.num_vertices; first += BLOCK)
+  {
+    const int count = std::min(BLOCK, header.num_vertices - first);
+    vertsA.decode(first, count, blockA);
+
+    if (interp == 0)
+    {
+      // Image clé: pas d'interpolation
+      for (int i = 0; i < count; ++i)
+      {
+        vertices[first + i] = blockA[i] * scale;
+        shades[first + i] = dots[normals[first + i]];
+      }
+      continue;
+    }
+
+    // Interpolation de chaque sommet, une seule fois même s'il est partagé
+    // par plusieurs triangles
+    vertsB.decode(first, count, blockB);
+    for (int i = 0; i < count; ++i)
+    {
+      // Interpolation linéaire et mise à l'echelle
+      vertices[first + i] = (blockA[i] + interp * (blockB[i] - blockA[i])) * scale;
+      shades[first + i] = dots[normals[first + i]];
+    }
+  }
+
+  // Position et couleur de chaque sommet de chaque triangle, écrites
+  // directement dans le stream buffer s'il y en a un (stream_pose)
+  if (stream_buffer.ready())
+  {
+    positions.clear();
+    pose.colors.clear();
+  }
+  else
+  {
+    positions.resize(num_corners(lod));
+    gather_positions(vertices, lod, positions.data());
+    pose.colors.resize(num_corners(lod) * 4);
+    gather_colors(shades, lod, pose.colors.data());
+  }
+
+  pose.model = this;
+  pose.frameA = frameA;
+  pose.frameB = frameB;
+  pose.interp = interp;
+  pose.scale = scale;
+  pose.lod = lod;
+  pose.pose_valid = true;
 }
 
-/***************************************************************************\
- * Md2::Model::set_texture                                                 *
- * Choisitun texture comme skin courante                                   *
-\***************************************************************************/
-void Md2::Model::set_texture(const std::string &filename)
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::num_corners                                                 *
+\*-------------------------------------------------------------------------*/
+size_t Md2::Model::num_corners(int lod) const
 {
-  auto iter = skin_ids.find(filename);
+  return lod ? lods[lod - 1].size() : header.num_tris * 3;
+}
 
-  if (iter != skin_ids.end())
-    tex = iter->second;
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::gather_positions                                            *
+ * Position de chaque sommet de chaque triangle, au niveau de détail voulu.*
+\*-------------------------------------------------------------------------*/
+void Md2::Model::gather_positions(const Vec3Array &vertices, int lod,
+                                  vec3 *positions) const
+{
+  if (lod == 0)
+  {
+    for (int i = 0; i < header.num_tris; ++i)
+      for (int j = 0; j < 3; ++j)
+        positions[i * 3 + j] = vertices[triangles[i].vertex[j]];
+  }
   else
-    tex = 0;
+  {
+    const std::vector<unsigned> &indices = lods[lod - 1];
+    for (size_t i = 0; i < indices.size(); ++i)
+      positions[i] = vertices[indices[i]];
+  }
 }
 
-/***************************************************************************\
- * Md2::Model::setup_animations                                            *
- * Crée la liste des animations.                                           *
-\***************************************************************************/
-void Md2::Model::setup_animations()
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::gather_colors                                               *
+ * Couleur (gris, opaque) de chaque sommet de chaque triangle.             *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::gather_colors(const ByteArray &shades, int lod,
+                               unsigned char *colors) const
 {
-  std::string current_anim;
-  Anim anim_info = { 0, 0 };
+  const std::vector<unsigned> *indices = lod ? &lods[lod - 1] : nullptr;
+  size_t corners = num_corners(lod);
 
-  for (int i = 0; i < header.num_frames; i++)
+  for (size_t i = 0; i < corners; ++i)
   {
-    std::string frame_name = frames[i].name;
-    std::string frame_anim;
+    unsigned char shade = shades[indices ? (*indices)[i] : triangles[i / 3].vertex[i % 3]];
+    colors[i * 4] = colors[i * 4 + 1] = colors[i * 4 + 2] = shade;
+    colors[i * 4 + 3] = 255;
+  }
+}
 
-    // Extraction des noms d'animations à partir des noms des positions
-    std::string::size_type len = frame_name.find_first_of("0123456789");
-    if ((len == frame_name.length () - 3) &&
-        (frame_name[len] != '0'))
-      len++;
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::build_projected_shadow                                      *
+ * Ombre projetée triangle par triangle.                                   *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::build_projected_shadow(const PoseCache &pose, int lod,
+                                        Vec3Array &positions_ombres) const
+{
+  // Coins des triangles du niveau voulu, pris dans les sommets interpolés
+  // (les positions du personnage peuvent n'exister que dans le stream buffer)
+  const Vec3Array &vertices = pose.vertices;
+  const std::vector<unsigned> *indices = lod ? &lods[lod - 1] : nullptr;
+  size_t n_corners = num_corners(lod);
 
-    frame_anim.assign(frame_name, 0, len);
+  positions_ombres.resize(n_corners);
 
-    if (current_anim != frame_anim)
-    {
-      if (i > 0)
-        anims.insert(AnimMap::value_type(current_anim, anim_info));
-      // Passage à l'animation suivante
-      anim_info.start = i;
-      anim_info.end = i;
+  // Seuls les triangles tournés vers la lumière sont projetés: les autres
+  // recouvrent la même zone du plan et doubleraient le remplissage
+  size_t n_ombres = 0;
+  for (size_t i = 0; i < n_corners; i += 3)
+  {
+    const unsigned short *tri = triangles[i / 3].vertex;
+    const vec3 &a = vertices[indices ? (*indices)[i] : tri[0]];
+    const vec3 &b = vertices[indices ? (*indices)[i + 1] : tri[1]];
+    const vec3 &c = vertices[indices ? (*indices)[i + 2] : tri[2]];
 
-      current_anim = frame_anim;
+    if (light_facing(a, b, c, light_pos))
+    {
+      positions_ombres[n_ombres++] = a;
+      positions_ombres[n_ombres++] = b;
+      positions_ombres[n_ombres++] = c;
     }
-    else
-      anim_info.end = i;
   }
+  positions_ombres.resize(n_ombres);
 
-  // Ajout de la dernière animation
-  anims.insert(AnimMap::value_type(current_anim, anim_info));
+  // Projection centrale de ces positions sur le plan, en un seul appel
+  matrix M = shadow_matrix();
+  M.project_points(positions_ombres.data(), positions_ombres.data(), positions_ombres.size());
 }
 
-// Position de la lumière
-vec3 light_pos{ 0, -2, 10 };
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::draw_projected_shadow                                       *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::draw_projected_shadow(const PoseCache &pose)
+{
+  // Dessin de l'ombre si elle existe
+  if (!pose.shadow.empty())
+  {
+    glColor4f(0.2,0.2,0.2,1);
+    vertex_pointer(3, pose.shadow_offset, pose.shadow.data());
+    glDrawArrays(GL_TRIANGLES, 0, pose.shadow.size());
+  }
+}
 
-/***************************************************************************\
- * Md2::Model::draw_model                                                  *
-\***************************************************************************/
-void Md2::Model::draw_model(int frameA, int frameB, float interp)
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::draw_gpu_projected_shadow                                   *
+ * Ombre projetée par la pile de matrices: les positions du personnage,    *
+ * déjà calculées, sont redessinées à travers la matrice de projection     *
+ * sur le plan.  Aucun calcul ni envoi supplémentaire côté CPU; le stencil *
+ * n'autorise qu'une écriture par pixel (il est effacé à chaque image).    *
+ * Aux niveaux plus simples que le personnage, les sommets interpolés sont *
+ * indexés.                                                                *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::draw_gpu_projected_shadow(const PoseCache &pose, int lod)
 {
-  // vecteurs pour stocker les positions et les coordonnées de texture du personnage
-  std::vector<vec3> positions;
-  std::vector<vec2> tex_coords;
+  matrix M = shadow_matrix();
 
-  // vecteur pour stocker les positions de l'ombre.
-  std::vector<vec3> positions_ombres;
+  glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT | GL_STENCIL_BUFFER_BIT);
 
-  // *** matrice de projection permettant de calculer une ombre projetée pour la technique 
-  // *** de la projection centrale
-  // *** matrix proj;
+  // Les triangles projetés changent d'orientation selon leur face éclairée
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_STENCIL_TEST);
+  glStencilFunc(GL_EQUAL, 0, ~0u);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+  glColor4f(0.2,0.2,0.2,1);
 
-  // Calcul de chaque triangle
-  for (int i = 0; i < header.num_tris; ++i)
-  {
-    // Calcul pour chaque sommet de ce triangle
-    for (int j = 0; j < 3; ++j)
+  glPushMatrix();
+    glMultMatrixf(M.m);
+    if (lod == pose.lod)
+    {
+      vertex_pointer(3, pose.positions_offset, pose.positions.data());
+      glDrawArrays(GL_TRIANGLES, 0, num_corners(lod));
+    }
+    else
     {
-      Frame *pFrameA = &frames[frameA];
-      Frame *pFrameB = &frames[frameB];
+      const std::vector<unsigned> &indices = lods[lod - 1];
+      vertex_pointer(3, pose.vertices_offset, pose.vertices.data());
+      glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, indices.data());
+    }
+  glPopMatrix();
+
+  glPopAttrib();
+}
 
-      vec3 *pVertA = &pFrameA->verts[triangles[i].vertex[j]];
-      vec3 *pVertB = &pFrameB->verts[triangles[i].vertex[j]];
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::build_silhouette_fan                                        *
+ * Ombre construite à partir des seules arêtes de silhouette.  Chaque      *
+ * arête, orientée comme dans son triangle éclairé, forme un triangle avec *
+ * un point commun; la somme de ces éventails compte dans le stencil le    *
+ * nombre de triangles éclairés au-dessus de chaque pixel, et l'ombre est  *
+ * remplie là où ce nombre est non nul, sans recouvrement.                 *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::build_silhouette_fan(const Vec3Array &vertices,
+                                      Vec3Array &fan) const
+{
+  // Classification des triangles par rapport à la lumière
+  MemStats::vector<unsigned char, MemStats::SCRATCH> lit(header.num_tris);
+  classify_faces(vertices.data(), lit.data(), 0, header.num_tris);
 
-      // Décompression des positions
-      vec3 vecA = pFrameA->scale * *pVertA + pFrameA->translate;
-      vec3 vecB = pFrameB->scale * *pVertB + pFrameB->translate;
+  // Extraction des arêtes de silhouette
+  for (const Edge &e : edges)
+  {
+    bool lit0 = lit[e.tri[0]];
+    bool lit1 = e.tri[1] >= 0 && lit[e.tri[1]];
+    if (lit0 == lit1)
+      continue;
 
-      // Interpolation linéaire et mise à l'echelle
-      vec3 v = (vecA + interp * (vecB - vecA)) * scale;
-      positions.push_back(v); // Ajout d'une position dans le tableau
-      
-      // *** C'est ici qu'il faut ajouter le code pour calculer les positions de l'ombre
-
-//      vec3 v_ombre = v;
-//      v_ombre.z = -2.4;
-//      positions_ombres.push_back( v_ombre ); Q1, 2 et 3
-      //float z= -2.4;
-      vec4 P(0,0,1,2.41);
-      vec4 light(light_pos.x,light_pos.y,light_pos.z,0);
-      vec4 v0(P.dot(light) - light.x * P.x, -light.x * P.y, -light.x * P.z, -P.w * light.x );
-      vec4 v1(-light.y * P.x, P.dot(light) - light.y * P.y, -light.y * P.z, -P.w * light.y );
-      vec4 v2(-light.z * P.x, -light.z * P.x, P.dot(light) - light.z * P.z, -P.w * light.z );
-      vec4 v3(-light.w * P.x, -light.w * P.y, -light.w * P.y, P.dot(light) - P.w * light.w );
-
-      matrix M(v0,v1,v2,v3);
-      positions_ombres.push_back(M*v);
-
-      //
-      TexCoord *pTexCoords = &texCoords[triangles[i].st[j]];
-      // Calcul des coordonnées de textures
-      float s = static_cast<float>(pTexCoords->s) / header.skinwidth;
-      float t = static_cast<float>(pTexCoords->t) / header.skinheight;
-      tex_coords.push_back(vec2(s, 1 - t));
-    }
+    const vec3 &a = vertices[e.v[lit0 ? 0 : 1]];
+    const vec3 &b = vertices[e.v[lit0 ? 1 : 0]];
+    fan.push_back(fan.empty() ? a : fan[0]);
+    fan.push_back(a);
+    fan.push_back(b);
   }
-  glDisable(GL_BLEND);
-  glDepthFunc(GL_LESS);
 
-  // Dessin de l'ombre si elle existe
-  if (!positions_ombres.empty())
+  matrix M = shadow_matrix();
+  M.project_points(fan.data(), fan.data(), fan.size());
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Model::draw_silhouette_shadow                                      *
+\*-------------------------------------------------------------------------*/
+void Md2::Model::draw_silhouette_shadow(const PoseCache &pose)
+{
+  const Vec3Array &fan = pose.shadow;
+
+  if (fan.empty())
+    return;
+
+  vertex_pointer(3, pose.shadow_offset, fan.data());
+
+  glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+               GL_STENCIL_BUFFER_BIT | GL_POLYGON_BIT);
+
+  // Comptage: +1 pour les éventails d'une orientation, -1 pour l'autre
+  glEnable(GL_STENCIL_TEST);
+  glStencilFunc(GL_ALWAYS, 0, ~0u);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_FALSE);
+  glEnable(GL_CULL_FACE);
+
+  glCullFace(GL_BACK);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+  glDrawArrays(GL_TRIANGLES, 0, fan.size());
+
+  glCullFace(GL_FRONT);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+  glDrawArrays(GL_TRIANGLES, 0, fan.size());
+
+  // Remplissage, en remettant le stencil à zéro pour l'objet suivant
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthMask(GL_TRUE);
+  glDisable(GL_CULL_FACE);
+  glStencilFunc(GL_NOTEQUAL, 0, ~0u);
+  glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+  glColor4f(0.2,0.2,0.2,1);
+  glDrawArrays(GL_TRIANGLES, 0, fan.size());
+
+  glPopAttrib();
+}
+
+/***************************************************************************\
+ * Md2::Model::classify_faces                                              *
+\***************************************************************************/
+void Md2::Model::classify_faces(const vec3 *vertices, unsigned char *lit,
+                                int begin, int end) const
+{
+  for (int i = begin; i < end; ++i)
+    lit[i] = light_facing(vertices[triangles[i].vertex[0]],
+                          vertices[triangles[i].vertex[1]],
+                          vertices[triangles[i].vertex[2]], light_pos);
+}
+
+/***************************************************************************\
+ * Md2::Model::extrude_silhouette                                          *
+ * Chaque arête de silhouette a -> b (orientée comme dans son triangle     *
+ * éclairé) donne une face latérale (b, a, infini).  La lumière étant      *
+ * directionnelle, les sommets extrudés se confondent en un point à        *
+ * l'infini (w = 0) et le volume n'a pas de couvercle arrière.             *
+\***************************************************************************/
+void Md2::Model::extrude_silhouette(const vec3 *vertices, const unsigned char *lit,
+                                    int begin, int end, Vec4Array &volume) const
+{
+  const vec4 infinity(-light_pos.x, -light_pos.y, -light_pos.z, 0);
+
+  for (int i = begin; i < end; ++i)
   {
-    glColor4f(0.2,0.2,0.2,1);
-    glDisable(GL_TEXTURE_2D);
-    glVertexPointer(3, GL_FLOAT, 0, positions_ombres.data());
-    glDrawArrays(GL_TRIANGLES, 0, positions_ombres.size());
+    // Un bord de maillage ouvert ferme le volume seulement si son
+    // triangle est à l'ombre (il borde alors le couvercle)
+    const Edge &e = edges[i];
+    bool lit0 = lit[e.tri[0]];
+    bool lit1 = e.tri[1] < 0 || lit[e.tri[1]];
+    if (lit0 == lit1)
+      continue;
+
+    const vec3 &a = vertices[e.v[lit0 ? 0 : 1]];
+    const vec3 &b = vertices[e.v[lit0 ? 1 : 0]];
+    volume.push_back(vec4(b.x, b.y, b.z, 1));
+    volume.push_back(vec4(a.x, a.y, a.z, 1));
+    volume.push_back(infinity);
   }
+}
 
-  // Dessin du personnage
-  glColor4f(1,1,1,1);
-  glTexCoordPointer(2, GL_FLOAT, 0, tex_coords.data());
-  glTexEnvi(GL_TEXTURE_2D, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-  glVertexPointer(3, GL_FLOAT, 0, positions.data());
-  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-  glBindTexture(GL_TEXTURE_2D, tex);
-  glEnable(GL_TEXTURE_2D);
-  glDrawArrays(GL_TRIANGLES, 0, positions.size());
-  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+/***************************************************************************\
+ * Md2::Model::add_volume_caps                                             *
+ * Le couvercle avant est formé des triangles à l'ombre, retournés pour    *
+ * faire face à la lumière: il ne coïncide pas avec les faces éclairées.   *
+\***************************************************************************/
+void Md2::Model::add_volume_caps(const vec3 *vertices, const unsigned char *lit,
+                                 int begin, int end, Vec4Array &volume) const
+{
+  for (int i = begin; i < end; ++i)
+  {
+    if (lit[i])
+      continue;
+
+    for (int j = 2; j >= 0; --j)
+    {
+      const vec3 &v = vertices[triangles[i].vertex[j]];
+      volume.push_back(vec4(v.x, v.y, v.z, 1));
+    }
+  }
 }
 
 /***************************************************************************\
  * Md2::Object::Object                                                     *
 \***************************************************************************/
 Md2::Object::Object () : model(nullptr), current_frame(0), next_frame(0),
-    interp(0.0f), percent(0.0f), scale(1)
+    interp(0.0f), percent(0.0f), scale(1), lod(0), shadow_volume_serial(0)
 {
 }
 
@@ -245,25 +1664,147 @@ Md2::Object::Object () : model(nullptr), current_frame(0), next_frame(0),
 \***************************************************************************/
 void Md2::Object::draw_object_itp(bool animated)
 {
-  glPushMatrix ();
-    glRotatef(-90, 1, 0, 0);
-    glRotatef(-90, 0, 0, 1);
+  prepare(animated);
+  draw(PASS_SHADOW);
+  draw(PASS_OPAQUE);
+  gl_state.client_state(GL_TEXTURE_COORD_ARRAY, false);
+  gl_state.client_state(GL_COLOR_ARRAY, false);
+}
 
+/***************************************************************************\
+ * Md2::Object::prepare                                                    *
+\***************************************************************************/
+void Md2::Object::prepare(bool animated)
+{
+  push_transform();
     model->set_scale(scale);
 
-    glPushAttrib (GL_POLYGON_BIT);
-    glFrontFace (GL_CW);
+    // Niveau de détail selon la taille à l'écran; les personnages lointains
+    // n'interpolent que par pas, voire restent sur les images clés, et leur
+    // pose n'est refaite qu'à chaque pas
+    float t = interp;
+    if (mesh_lod)
+    {
+      select_lod(model->get_screen_radius());
+      int steps = ANIM_LOD_STEPS[lod];
+      if (steps)
+        t = std::floor(interp * steps) / steps;
+    }
+    else
+      lod = 0;
+
+    // Pose du personnage et de son ombre
+    model->prepare(current_frame, next_frame, t, pose, lod);
+  glPopMatrix ();
+
+  if (animated)
+    interp += percent;
+}
 
-    // Dessin du personnage et de son ombre
-    model->draw_model(current_frame, next_frame, interp);
+/***************************************************************************\
+ * Md2::Object::draw                                                       *
+ * Dessine la pose préparée: l'ombre plane ou le personnage.               *
+\***************************************************************************/
+void Md2::Object::draw(RenderPass pass) const
+{
+  push_transform();
+    gl_state.set_front_face(GL_CW);
 
-    glPopAttrib ();
+    if (pass == PASS_SHADOW)
+      model->draw_shadow(pose);
+    else
+      model->draw_character(pose);
   glPopMatrix ();
+}
 
+/***************************************************************************\
+ * Md2::Object::skip_frame                                                 *
+ * Personnage caché: l'animation avance sans interpolation ni dessin.      *
+\***************************************************************************/
+void Md2::Object::skip_frame(bool animated)
+{
   if (animated)
     interp += percent;
 }
 
+/*-------------------------------------------------------------------------*\
+ * Md2::Object::select_lod                                                 *
+ * Le niveau l commence sous MESH_LOD_PIXELS / 2^(l-1) pixels; un niveau   *
+ * n'est quitté qu'une fois ce seuil dépassé de LOD_HYSTERESIS, pour ne    *
+ * pas osciller.  Un rayon négatif (passe de profondeur en projection      *
+ * orthogonale) garde le niveau courant.                                   *
+\*-------------------------------------------------------------------------*/
+void Md2::Object::select_lod(float pixels)
+{
+  if (pixels < 0)
+    return;
+
+  int levels = model->get_num_lods() - 1;
+  lod = std::min(lod, levels);
+
+  while (lod < levels && pixels < MESH_LOD_PIXELS / (1 << lod) * (1 - LOD_HYSTERESIS))
+    lod++;
+  while (lod > 0 && pixels > MESH_LOD_PIXELS / (1 << (lod - 1)) * (1 + LOD_HYSTERESIS))
+    lod--;
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Object::push_transform                                             *
+ * Repère de l'objet; à refermer par glPopMatrix.  Les triangles MD2 sont  *
+ * dans le sens horaire: à l'appelant de régler glFrontFace.               *
+\*-------------------------------------------------------------------------*/
+void Md2::Object::push_transform() const
+{
+  glPushMatrix ();
+    glRotatef(-90, 1, 0, 0);
+    glRotatef(-90, 0, 0, 1);
+}
+
+/***************************************************************************\
+ * Md2::Object::draw_shadow_volume                                         *
+ * Dessine le volume d'ombre construit pour la dernière image.             *
+\***************************************************************************/
+void Md2::Object::draw_shadow_volume() const
+{
+  push_transform();
+    // Appelé sous le glPushAttrib de render_shadow_volumes: hors du cache
+    glFrontFace(GL_CW);
+
+    for (const Vec4Array &chunk : shadow_volume)
+    {
+      if (chunk.empty())
+        continue;
+      gl_state.bind_buffer(0);
+      glVertexPointer(4, GL_FLOAT, 0, chunk.data());
+      glDrawArrays(GL_TRIANGLES, 0, chunk.size());
+    }
+  glPopMatrix ();
+}
+
+/***************************************************************************\
+ * Md2::Object::draw_bounds                                                *
+ * Boîte englobant la position courante et la suivante, puis la même boîte *
+ * aplatie sur le plan de l'ombre: un personnage caché dont l'ombre se     *
+ * voit reste visible.                                                     *
+\***************************************************************************/
+void Md2::Object::draw_bounds() const
+{
+  vec3 lo, hi, lo_next, hi_next;
+  model->get_frame_bounds(current_frame, lo, hi);
+  model->get_frame_bounds(next_frame, lo_next, hi_next);
+
+  lo = vec3(std::min(lo.x, lo_next.x), std::min(lo.y, lo_next.y), std::min(lo.z, lo_next.z)) * scale;
+  hi = vec3(std::max(hi.x, hi_next.x), std::max(hi.y, hi_next.y), std::max(hi.z, hi_next.z)) * scale;
+
+  matrix M = shadow_matrix();
+
+  push_transform();
+    draw_box(lo, hi);
+    glMultMatrixf(M.m);
+    draw_box(lo, hi);
+  glPopMatrix ();
+}
+
 /***************************************************************************\
  * Md2::Object::animate                                                    *
  * Animation du personnage. Calcule la position courante, la suivante et   *
@@ -271,6 +1812,7 @@ void Md2::Object::draw_object_itp(bool animated)
 \***************************************************************************/
 void Md2::Object::animate(int start_frame, int end_frame, float p)
 {
+  Trace::Scope trace("Object::animate");
   if (current_frame < start_frame)
     current_frame = start_frame;
 
@@ -329,5 +1871,65 @@ void Md2::Object::set_anim(const std::string &name)
   {
     anim_info = &itor->second;
     current_anim = name;
+
+    // Décodage de l'animation dès sa sélection en mode paginé
+    model->page_in(*anim_info);
+  }
+}
+
+/***************************************************************************\
+ * Md2::AnimCache::touch                                                   *
+ * Marque une animation décodée comme la plus récemment utilisée.          *
+\***************************************************************************/
+void Md2::AnimCache::touch(Model *model, const Anim &anim, size_t bytes)
+{
+  Key key(model, anim.start);
+  auto it = entries.find(key);
+
+  if (it != entries.end())
+  {
+    lru.splice(lru.begin(), lru, it->second);
+    return;
+  }
+
+  Entry entry = { model, anim, bytes };
+  lru.push_front(entry);
+  entries[key] = lru.begin();
+  resident += bytes;
+}
+
+/***************************************************************************\
+ * Md2::AnimCache::trim                                                    *
+ * Libère les animations les moins récemment utilisées jusqu'à repasser    *
+ * sous le budget.                                                         *
+\***************************************************************************/
+void Md2::AnimCache::trim()
+{
+  while (resident > budget && lru.size() > 1)
+  {
+    Entry &entry = lru.back();
+    entry.model->page_out(entry.anim);
+    resident -= entry.bytes;
+    entries.erase(Key(entry.model, entry.anim.start));
+    lru.pop_back();
+  }
+}
+
+/***************************************************************************\
+ * Md2::AnimCache::forget                                                  *
+ * Oublie les animations d'un modèle détruit.                              *
+\***************************************************************************/
+void Md2::AnimCache::forget(const Model *model)
+{
+  for (auto it = lru.begin(); it != lru.end(); )
+  {
+    if (it->model == model)
+    {
+      resident -= it->bytes;
+      entries.erase(Key(it->model, it->anim.start));
+      it = lru.erase(it);
+    }
+    else
+      ++it;
   }
 }
@@ -3,12 +3,18 @@
 #ifndef MD2MODEL_H
 #define MD2MODEL_H
 
+#include <list>
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "mem_stats.h"
 #include "texture.h"
+#include "vec2.h"
 #include "vec3.h"
+#include "vec4.h"
+#include "vfs.h"
 
 namespace Md2
 {
@@ -71,9 +77,50 @@ namespace Md2
     vec3 scale;        // Scale factors
     vec3 translate;    // Translation vector
     char name[16];     // Frame name
-    std::vector<vec3> verts;
+
+    typedef MemStats::vector<vec3, MemStats::KEYFRAMES> Vertices;
+    typedef MemStats::vector<unsigned char, MemStats::KEYFRAMES> Normals;
+    Vertices verts;
+    Normals normals;  // index in anorms of each vertex
   };
 
+  // Geometry rebuilt as the characters move
+  typedef MemStats::vector<vec3, MemStats::SCRATCH> Vec3Array;
+  typedef MemStats::vector<vec4, MemStats::SCRATCH> Vec4Array;
+  typedef MemStats::vector<unsigned char, MemStats::SCRATCH> ByteArray;
+
+  // Edge adjacency, built once at load time.  tri[0] uses the edge as
+  // v[0] -> v[1], tri[1] (or -1 on a boundary) as v[1] -> v[0].
+  struct Edge
+  {
+    unsigned short v[2];
+    int tri[2];
+  };
+
+  // Shadow techniques
+  enum ShadowMode
+  {
+    SHADOW_PROJECTED,     // light-facing triangles projected on the plane
+    SHADOW_SILHOUETTE,    // silhouette edges projected, filled with stencil
+    SHADOW_VOLUME,        // z-fail stencil shadow volumes, any receiver
+    SHADOW_MAP,           // depth texture rendered from the light
+    SHADOW_GPU_PROJECTED, // mesh redrawn through the projection matrix
+    SHADOW_MODE_COUNT
+  };
+
+  extern ShadowMode shadow_mode;
+
+  // Passes of a frame, in drawing order
+  enum RenderPass
+  {
+    PASS_SHADOW,  // planar shadows
+    PASS_OPAQUE,  // textured characters
+    PASS_COUNT
+  };
+
+  // Distance based level of detail of the characters (mesh and animation)
+  extern bool mesh_lod;
+
   // Animation infos
   struct Anim
   {
@@ -81,6 +128,83 @@ namespace Md2
     int end;    // last frame index
   };
 
+  class Model;
+
+  // Skinned geometry of an object and the shadow built from it.  Kept
+  // between draws and rebuilt only when the pose, the scale or the light
+  // changes, so that camera motion costs nothing but GL submission.
+  struct PoseCache
+  {
+    // Inputs of the cached geometry
+    const Model *model;
+    int frameA, frameB;
+    float interp, scale;
+    int lod;                    // mesh level of 'positions'
+    vec3 light;
+    ShadowMode shadow_mode;     // mode 'shadow' was built for
+    int shadow_lod;             // caster level 'shadow' was built from
+
+    bool pose_valid;            // vertices and positions
+    bool shadow_valid;          // shadow
+    unsigned serial;            // bumped whenever the pose or the light change
+
+    Vec3Array vertices;   // interpolated model vertices
+    ByteArray shades;     // light of each vertex (anorms_dots)
+    Vec3Array positions;  // one per triangle corner, without stream buffer
+    ByteArray colors;     // RGBA of each corner, without stream buffer
+    Vec3Array shadow;     // projected shadow triangles
+
+    // Copies in the stream buffer for its frame 'stream_frame' (0: none),
+    // offsets -1 when not there
+    unsigned long stream_frame;
+    GLintptr positions_offset;
+    GLintptr colors_offset;
+    GLintptr shadow_offset;
+    GLintptr vertices_offset;
+
+    PoseCache() : model(nullptr), frameA(-1), frameB(-1), interp(0), scale(0), lod(0),
+      shadow_mode(SHADOW_MODE_COUNT), shadow_lod(0), pose_valid(false), shadow_valid(false), serial(0),
+      stream_frame(0), positions_offset(-1), colors_offset(-1), shadow_offset(-1), vertices_offset(-1) {}
+  };
+
+  /////////////////////////////////////////////////////////////////////////////
+  //
+  // class AnimCache -- LRU cache of decoded animations.
+  //
+  // Shared by the models loaded in paged mode.  Animations are decoded on
+  // first use and the least recently used ones are dropped once the decoded
+  // bytes exceed the budget.  The most recently used animation is never
+  // dropped, so a single animation larger than the budget still plays.
+  // Not thread safe: use it from the rendering thread only.
+  //
+  /////////////////////////////////////////////////////////////////////////////
+
+  class AnimCache
+  {
+    struct Entry
+    {
+      Model *model;
+      Anim anim;
+      size_t bytes;
+    };
+    typedef std::list<Entry> EntryList;
+    typedef std::pair<const Model *, int> Key;
+
+    EntryList lru;  // most recently used first
+    std::map<Key, EntryList::iterator> entries;
+    size_t budget;
+    size_t resident;
+  public:
+    AnimCache(size_t budget) : budget(budget), resident(0) {}
+
+    void touch(Model *model, const Anim &anim, size_t bytes);
+    void trim();
+    void forget(const Model *model);
+
+    size_t get_budget() const { return budget; }
+    size_t get_resident() const { return resident; }
+  };
+
   /////////////////////////////////////////////////////////////////////////////
   //
   // class Md2Model -- MD2 Model Data Class.
@@ -99,31 +223,180 @@ namespace Md2
     std::vector<TexCoord> texCoords;
     std::vector<Triangle> triangles;
     std::vector<Frame>    frames;
+    std::vector<Edge>     edges;
+    std::vector<vec2>     tex_coords;  // one per triangle corner
+
+    // Simplified meshes (vertex indices, coarser and coarser), built on
+    // the first frame and used for all of them, and their texture
+    // coordinates.  Drawn for distant characters and used as shadow casters.
+    std::vector<std::vector<unsigned> > lods;
+    std::vector<std::vector<vec2> > lod_tex_coords;
+    float radius;  // bounding radius of the first frame
+
+    // Texture coordinates of every level in a vertex buffer, uploaded on
+    // first use along with the stream buffer
+    GLuint tex_coord_buffer;
+    std::vector<GLintptr> tex_coord_offsets;
+    size_t tex_coord_bytes;
+
+    // Bytes of the above and of the topology, accounted as MemStats::GEOMETRY
+    size_t geometry_bytes;
+    size_t count_geometry() const;
 
     GLfloat  scale;
     GLuint tex;
     TextureManager texture_manager;
+
+    // Paged mode: only the frame directory is resident, vertices are
+    // decoded from 'source' when their animation is first needed.
+    FileSpan source;
+    AnimCache *anim_cache;
+
+    // Compressed mode (compress()): the vertices of each animation are
+    // bit packed on a grid, each axis on the fewest bits its range needs:
+    // record of vertex k in frame f = reference[k] + delta[f][k] (the
+    // references may have 0 bits), position = origin + step * record.
+    // The native MD2 bytes are the case of the frame's own scale and
+    // translate with 8 bits deltas, kept when nothing smaller fits or when
+    // the float rounding of a grid would exceed the bound.
+    struct PackedAnim
+    {
+      int start;                  // first frame
+      bool native;                // grid of each frame: its scale, translate
+      vec3 origin, step;          // grid of the animation otherwise
+      int ref_bits[3];            // widths of the fields on each axis
+      int delta_bits[3];
+      size_t frame_bytes;         // bytes of the deltas of one frame
+      MemStats::vector<unsigned char, MemStats::KEYFRAMES> references;
+      MemStats::vector<unsigned char, MemStats::KEYFRAMES> deltas;
+    };
+    std::vector<PackedAnim> packed_anims;
+    std::vector<int> frame_packs;  // index in packed_anims of each frame
+    float keyframe_error;          // largest error measured on an axis
+
+    // Unscaled positions of a frame, resident or packed.  decode() writes
+    // a run of vertices with a loop specialised for the encoding, chosen
+    // once per run: whole bytes for the MD2 ones, fixed shifts and masks
+    // when a record fits in one 64-bit read, field by field otherwise.
+    struct KeyframeReader
+    {
+      enum Coding { RESIDENT, BYTES, PACKED, REFERENCED, WIDE };
+
+      Coding coding;
+      const vec3 *verts;                // resident frame, or
+      const unsigned char *references;  // packed one
+      const unsigned char *deltas;
+      int ref_bits[3], delta_bits[3];
+      int ref_size, delta_size;         // bits of a record
+      vec3 scale, translate;            // step and origin when packed
+
+      void decode(int first, int count, vec3 *out) const;
+      template <bool REFERENCED> void decode_packed(int first, int count, vec3 *out) const;
+    };
+    KeyframeReader keyframe(const PackedAnim &pack, int frame) const;
+    KeyframeReader keyframe(int frame) const;
+
     void setup_animations();
+    void build_adjacency();
+    void build_tex_coords();
+    void build_lods();
+    int select_shadow_lod() const;
+    void decode_frame(int frame);
+    void require_frame(int frame);
   public:
     typedef std::map<std::string, GLuint> SkinMap;
     typedef std::map<std::string, Anim> AnimMap;
   private:
-    SkinMap skin_ids;
+    SkinMap skin_ids;  // 0 for the skins not loaded yet
+    std::map<std::string, FileSpan> skin_files;  // skins to load on first use
     AnimMap anims;
   public:
-    Model(const std::string &filename);
+    // With an AnimCache the model is paged: 'data' must then stay mapped
+    // for the lifetime of the model.
+    Model(const std::string &name, const FileSpan &data, AnimCache *cache = nullptr);
+    ~Model();
+    // Why 'data' can't be loaded, empty if it can.  The constructor exits
+    // on such files: check them first off the main thread.
+    static std::string check(const std::string &name, const FileSpan &data);
+    Model(const Model &) = delete;
+    Model &operator=(const Model &) = delete;
+
+    // Make sure the frames of 'anim' are decoded
+    void page_in(const Anim &anim);
+    void page_out(const Anim &anim);
 
-    bool load_texture(const std::string &filename);
+    bool load_texture(const std::string &filename, const FileSpan &data);
+    void add_texture(const std::string &filename, const Image &image);
+    // Register a skin, decoded and uploaded when set_texture first selects
+    // it: 'data' must stay mapped until then
+    void add_skin(const std::string &filename, const FileSpan &data);
+    // Current skin, loading it if needed (uploads go through gl_state)
     void set_texture(const std::string &filename);
 
     void render_frame(int frame);
-    void draw_model(int frameA, int frameB, float interp);
+    // 'pose' receives the interpolated model vertices, and is reused as is
+    // when the frames, the scale and the light are those it was built for.
+    // 'lod' selects a simplified mesh (0: full detail).
+    void draw_model(int frameA, int frameB, float interp, PoseCache &pose, int lod = 0);
+    // draw_model in steps, for the render queue: update 'pose', then draw
+    // its planar shadow and the character in the current object frame
+    void prepare(int frameA, int frameB, float interp, PoseCache &pose, int lod = 0);
+    void draw_shadow(const PoseCache &pose);
+    void draw_character(const PoseCache &pose);
+    // Radius in pixels of the model with the current GL matrices, negative
+    // when it can't be told (not a perspective projection, behind the eye)
+    float get_screen_radius() const;
+    // Unscaled positions and anorms indices of the vertices of a frame,
+    // resident or not
+    void read_frame(int frame, vec3 *positions, unsigned char *normals) const;
+
+    // Replace the resident keyframes by bit packed ones, decoded on the
+    // fly by the interpolation, within 'max_error' (model units, on each
+    // axis) of the original positions, and no larger than the MD2
+    // vertices but for a few bytes of padding.  False for a paged model.
+    bool compress(float max_error);
+    bool is_compressed() const { return !packed_anims.empty(); }
+    float get_keyframe_error() const { return keyframe_error; }
+  private:
+    void update_pose(int frameA, int frameB, float interp, int lod, PoseCache &pose);
+    size_t num_corners(int lod) const;
+    void gather_positions(const Vec3Array &vertices, int lod, vec3 *positions) const;
+    void gather_colors(const ByteArray &shades, int lod, unsigned char *colors) const;
+    void stream_pose(PoseCache &pose);
+    void upload_tex_coords();
+    void build_projected_shadow(const PoseCache &pose, int lod, Vec3Array &shadow) const;
+    void build_silhouette_fan(const Vec3Array &vertices, Vec3Array &fan) const;
+    void draw_projected_shadow(const PoseCache &pose);
+    void draw_gpu_projected_shadow(const PoseCache &pose, int lod);
+    void draw_silhouette_shadow(const PoseCache &pose);
+  public:
+
+    // Shadow volume construction, split in ranges so that it can run on
+    // several threads: classify triangles [begin, end) against the light,
+    // then extrude the silhouette of edges [begin, end) and add the caps
+    // of triangles [begin, end) to 'volume' (homogeneous positions).
+    void classify_faces(const vec3 *vertices, unsigned char *lit,
+                        int begin, int end) const;
+    void extrude_silhouette(const vec3 *vertices, const unsigned char *lit,
+                            int begin, int end, Vec4Array &volume) const;
+    void add_volume_caps(const vec3 *vertices, const unsigned char *lit,
+                         int begin, int end, Vec4Array &volume) const;
 
     void set_scale(GLfloat s) { scale = s; }
 
     // Accessors
     const SkinMap &get_skins() const { return skin_ids; }
     const AnimMap &get_anims() const { return anims; }
+    int get_num_tris() const { return header.num_tris; }
+    int get_num_vertices() const { return header.num_vertices; }
+    int get_num_frames() const { return header.num_frames; }
+    const std::vector<Triangle> &get_triangles() const { return triangles; }
+    const std::vector<vec2> &get_tex_coords() const { return tex_coords; }
+    GLuint get_texture() const { return tex; }
+    int get_num_edges() const { return edges.size(); }
+    int get_num_lods() const { return lods.size() + 1; }
+    // Bounds of a frame, before scaling (resident even when paged out)
+    void get_frame_bounds(int frame, vec3 &lo, vec3 &hi) const;
   };
 
   class Object
@@ -137,14 +410,36 @@ namespace Md2
     float percent;
     float scale;
 
+    // Level of detail, kept between draws for the hysteresis
+    int lod;
+    void select_lod(float pixels);
+
     // Animation data
     const Anim *anim_info;
     std::string current_anim;
     void animate(int start_frame, int end_frame, float percent);
+
+    void push_transform() const;
   public:
+    // Geometry of the last drawn frame, and the shadow volume built from
+    // its vertices (one vertex array per worker chunk) for pose.serial
+    PoseCache pose;
+    MemStats::vector<unsigned char, MemStats::SCRATCH> lit;
+    std::vector<Vec4Array> shadow_volume;
+    unsigned shadow_volume_serial;
+
     Object();
 
     void draw_object_itp(bool animated);
+    // draw_object_itp in steps: skin for this frame (and advance the
+    // animation), then draw one pass
+    void prepare(bool animated);
+    void draw(RenderPass pass) const;
+    // Advance the animation as draw_object_itp would, without drawing
+    void skip_frame(bool animated);
+    void draw_shadow_volume() const;
+    // Box around the current and next frames, and its shadow on the plane
+    void draw_bounds() const;
     void animate(float percent);
 
     void set_model(Model *model);
@@ -153,6 +448,8 @@ namespace Md2
 
     // Accessors
     const std::string &get_current_anim() const { return current_anim; }
+    const Model *get_model() const { return model; }
+    int get_lod() const { return lod; }
   };
 }
 
@@ -1,83 +1,101 @@
 // md2_player.cpp
 
-#include <fstream>
 #include <iostream>
 
-#include <dirent.h>
-#include <sys/types.h>
-
 #include <GL/gl.h>
 
 #include "md2_player.h"
 #include "texture.h"
+#include "trace.h"
 
 /***************************************************************************\
  * Md2::Player::Player                                                     *
+ * Load a player from a directory of the virtual file system: tris.md2    *
+ * plus its .pcx skins.                                                    *
 \***************************************************************************/
-Md2::Player::Player(const std::string &dirname) throw (std::runtime_error)
+Md2::Player::Player(const Vfs &vfs, const std::string &dirname,
+                    AnimCache *anim_cache) throw (std::runtime_error)
 : player_mesh(nullptr)
 {
-  std::ifstream ifs;
+  Trace::Scope trace("Player::Player");
   std::string path;
-  dirent *dit;
-  DIR *dd;
-
-  // Open the directory
-  dd = opendir (dirname.c_str());
-  if (!dd)
-    throw std::runtime_error("Couldn't open dir");
 
   // Test if player mesh exists
-  path = dirname + "/tris.md2";
-  ifs.open(path.c_str(), std::ios::binary);
+  path = Vfs::join(dirname, "tris.md2");
+  FileSpan mesh = vfs.open(path);
 
-  if (!ifs.fail())
-  {
-    ifs.close();
-    player_mesh = ModelPtr(new Model(path));
-  }
+  if (!mesh.empty())
+    player_mesh = ModelPtr(new Model(path, mesh, anim_cache));
 
   // If we haven't found any model, this is not a success...
   if (!player_mesh.get()) // FIXME: redondant!
     throw std::runtime_error("No model found");
 
-  name.assign(dirname, dirname.find_last_of('/') + 1, dirname.length());
-
-  // Read directory for textures
-  while ((dit = readdir(dd)) != nullptr)
+  // Read directory for textures, loaded when first selected
+  for (const std::string &filename : vfs.list(dirname))
   {
-    const std::string filename(dit->d_name);
-    path = dirname + "/" + filename;
-
-    const char *str = filename.c_str();
-    std::string::size_type l = filename.find_last_of('.');
-
-    // Skip directories
-    if (l > filename.length())
-      continue;
-
-    // Skip files beginning with "<char>_" and files
-    // ending with "_i.<char*>"
-    if ((str[1] != '_') &&
-        !((str[l-1] == 'i') && (str[l-2] == '_')))
+    if (is_skin(filename))
     {
-      if (filename.compare (l, 4, ".pcx") == 0)
-        player_mesh->load_texture(path);
+      path = Vfs::join(dirname, filename);
+      player_mesh->add_skin(path, vfs.open(path));
     }
   }
 
-  // Close directory
-  closedir(dd);
+  attach(dirname);
+}
 
-  // Attach models to MD2 objects
-  if (player_mesh.get())
-  {
-    player_object.set_model(player_mesh.get());
+/***************************************************************************\
+ * Md2::Player::Player                                                     *
+ * Build a player from a mesh loaded and given its skins elsewhere.        *
+\***************************************************************************/
+Md2::Player::Player(const std::string &dirname, std::unique_ptr<Model> mesh)
+  throw (std::runtime_error)
+: player_mesh(std::move(mesh))
+{
+  if (!player_mesh.get())
+    throw std::runtime_error("No model found");
 
-    // Set first skin as default skin
-    current_skin = player_mesh->get_skins().begin()->first;
-    current_anim = player_object.get_current_anim();
-  }
+  attach(dirname);
+}
+
+/***************************************************************************\
+ * Md2::Player::is_skin                                                    *
+ * Tell whether a file of a player directory is one of its skins.          *
+\***************************************************************************/
+bool Md2::Player::is_skin(const std::string &filename)
+{
+  const char *str = filename.c_str();
+  std::string::size_type l = filename.find_last_of('.');
+
+  // Skip files without extension
+  if (l > filename.length())
+    return false;
+
+  // Skip files beginning with "<char>_" and files
+  // ending with "_i.<char*>"
+  if ((str[1] != '_') &&
+      !((str[l-1] == 'i') && (str[l-2] == '_')))
+    return filename.compare (l, 4, ".pcx") == 0;
+
+  return false;
+}
+
+/*-------------------------------------------------------------------------*\
+ * Md2::Player::attach                                                     *
+ * Attach the loaded mesh to the MD2 object.                               *
+\*-------------------------------------------------------------------------*/
+void Md2::Player::attach(const std::string &dirname) throw (std::runtime_error)
+{
+  if (player_mesh->get_skins().empty())
+    throw std::runtime_error("No skin found");
+
+  name.assign(dirname, dirname.find_last_of('/') + 1, dirname.length());
+
+  player_object.set_model(player_mesh.get());
+
+  // Set first skin as default skin
+  current_skin = player_mesh->get_skins().begin()->first;
+  current_anim = player_object.get_current_anim();
 }
 
 /***************************************************************************\
@@ -90,6 +108,15 @@ void Md2::Player::draw_player_itp(bool animated)
   player_object.draw_object_itp(animated);
 }
 
+/***************************************************************************\
+ * Md2::Player::prepare_player                                             *
+\***************************************************************************/
+void Md2::Player::prepare_player(bool animated)
+{
+  player_mesh->set_texture(current_skin);
+  player_object.prepare(animated);
+}
+
 /***************************************************************************\
  * Md2::Player::animate                                                    *
  * Animate player objects.                                                 *
@@ -7,6 +7,7 @@
 #include <string>
 
 #include "md2_model.h"
+#include "vfs.h"
 
 namespace Md2
 {
@@ -21,10 +22,21 @@ namespace Md2
     std::string name;
     std::string current_skin;
     std::string current_anim;
+
+    void attach(const std::string &dirname) throw(std::runtime_error);
   public:
-    Player(const std::string &dirname) throw(std::runtime_error);
+    // With an AnimCache the mesh animations are paged in on demand
+    Player(const Vfs &vfs, const std::string &dirname,
+           AnimCache *anim_cache = nullptr) throw(std::runtime_error);
+    // From a mesh whose skins are already registered (see PlayerLoader)
+    Player(const std::string &dirname, std::unique_ptr<Model> mesh) throw(std::runtime_error);
+
+    // Files of a player directory which are skins
+    static bool is_skin(const std::string &filename);
 
     void draw_player_itp(bool animated);
+    // Skin the player for this frame, to be drawn through a RenderQueue
+    void prepare_player(bool animated);
     void animate(float percent);
 
     // Setters and accessors
@@ -36,6 +48,7 @@ namespace Md2
     const std::string &get_current_anim() const { return current_anim; }
 
     const Model *get_player_mesh() const { return player_mesh.get(); }
+    Object *get_player_object() { return &player_object; }
   };
 }
 #endif
@@ -0,0 +1,95 @@
+// occlusion.cpp
+
+#include "occlusion.h"
+
+/***************************************************************************\
+ * OcclusionCuller::release                                                *
+\***************************************************************************/
+void OcclusionCuller::release()
+{
+  for (auto &query : queries)
+    glDeleteQueries(1, &query.second.id);
+  queries.clear();
+}
+
+/***************************************************************************\
+ * OcclusionCuller::collect                                                *
+\***************************************************************************/
+void OcclusionCuller::collect()
+{
+  drawn = culled = 0;
+
+  for (auto &entry : queries)
+  {
+    Query &query = entry.second;
+    if (!query.pending)
+      continue;
+
+    GLint available = 0;
+    glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      continue;
+
+    GLuint samples = 0;
+    glGetQueryObjectuiv(query.id, GL_QUERY_RESULT, &samples);
+    query.visible = samples > 0;
+    query.pending = false;
+  }
+}
+
+/***************************************************************************\
+ * OcclusionCuller::is_visible                                             *
+\***************************************************************************/
+bool OcclusionCuller::is_visible(const Md2::Object *object)
+{
+  auto it = queries.find(object);
+  bool visible = !enabled || it == queries.end() || it->second.visible;
+
+  if (visible)
+    drawn++;
+  else
+    culled++;
+
+  return visible;
+}
+
+/***************************************************************************\
+ * OcclusionCuller::issue                                                  *
+\***************************************************************************/
+void OcclusionCuller::issue(const std::vector<Md2::Object *> &objects)
+{
+  if (!enabled)
+    return;
+
+  glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glDisable(GL_TEXTURE_2D);
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LEQUAL);
+  glDepthMask(GL_FALSE);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+  for (const Md2::Object *object : objects)
+  {
+    auto it = queries.find(object);
+    if (it == queries.end())
+    {
+      Query query = { 0, false, true };
+      glGenQueries(1, &query.id);
+      it = queries.insert(std::make_pair(object, query)).first;
+    }
+
+    // One query in flight per object
+    Query &query = it->second;
+    if (query.pending)
+      continue;
+
+    glBeginQuery(GL_SAMPLES_PASSED, query.id);
+    object->draw_bounds();
+    glEndQuery(GL_SAMPLES_PASSED);
+    query.pending = true;
+  }
+
+  glPopAttrib();
+}
@@ -0,0 +1,58 @@
+// occlusion.h
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <map>
+#include <vector>
+
+#include <GL/gl.h>
+
+#include "md2_model.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// class OcclusionCuller -- hardware occlusion queries on the objects.
+//
+// Once the scene is in the depth buffer, the bounding box of each object
+// (and its projection on the shadow plane) is drawn inside a
+// GL_SAMPLES_PASSED query.  The results are read back on the next frame,
+// only if the GL has them ready, so the pipeline never stalls: an object
+// keeps its last known visibility while its query is in flight.  Occluded
+// objects are neither skinned nor drawn.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+class OcclusionCuller
+{
+  struct Query
+  {
+    GLuint id;
+    bool pending;
+    bool visible;
+  };
+  std::map<const Md2::Object *, Query> queries;
+
+  bool enabled;
+  int drawn;
+  int culled;
+public:
+  OcclusionCuller() : enabled(true), drawn(0), culled(0) {}
+
+  void release();
+  void set_enabled(bool e) { enabled = e; }
+  bool is_enabled() const { return enabled; }
+
+  // Read the available results and reset the frame counters
+  void collect();
+  // Visibility of 'object' for this frame, counted in the statistics
+  bool is_visible(const Md2::Object *object);
+  // Issue the queries for the next frame
+  void issue(const std::vector<Md2::Object *> &objects);
+
+  // Statistics of the current frame
+  int get_drawn() const { return drawn; }
+  int get_culled() const { return culled; }
+};
+
+#endif
@@ -0,0 +1,241 @@
+// player_loader.cpp
+
+#include <chrono>
+#include <iostream>
+#include <limits>
+
+#include "player_loader.h"
+#include "trace.h"
+
+/***************************************************************************\
+ * PlayerLoader::PlayerLoader                                              *
+\***************************************************************************/
+PlayerLoader::PlayerLoader(int threads)
+: queued(0), loaded(0), failed(0), stopping(false), pool(threads)
+{
+}
+
+/***************************************************************************\
+ * PlayerLoader::~PlayerLoader                                             *
+\***************************************************************************/
+PlayerLoader::~PlayerLoader()
+{
+  release();
+}
+
+/***************************************************************************\
+ * PlayerLoader::release                                                   *
+\***************************************************************************/
+void PlayerLoader::release()
+{
+  // The tasks still queued return at once
+  stopping = true;
+  pool.wait();
+
+  std::lock_guard<std::mutex> guard(lock);
+  jobs.clear();
+}
+
+/***************************************************************************\
+ * PlayerLoader::queue                                                     *
+\***************************************************************************/
+void PlayerLoader::queue(const Vfs &vfs, const std::string &dirname,
+                         Md2::AnimCache *anim_cache, float keyframe_error)
+{
+  Job *job = new Job;
+  job->vfs = &vfs;
+  job->dirname = dirname;
+  job->anim_cache = anim_cache;
+  job->keyframe_error = keyframe_error;
+  job->state = Job::QUEUED;
+  job->uploaded = 0;
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back(std::unique_ptr<Job>(job));
+    queued++;
+  }
+  pool.submit([this, job]() { load(job); });
+}
+
+/*-------------------------------------------------------------------------*\
+ * PlayerLoader::load                                                      *
+ * Loader thread: parse (and compress) the mesh and decode the skins of a  *
+ * player.  No GL calls here.                                              *
+\*-------------------------------------------------------------------------*/
+void PlayerLoader::load(Job *job)
+{
+  if (stopping)
+    return;
+
+  Trace::Scope trace("PlayerLoader::load");
+  std::unique_ptr<Md2::Model> mesh;
+  std::vector<Skin> skins;
+  std::string error;
+
+  std::string path = Vfs::join(job->dirname, "tris.md2");
+  FileSpan data = job->vfs->open(path);
+
+  // Md2::Model and Image exit on bad files: they are checked first, so
+  // that the failure goes through the progress instead
+  if (data.empty())
+    error = "No model found";
+  else
+    error = Md2::Model::check(path, data);
+
+  if (error.empty())
+  {
+    mesh.reset(new Md2::Model(path, data, job->anim_cache));
+    if (job->keyframe_error > 0)
+      mesh->compress(job->keyframe_error);
+
+    // Only the default skin (the first one) is decoded, the others are
+    // loaded when first selected
+    for (const std::string &filename : job->vfs->list(job->dirname))
+      if (Md2::Player::is_skin(filename))
+      {
+        std::string skin_path = Vfs::join(job->dirname, filename);
+        mesh->add_skin(skin_path, job->vfs->open(skin_path));
+        if (skins.empty() || skin_path < skins.front().path)
+        {
+          skins.resize(1);
+          skins.front().path = skin_path;
+        }
+      }
+
+    if (stopping)
+      return;
+    for (Skin &skin : skins)
+    {
+      FileSpan file = job->vfs->open(skin.path);
+      error = Image::check(skin.path, file);
+      if (!error.empty())
+      {
+        mesh.reset();
+        skins.clear();
+        break;
+      }
+      skin.image.reset(new Image(skin.path, file));
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  job->mesh = std::move(mesh);
+  job->skins = std::move(skins);
+  job->error = error;
+  job->state = error.empty() ? Job::DECODED : Job::FAILED;
+}
+
+/***************************************************************************\
+ * PlayerLoader::update                                                    *
+\***************************************************************************/
+std::vector<PlayerLoader::PlayerPtr> PlayerLoader::update(double budget_ms)
+{
+  Trace::Scope trace("PlayerLoader::update");
+  auto start = std::chrono::steady_clock::now();
+  std::vector<PlayerPtr> ready;
+  bool uploaded_any = false;
+
+  // Jobs are only removed here, and a decoded job is left alone by the
+  // loader threads, so its skins are uploaded without the lock
+  std::unique_lock<std::mutex> guard(lock);
+  auto it = jobs.begin();
+  while (it != jobs.end())
+  {
+    Job &job = **it;
+
+    if (job.state == Job::QUEUED)
+    {
+      ++it;
+      continue;
+    }
+
+    if (job.state == Job::DECODED)
+    {
+      guard.unlock();
+      while (job.uploaded < job.skins.size())
+      {
+        std::chrono::duration<double, std::milli> spent = std::chrono::steady_clock::now() - start;
+        if (uploaded_any && spent.count() >= budget_ms)
+          break;
+
+        Skin &skin = job.skins[job.uploaded];
+        job.mesh->add_texture(skin.path, *skin.image);
+        skin.image.reset();
+        uploaded_any = true;
+
+        guard.lock();
+        job.uploaded++;
+        guard.unlock();
+      }
+      guard.lock();
+
+      // Budget spent
+      if (job.uploaded < job.skins.size())
+        break;
+
+      try
+      {
+        ready.push_back(PlayerPtr(new Md2::Player(job.dirname, std::move(job.mesh))));
+        loaded++;
+      }
+      catch (std::runtime_error &err)
+      {
+        job.error = err.what();
+        job.state = Job::FAILED;
+      }
+    }
+
+    if (job.state == Job::FAILED)
+    {
+      std::cerr << "Error: failed to load player from " << job.dirname << std::endl;
+      std::cerr << "Reason: " << job.error << std::endl;
+      failed++;
+    }
+    it = jobs.erase(it);
+  }
+
+  return ready;
+}
+
+/***************************************************************************\
+ * PlayerLoader::finish                                                    *
+\***************************************************************************/
+std::vector<PlayerLoader::PlayerPtr> PlayerLoader::finish()
+{
+  pool.wait();
+  return update(std::numeric_limits<double>::infinity());
+}
+
+/***************************************************************************\
+ * PlayerLoader::get_progress                                              *
+ * Each player counts as half done once decoded, the rest going with its   *
+ * uploads.                                                                *
+\***************************************************************************/
+PlayerLoader::Progress PlayerLoader::get_progress() const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  Progress progress;
+  progress.queued = queued;
+  progress.loaded = loaded;
+  progress.failed = failed;
+
+  float done = loaded + failed;
+  for (const auto &job : jobs)
+    if (job->state == Job::DECODED)
+      done += 0.5f + (job->skins.empty() ? 0.5f : 0.5f * job->uploaded / job->skins.size());
+    else if (job->state == Job::FAILED)
+      done += 1;
+
+  progress.fraction = queued > 0 ? done / queued : 1;
+  return progress;
+}
+
+/***************************************************************************\
+ * PlayerLoader::busy                                                      *
+\***************************************************************************/
+bool PlayerLoader::busy() const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return !jobs.empty();
+}
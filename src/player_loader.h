@@ -0,0 +1,102 @@
+// player_loader.h
+
+#ifndef PLAYER_LOADER_H
+#define PLAYER_LOADER_H
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "md2_player.h"
+#include "thread_pool.h"
+#include "vfs.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// class PlayerLoader -- players loaded in the background.
+//
+// Queued player directories are parsed (tris.md2) and their default skin
+// decoded on the loader threads, the other skins being only registered.
+// The GL work is left to update(), called once per frame on the rendering
+// thread: it uploads the decoded skins until its time budget is spent, and
+// hands out the players which are complete, so that a frame is never held
+// by more than about one skin upload.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+class PlayerLoader
+{
+  struct Skin
+  {
+    std::string path;
+    std::unique_ptr<Image> image;  // released once uploaded
+  };
+
+  struct Job
+  {
+    enum State { QUEUED, DECODED, FAILED };
+
+    const Vfs *vfs;
+    std::string dirname;
+    Md2::AnimCache *anim_cache;
+    float keyframe_error;  // 0: keyframes left uncompressed
+
+    // Set by the loader thread, then owned by update()
+    State state;
+    std::unique_ptr<Md2::Model> mesh;
+    std::vector<Skin> skins;
+    size_t uploaded;
+    std::string error;
+  };
+
+  mutable std::mutex lock;
+  std::list<std::unique_ptr<Job> > jobs;
+  int queued;
+  int loaded;
+  int failed;
+  std::atomic<bool> stopping;
+  // Last member: joined before the jobs go
+  ThreadPool pool;
+
+  void load(Job *job);
+public:
+  typedef std::unique_ptr<Md2::Player> PlayerPtr;
+
+  struct Progress
+  {
+    int queued;      // players queued so far
+    int loaded;      // handed out by update()
+    int failed;
+    float fraction;  // of the work queued so far, 1 when done
+  };
+
+  PlayerLoader(int threads = 2);
+  ~PlayerLoader();
+  PlayerLoader(const PlayerLoader &) = delete;
+  PlayerLoader &operator=(const PlayerLoader &) = delete;
+
+  // Drop the players not handed out yet, to be called before the GL
+  // context and the AnimCache go
+  void release();
+
+  // With an AnimCache the mesh is paged: it is only used by the player
+  // handed out, on the rendering thread.  Otherwise a 'keyframe_error'
+  // above 0 compresses its keyframes (Model::compress).
+  void queue(const Vfs &vfs, const std::string &dirname, Md2::AnimCache *anim_cache = nullptr,
+             float keyframe_error = 0);
+
+  // Upload skins for at most 'budget_ms' (at least one when some are
+  // waiting) and return the players completed.  Rendering thread only.
+  std::vector<PlayerPtr> update(double budget_ms);
+  // Wait for every queued player and return those not handed out yet
+  std::vector<PlayerPtr> finish();
+
+  Progress get_progress() const;
+  bool busy() const;
+};
+
+#endif
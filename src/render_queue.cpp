@@ -0,0 +1,64 @@
+// render_queue.cpp
+
+#include <algorithm>
+
+#include "gl_state.h"
+#include "render_queue.h"
+#include "trace.h"
+
+/*-------------------------------------------------------------------------*\
+ * RenderQueue::Item::operator<                                            *
+\*-------------------------------------------------------------------------*/
+bool RenderQueue::Item::operator<(const Item &o) const
+{
+  if (pass != o.pass)
+    return pass < o.pass;
+  if (program != o.program)
+    return program < o.program;
+  return texture < o.texture;
+}
+
+/***************************************************************************\
+ * RenderQueue::add                                                        *
+\***************************************************************************/
+void RenderQueue::add(const Md2::Object *object, GLuint program)
+{
+  GLuint texture = object->get_model()->get_texture();
+
+  for (int pass = 0; pass < Md2::PASS_COUNT; pass++)
+    items.push_back(Item{static_cast<Md2::RenderPass>(pass), program, texture, object});
+}
+
+/***************************************************************************\
+ * RenderQueue::flush                                                      *
+\***************************************************************************/
+void RenderQueue::flush(Md2::RenderPass pass)
+{
+  Trace::Scope trace("RenderQueue::flush");
+  // Stable: objects sharing all their state keep the order they came in
+  std::stable_sort(items.begin(), items.end());
+
+  auto first = std::find_if(items.begin(), items.end(),
+                            [pass](const Item &item) { return item.pass == pass; });
+  auto last = std::find_if(first, items.end(),
+                           [pass](const Item &item) { return item.pass != pass; });
+
+  for (auto it = first; it != last; ++it)
+  {
+    gl_state.use_program(it->program);
+    it->object->draw(it->pass);
+  }
+
+  gl_state.client_state(GL_TEXTURE_COORD_ARRAY, false);
+  gl_state.client_state(GL_COLOR_ARRAY, false);
+  items.erase(first, last);
+}
+
+/***************************************************************************\
+ * RenderQueue::flush                                                      *
+\***************************************************************************/
+void RenderQueue::flush()
+{
+  for (int pass = 0; pass < Md2::PASS_COUNT; pass++)
+    flush(static_cast<Md2::RenderPass>(pass));
+}
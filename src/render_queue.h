@@ -0,0 +1,45 @@
+// render_queue.h
+
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <vector>
+
+#include <GL/gl.h>
+
+#include "md2_model.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// class RenderQueue -- draws of a frame, sorted to share GL state.
+//
+// Objects are queued once skinned (Object::prepare) and drawn on flush,
+// ordered by pass (planar shadows, then characters), by shader program and
+// by texture, so that consecutive draws only change what differs.  State
+// goes through gl_state, which skips what is already set.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+class RenderQueue
+{
+  struct Item
+  {
+    Md2::RenderPass pass;
+    GLuint program;
+    GLuint texture;
+    const Md2::Object *object;
+
+    bool operator<(const Item &o) const;
+  };
+  std::vector<Item> items;
+public:
+  // Queue every pass of 'object', drawn with 'program' (0: fixed function)
+  void add(const Md2::Object *object, GLuint program = 0);
+  // Draw and remove the items of one pass, or all of them in pass order
+  void flush(Md2::RenderPass pass);
+  void flush();
+
+  bool empty() const { return items.empty(); }
+};
+
+#endif
@@ -0,0 +1,340 @@
+// session.cpp
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "session.h"
+
+namespace
+{
+  const char MAGIC[4] = { 'O', 'M', 'B', 'S' };
+  const unsigned char VERSION = 4;
+
+  // Frames a timing row waits for its GPU times
+  const size_t GPU_WAIT_FRAMES = 8;
+
+  template <typename T> void put(std::ofstream &ofs, const T &value)
+  {
+    ofs.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  template <typename T> bool get(std::ifstream &ifs, T &value)
+  {
+    return static_cast<bool>(ifs.read(reinterpret_cast<char *>(&value), sizeof(T)));
+  }
+
+  void put_vec3(std::ofstream &ofs, const vec3 &v)
+  {
+    put(ofs, v.x); put(ofs, v.y); put(ofs, v.z);
+  }
+
+  bool get_vec3(std::ifstream &ifs, vec3 &v)
+  {
+    return get(ifs, v.x) && get(ifs, v.y) && get(ifs, v.z);
+  }
+}
+
+/***************************************************************************\
+ * Session::Writer::open                                                   *
+\***************************************************************************/
+bool Session::Writer::open(const std::string &filename)
+{
+  ofs.open(filename.c_str(), std::ios::binary);
+  if (ofs.fail())
+    return false;
+
+  ofs.write(MAGIC, 4);
+  put(ofs, VERSION);
+  return true;
+}
+
+/***************************************************************************\
+ * Session::Writer::write                                                  *
+\***************************************************************************/
+void Session::Writer::write(const Event &ev)
+{
+  if (!ofs.is_open())
+    return;
+
+  put(ofs, static_cast<unsigned char>(ev.type));
+  put(ofs, ev.time);
+
+  switch (ev.type)
+  {
+    case EV_CAMERA:
+      put_vec3(ofs, ev.a);
+      put_vec3(ofs, ev.b);
+      break;
+    case EV_LIGHT:
+      put_vec3(ofs, ev.a);
+      break;
+    case EV_ANIM:
+    case EV_SKIN:
+      put(ofs, static_cast<unsigned short>(ev.name.length()));
+      ofs.write(ev.name.data(), ev.name.length());
+      break;
+    case EV_ANIMATED:
+    case EV_FRAME_RATE:
+    case EV_POLYGON_MODE:
+    case EV_SHADOW_MODE:
+    case EV_MESH_LOD:
+    case EV_OCCLUSION:
+      put(ofs, ev.value);
+      break;
+    default:
+      break;
+  }
+}
+
+/***************************************************************************\
+ * Session::Reader::open                                                   *
+\***************************************************************************/
+bool Session::Reader::open(const std::string &filename)
+{
+  char magic[4];
+  unsigned char version;
+
+  ifs.open(filename.c_str(), std::ios::binary);
+  if (ifs.fail())
+    return false;
+
+  ifs.read(magic, 4);
+  if (!ifs || !std::equal(magic, magic + 4, MAGIC) || !get(ifs, version) || version != VERSION)
+  {
+    std::cerr << "Bad session file: " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/***************************************************************************\
+ * Session::Reader::read                                                   *
+\***************************************************************************/
+bool Session::Reader::read(Event &ev)
+{
+  unsigned char type;
+  unsigned short length;
+  bool ok;
+
+  if (!error.empty())
+    return false;
+
+  // Nothing left before a record: clean end of the log
+  std::streamoff offset = ifs.tellg();
+  if (!get(ifs, type))
+    return false;
+  if (type >= EV_COUNT)
+    return fail(offset, "unknown event type " + std::to_string(type));
+  if (!get(ifs, ev.time))
+    return fail(offset, "truncated event");
+
+  ev.type = static_cast<EventType>(type);
+
+  switch (ev.type)
+  {
+    case EV_CAMERA:
+      ok = get_vec3(ifs, ev.a) && get_vec3(ifs, ev.b);
+      break;
+    case EV_LIGHT:
+      ok = get_vec3(ifs, ev.a);
+      break;
+    case EV_ANIM:
+    case EV_SKIN:
+      ok = get(ifs, length);
+      if (ok)
+      {
+        ev.name.resize(length);
+        ok = length == 0 || static_cast<bool>(ifs.read(&ev.name[0], length));
+      }
+      break;
+    case EV_ANIMATED:
+    case EV_FRAME_RATE:
+    case EV_POLYGON_MODE:
+    case EV_SHADOW_MODE:
+    case EV_MESH_LOD:
+    case EV_OCCLUSION:
+      ok = get(ifs, ev.value);
+      break;
+    default:
+      ok = true;
+      break;
+  }
+
+  return ok || fail(offset, "truncated event");
+}
+
+/*-------------------------------------------------------------------------*\
+ * Session::Reader::fail                                                   *
+ * Record why the log stops before its end.                                *
+\*-------------------------------------------------------------------------*/
+bool Session::Reader::fail(std::streamoff offset, const std::string &what)
+{
+  std::ostringstream message;
+  message << what << " at byte " << offset;
+  error = message.str();
+  return false;
+}
+
+/***************************************************************************\
+ * Session::TimingLog::set_gpu_sections                                    *
+\***************************************************************************/
+void Session::TimingLog::set_gpu_sections(const std::vector<std::string> &names)
+{
+  gpu_sections = names;
+  gpu_total_ms.assign(names.size() + 1, 0);
+}
+
+/***************************************************************************\
+ * Session::TimingLog::open                                                *
+\***************************************************************************/
+bool Session::TimingLog::open(const std::string &filename)
+{
+  ofs.open(filename.c_str());
+  if (ofs.fail())
+    return false;
+
+  ofs << "frame,time,frame_ms,drawn,culled,gl_issued,gl_elided,allocs";
+  for (const std::string &name : gpu_sections)
+    ofs << ",gpu_" << name << "_ms";
+  if (!gpu_sections.empty())
+    ofs << ",gpu_frame_ms";
+  ofs << '\n';
+  return true;
+}
+
+/***************************************************************************\
+ * Session::TimingLog::frame                                               *
+\***************************************************************************/
+void Session::TimingLog::frame(float time, double ms, const FrameStats &stats)
+{
+  if (ofs.is_open())
+  {
+    std::ostringstream line;
+    line << frame_ms.size() << ',' << time << ',' << ms << ','
+         << stats.drawn << ',' << stats.culled << ','
+         << stats.gl_issued << ',' << stats.gl_elided << ',' << stats.allocations;
+    pending.push_back(Row{line.str(), stats.gpu_frame, std::vector<double>()});
+    write_rows(false);
+  }
+  frame_ms.push_back(ms);
+  total_drawn += stats.drawn;
+  total_culled += stats.culled;
+  total_issued += stats.gl_issued;
+  total_elided += stats.gl_elided;
+  total_allocations += stats.allocations;
+}
+
+/***************************************************************************\
+ * Session::TimingLog::gpu                                                 *
+\***************************************************************************/
+void Session::TimingLog::gpu(unsigned long gpu_frame, const std::vector<double> &section_ms,
+                             double ms)
+{
+  if (gpu_sections.empty() || section_ms.size() != gpu_sections.size())
+    return;
+
+  for (size_t i = 0; i < section_ms.size(); i++)
+    gpu_total_ms[i] += section_ms[i];
+  gpu_total_ms.back() += ms;
+  gpu_frames++;
+
+  for (Row &row : pending)
+    if (row.gpu_frame == gpu_frame && row.gpu_ms.empty())
+    {
+      row.gpu_ms = section_ms;
+      row.gpu_ms.push_back(ms);
+      break;
+    }
+
+  write_rows(false);
+}
+
+/*-------------------------------------------------------------------------*\
+ * Session::TimingLog::write_rows                                          *
+ * Write the rows which have their GPU times, in order, and those which    *
+ * waited too long.                                                        *
+\*-------------------------------------------------------------------------*/
+void Session::TimingLog::write_rows(bool all)
+{
+  while (!pending.empty())
+  {
+    Row &row = pending.front();
+    bool waiting = !gpu_sections.empty() && row.gpu_frame && row.gpu_ms.empty();
+    if (waiting && !all && pending.size() <= GPU_WAIT_FRAMES)
+      break;
+
+    ofs << row.line;
+    if (!gpu_sections.empty())
+    {
+      if (row.gpu_ms.empty())
+        row.gpu_ms.assign(gpu_sections.size() + 1, -1);
+      for (double ms : row.gpu_ms)
+        if (ms >= 0)
+          ofs << ',' << ms;
+        else
+          ofs << ',';
+    }
+    ofs << '\n';
+    pending.pop_front();
+  }
+}
+
+/***************************************************************************\
+ * Session::TimingLog::close                                               *
+ * Print the frame count, mean, median and 95th percentile frame times,   *
+ * the characters drawn and culled and the GL state changes over the       *
+ * replay, the heap allocations per frame and the mean GPU time of each    *
+ * section.                                                                *
+\***************************************************************************/
+void Session::TimingLog::close()
+{
+  if (ofs.is_open())
+  {
+    write_rows(true);
+    ofs.close();
+  }
+
+  if (frame_ms.empty())
+    return;
+
+  std::vector<double> sorted(frame_ms);
+  std::sort(sorted.begin(), sorted.end());
+
+  double total = 0;
+  for (double ms : sorted)
+    total += ms;
+
+  std::cerr << "frames: " << sorted.size()
+            << "  mean: " << total / sorted.size() << " ms"
+            << "  p50: " << sorted[sorted.size() / 2] << " ms"
+            << "  p95: " << sorted[sorted.size() * 95 / 100] << " ms" << std::endl;
+  std::cerr << "characters drawn: " << total_drawn
+            << "  culled: " << total_culled << std::endl;
+  std::cerr << "gl state changes: " << total_issued
+            << "  redundant skipped: " << total_elided << std::endl;
+  std::cerr << "heap allocations per frame: "
+            << static_cast<double>(total_allocations) / sorted.size() << std::endl;
+  if (gpu_frames > 0)
+  {
+    std::cerr << "gpu mean (" << gpu_frames << " frames):";
+    for (size_t i = 0; i < gpu_sections.size(); i++)
+      std::cerr << "  " << gpu_sections[i] << ": " << gpu_total_ms[i] / gpu_frames << " ms";
+    std::cerr << "  frame: " << gpu_total_ms.back() / gpu_frames << " ms" << std::endl;
+  }
+
+  frame_ms.clear();
+  total_drawn = total_culled = 0;
+  total_issued = total_elided = 0;
+  total_allocations = 0;
+  gpu_total_ms.assign(gpu_total_ms.size(), 0);
+  gpu_frames = 0;
+}
+
+/***************************************************************************\
+ * Session::TimingLog::~TimingLog                                          *
+\***************************************************************************/
+Session::TimingLog::~TimingLog()
+{
+  close();
+}
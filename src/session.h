@@ -0,0 +1,135 @@
+// session.h
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "vec3.h"
+
+namespace Session
+{
+  // Recorded event kinds
+  enum EventType
+  {
+    EV_FRAME = 0,     // a frame is drawn at 'time' (virtual clock)
+    EV_CAMERA,        // a = eye, b = rot
+    EV_LIGHT,         // a = light position
+    EV_ANIM,          // name = animation
+    EV_SKIN,          // name = skin
+    EV_ANIMATED,      // value = animation on/off
+    EV_FRAME_RATE,    // value = animation frame rate
+    EV_POLYGON_MODE,  // value = GL polygon mode
+    EV_SHADOW_MODE,   // value = Md2::ShadowMode
+    EV_MESH_LOD,      // value = level of detail on/off
+    EV_OCCLUSION,     // value = occlusion culling on/off
+    EV_COUNT
+  };
+
+  struct Event
+  {
+    EventType type;
+    float time;        // seconds since the start of the session
+    vec3 a, b;
+    int value;
+    std::string name;
+
+    Event(EventType type = EV_FRAME, float time = 0)
+    : type(type), time(time), value(0) {}
+  };
+
+  /////////////////////////////////////////////////////////////////////////////
+  //
+  // class Writer / Reader -- compact binary session log.
+  //
+  // The file starts with "OMBS" and a version byte, followed by the events:
+  // one type byte, a float timestamp, then a type dependent payload.
+  //
+  /////////////////////////////////////////////////////////////////////////////
+
+  class Writer
+  {
+    std::ofstream ofs;
+  public:
+    bool open(const std::string &filename);
+    bool is_open() const { return ofs.is_open(); }
+    void write(const Event &ev);
+  };
+
+  class Reader
+  {
+    std::ifstream ifs;
+    std::string error;
+
+    bool fail(std::streamoff offset, const std::string &what);
+  public:
+    bool open(const std::string &filename);
+    // Returns false at the end of the log, or on a truncated or unknown
+    // record: get_error() then says which, empty at a clean end
+    bool read(Event &ev);
+    const std::string &get_error() const { return error; }
+  };
+
+  /////////////////////////////////////////////////////////////////////////////
+  //
+  // class TimingLog -- per-frame timings of a replay, written as CSV.  A
+  // summary is printed on standard error when the log is closed.  GPU
+  // times arrive a few frames late: rows wait for them before being
+  // written, and are written without them if they don't come.
+  //
+  /////////////////////////////////////////////////////////////////////////////
+
+  // Per-frame counters logged with the timings
+  struct FrameStats
+  {
+    int drawn;   // characters drawn
+    int culled;  // characters skipped by the occlusion culling
+    unsigned long gl_issued;  // GL state changes made
+    unsigned long gl_elided;  // redundant ones skipped
+    unsigned long gpu_frame;  // frame number of the GPU profiler (0: none)
+    unsigned long allocations;  // heap allocations
+
+    FrameStats() : drawn(0), culled(0), gl_issued(0), gl_elided(0), gpu_frame(0), allocations(0) {}
+  };
+
+  class TimingLog
+  {
+    struct Row
+    {
+      std::string line;           // CPU side columns
+      unsigned long gpu_frame;
+      std::vector<double> gpu_ms; // per section then whole frame, empty until known
+    };
+
+    std::ofstream ofs;
+    std::vector<double> frame_ms;
+    long total_drawn;
+    long total_culled;
+    unsigned long total_issued;
+    unsigned long total_elided;
+    unsigned long total_allocations;
+
+    std::vector<std::string> gpu_sections;
+    std::deque<Row> pending;
+    std::vector<double> gpu_total_ms;
+    long gpu_frames;
+
+    void write_rows(bool all);
+  public:
+    TimingLog() : total_drawn(0), total_culled(0), total_issued(0), total_elided(0),
+      total_allocations(0), gpu_frames(0) {}
+    ~TimingLog();
+    // Names of the GPU sections, for the columns: call before open()
+    void set_gpu_sections(const std::vector<std::string> &names);
+    bool open(const std::string &filename);
+    void frame(float time, double ms, const FrameStats &stats = FrameStats());
+    // GPU times of the frame logged with stats.gpu_frame == 'gpu_frame'
+    void gpu(unsigned long gpu_frame, const std::vector<double> &section_ms, double frame_ms);
+    void close();
+  };
+}
+
+#endif
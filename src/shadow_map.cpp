@@ -0,0 +1,293 @@
+// shadow_map.cpp
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <GL/gl.h>
+#include <GL/glu.h>
+
+#include "gl_state.h"
+#include "mem_stats.h"
+#include "shadow_map.h"
+
+extern vec3 light_pos;
+
+namespace
+{
+  // Half size of the square covered by the light, and distance of the
+  // light camera to the origin of the object frame
+  const float LIGHT_EXTENT = 6.0f;
+  const float LIGHT_DISTANCE = 20.0f;
+
+  const char *VERTEX_SHADER =
+    "#version 120\n"
+    "uniform mat4 shadow_matrix;\n"
+    "varying vec4 shadow_coord;\n"
+    "void main()\n"
+    "{\n"
+    "  shadow_coord = shadow_matrix * (gl_ModelViewMatrix * gl_Vertex);\n"
+    "  gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+    "  gl_FrontColor = gl_Color;\n"
+    "  gl_Position = ftransform();\n"
+    "}\n";
+
+  // PCF_RADIUS and TEXEL are prepended at build time
+  const char *FRAGMENT_SHADER =
+    "uniform sampler2D skin;\n"
+    "uniform sampler2DShadow shadow_map;\n"
+    "uniform bool textured;\n"
+    "varying vec4 shadow_coord;\n"
+    "void main()\n"
+    "{\n"
+    "  vec4 color = textured ? texture2D(skin, gl_TexCoord[0].st) * gl_Color : gl_Color;\n"
+    "  float lit = 0.0;\n"
+    "  for (int y = -PCF_RADIUS; y <= PCF_RADIUS; y++)\n"
+    "    for (int x = -PCF_RADIUS; x <= PCF_RADIUS; x++)\n"
+    "      lit += shadow2DProj(shadow_map, shadow_coord +\n"
+    "                          vec4(float(x), float(y), 0.0, 0.0) * TEXEL * shadow_coord.w).r;\n"
+    "  lit /= float((2 * PCF_RADIUS + 1) * (2 * PCF_RADIUS + 1));\n"
+    "  gl_FragColor = vec4(color.rgb * mix(0.5, 1.0, lit), color.a);\n"
+    "}\n";
+
+  GLuint compile(GLenum type, const std::string &source)
+  {
+    GLuint shader = glCreateShader(type);
+    const char *str = source.c_str();
+    GLint ok;
+
+    glShaderSource(shader, 1, &str, nullptr);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+
+    if (!ok)
+    {
+      GLint length;
+      glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+      std::vector<char> log(length + 1);
+      glGetShaderInfoLog(shader, length, nullptr, log.data());
+      std::cerr << "Shadow map shader: " << log.data() << std::endl;
+      glDeleteShader(shader);
+      return 0;
+    }
+    return shader;
+  }
+}
+
+/***************************************************************************\
+ * ShadowMap::ShadowMap                                                    *
+\***************************************************************************/
+ShadowMap::ShadowMap() : fbo(0), depth_tex(0), program(0), shadow_matrix_loc(-1),
+    textured_loc(-1), size(0), pcf(1)
+{
+}
+
+/***************************************************************************\
+ * ShadowMap::init                                                         *
+\***************************************************************************/
+bool ShadowMap::init(int resolution, int kernel)
+{
+  release();
+
+  size = resolution;
+  pcf = kernel | 1;
+
+  // Depth texture, compared in the shader through sampler2DShadow.
+  // Outside the light frustum the border depth leaves things lit.
+  const GLfloat border[4] = { 1, 1, 1, 1 };
+
+  glGenTextures(1, &depth_tex);
+  glBindTexture(GL_TEXTURE_2D, depth_tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0,
+               GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+  glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  MemStats::account(MemStats::TEXTURE_GPU, size * size * 4);
+
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_tex, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (status != GL_FRAMEBUFFER_COMPLETE || !build_program())
+  {
+    std::cerr << "Shadow mapping unavailable" << std::endl;
+    release();
+    return false;
+  }
+
+  return true;
+}
+
+/*-------------------------------------------------------------------------*\
+ * ShadowMap::build_program                                                *
+\*-------------------------------------------------------------------------*/
+bool ShadowMap::build_program()
+{
+  std::string defines = "#version 120\n";
+  defines += "#define PCF_RADIUS " + std::to_string(pcf / 2) + "\n";
+  defines += "#define TEXEL " + std::to_string(1.0 / size) + "\n";
+
+  GLuint vs = compile(GL_VERTEX_SHADER, VERTEX_SHADER);
+  GLuint fs = compile(GL_FRAGMENT_SHADER, defines + FRAGMENT_SHADER);
+  GLint ok = 0;
+
+  if (vs && fs)
+  {
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  }
+
+  if (vs) glDeleteShader(vs);
+  if (fs) glDeleteShader(fs);
+
+  if (!ok)
+    return false;
+
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "skin"), 0);
+  glUniform1i(glGetUniformLocation(program, "shadow_map"), 1);
+  shadow_matrix_loc = glGetUniformLocation(program, "shadow_matrix");
+  textured_loc = glGetUniformLocation(program, "textured");
+  glUseProgram(0);
+
+  return true;
+}
+
+/***************************************************************************\
+ * ShadowMap::release                                                      *
+\***************************************************************************/
+void ShadowMap::release()
+{
+  if (program)   glDeleteProgram(program);
+  if (fbo)       glDeleteFramebuffers(1, &fbo);
+  if (depth_tex)
+  {
+    glDeleteTextures(1, &depth_tex);
+    MemStats::account(MemStats::TEXTURE_GPU, -static_cast<long>(size) * size * 4);
+  }
+  program = fbo = depth_tex = 0;
+}
+
+/***************************************************************************\
+ * ShadowMap::begin_depth_pass                                             *
+ * The light camera is set in the object frame (z up), in which light_pos  *
+ * is expressed; the objects apply that frame themselves, so it is undone  *
+ * here.                                                                   *
+\***************************************************************************/
+void ShadowMap::begin_depth_pass()
+{
+  vec3 dir = light_pos;
+  dir.normalize();
+
+  // Up vector: the axis least aligned with the light
+  vec3 up(0, 0, 1);
+  if (std::fabs(dir.z) > 0.9f)
+    up = vec3(1, 0, 0);
+
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glViewport(0, 0, size, size);
+  glClear(GL_DEPTH_BUFFER_BIT);
+
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(-LIGHT_EXTENT, LIGHT_EXTENT, -LIGHT_EXTENT, LIGHT_EXTENT, 1, 2 * LIGHT_DISTANCE);
+
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+  gluLookAt(dir.x * LIGHT_DISTANCE, dir.y * LIGHT_DISTANCE, dir.z * LIGHT_DISTANCE,
+            0, 0, 0, up.x, up.y, up.z);
+  glRotatef(90, 0, 0, 1);
+  glRotatef(90, 1, 0, 0);
+
+  // Texture coordinates of the shadow map from eye space of the light
+  GLfloat proj[16], view[16];
+  glGetFloatv(GL_PROJECTION_MATRIX, proj);
+  glGetFloatv(GL_MODELVIEW_MATRIX, view);
+
+  const float bias[16] = { 0.5f, 0, 0, 0,  0, 0.5f, 0, 0,
+                           0, 0, 0.5f, 0,  0.5f, 0.5f, 0.5f, 1 };
+  light_matrix = matrix(bias) * matrix(proj) * matrix(view);
+
+  glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_POLYGON_BIT);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDisable(GL_TEXTURE_2D);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2, 4);
+}
+
+/***************************************************************************\
+ * ShadowMap::end_depth_pass                                               *
+\***************************************************************************/
+void ShadowMap::end_depth_pass()
+{
+  glPopAttrib();
+  // The casters went through gl_state, now out of date
+  gl_state.invalidate();
+
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+/***************************************************************************\
+ * ShadowMap::begin_receiver_pass                                          *
+\***************************************************************************/
+bool ShadowMap::begin_receiver_pass(const matrix &camera_view)
+{
+  matrix eye_to_world;
+  if (!camera_view.inverse(eye_to_world))
+    return false;
+
+  // The shader gets eye space positions: undo the camera first
+  matrix shadow_matrix = light_matrix * eye_to_world;
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, depth_tex);
+  glActiveTexture(GL_TEXTURE0);
+
+  gl_state.use_program(program);
+  glUniformMatrix4fv(shadow_matrix_loc, 1, GL_FALSE, shadow_matrix.m);
+  glUniform1i(textured_loc, 1);
+  return true;
+}
+
+/***************************************************************************\
+ * ShadowMap::set_textured                                                 *
+\***************************************************************************/
+void ShadowMap::set_textured(bool textured)
+{
+  glUniform1i(textured_loc, textured);
+}
+
+/***************************************************************************\
+ * ShadowMap::end_receiver_pass                                            *
+\***************************************************************************/
+void ShadowMap::end_receiver_pass()
+{
+  gl_state.use_program(0);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
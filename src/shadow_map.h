@@ -0,0 +1,58 @@
+// shadow_map.h
+
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include <GL/gl.h>
+
+#include "matrix.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// class ShadowMap -- depth texture shadow mapping.
+//
+// The scene is rendered once from the directional light into a depth
+// texture attached to an FBO, then the receivers and the characters are
+// drawn with a shader which compares against it, with a PCF kernel of
+// configurable size.  Needs FBOs and GLSL 1.20 (Mesa llvmpipe has both).
+//
+/////////////////////////////////////////////////////////////////////////////
+
+class ShadowMap
+{
+  GLuint fbo;
+  GLuint depth_tex;
+  GLuint program;
+  GLint  shadow_matrix_loc;
+  GLint  textured_loc;
+
+  int size;
+  int pcf;
+
+  GLint viewport[4];
+  matrix light_matrix;  // object frame -> shadow texture coordinates
+
+  bool build_program();
+public:
+  ShadowMap();
+
+  // Create the GL objects, 'resolution' texels square, 'pcf' x 'pcf'
+  // kernel (odd).  Returns false if the GL implementation can't do it.
+  bool init(int resolution, int pcf);
+  void release();
+  bool ready() const { return program != 0; }
+  GLuint get_program() const { return program; }
+
+  // Depth pass: draw the shadow casters between these calls
+  void begin_depth_pass();
+  void end_depth_pass();
+
+  // Lit pass: 'camera_view' is the modelview holding only the camera
+  // transform.  Returns false, with nothing bound, if it can't be inverted.
+  // set_textured() tells whether the next draws are textured.
+  bool begin_receiver_pass(const matrix &camera_view);
+  void set_textured(bool textured);
+  void end_receiver_pass();
+};
+
+#endif
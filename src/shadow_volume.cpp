@@ -0,0 +1,141 @@
+// shadow_volume.cpp
+
+#include <algorithm>
+
+#include <GL/gl.h>
+
+#include "shadow_volume.h"
+#include "trace.h"
+
+namespace
+{
+  // Triangles per task
+  const int CHUNK_TRIS = 1024;
+}
+
+/***************************************************************************\
+ * Md2::build_shadow_volumes                                               *
+\***************************************************************************/
+void Md2::build_shadow_volumes(const std::vector<Object *> &objects, ThreadPool &pool)
+{
+  // Volumes still matching the pose and the light are kept
+  std::vector<Object *> dirty;
+  for (Object *object : objects)
+    if (object->shadow_volume_serial != object->pose.serial)
+      dirty.push_back(object);
+
+  // Classify every triangle against the light
+  for (Object *object : dirty)
+  {
+    const Model *model = object->get_model();
+    int num_tris = model->get_num_tris();
+    int chunks = (num_tris + CHUNK_TRIS - 1) / CHUNK_TRIS;
+
+    object->lit.resize(num_tris);
+    object->shadow_volume.resize(chunks);
+
+    for (int c = 0; c < chunks; c++)
+    {
+      int begin = c * CHUNK_TRIS;
+      int end = std::min(begin + CHUNK_TRIS, num_tris);
+      pool.submit([=]() {
+        Trace::Scope trace("classify_faces");
+        model->classify_faces(object->pose.vertices.data(), object->lit.data(), begin, end);
+      });
+    }
+  }
+  pool.wait();
+
+  // Extrude the silhouettes and add the caps, each chunk in its own array
+  for (Object *object : dirty)
+  {
+    object->shadow_volume_serial = object->pose.serial;
+
+    const Model *model = object->get_model();
+    int num_tris = model->get_num_tris();
+    int num_edges = model->get_num_edges();
+    int chunks = object->shadow_volume.size();
+
+    for (int c = 0; c < chunks; c++)
+    {
+      pool.submit([=]() {
+        Trace::Scope trace("extrude_volume");
+        Vec4Array &volume = object->shadow_volume[c];
+        const vec3 *vertices = object->pose.vertices.data();
+        const unsigned char *lit = object->lit.data();
+
+        volume.clear();
+        model->extrude_silhouette(vertices, lit, num_edges * c / chunks,
+                                  num_edges * (c + 1) / chunks, volume);
+        model->add_volume_caps(vertices, lit, num_tris * c / chunks,
+                               num_tris * (c + 1) / chunks, volume);
+      });
+    }
+  }
+  pool.wait();
+}
+
+/***************************************************************************\
+ * Md2::render_shadow_volumes                                              *
+\***************************************************************************/
+void Md2::render_shadow_volumes(const std::vector<Object *> &objects)
+{
+  glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+               GL_STENCIL_BUFFER_BIT | GL_POLYGON_BIT | GL_CURRENT_BIT);
+
+  // Volumes reach infinity: no far plane clipping
+  glEnable(GL_DEPTH_CLAMP);
+  glDisable(GL_TEXTURE_2D);
+  glDisable(GL_BLEND);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LESS);
+  glDepthMask(GL_FALSE);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+  glEnable(GL_STENCIL_TEST);
+  glStencilFunc(GL_ALWAYS, 0, ~0u);
+  glEnable(GL_CULL_FACE);
+
+  // Z-fail: count the volume faces behind the visible surface, back faces
+  // entering the volume and front faces leaving it
+  glCullFace(GL_FRONT);
+  glStencilOp(GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+  for (const Object *object : objects)
+    object->draw_shadow_volume();
+
+  glCullFace(GL_BACK);
+  glStencilOp(GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+  for (const Object *object : objects)
+    object->draw_shadow_volume();
+
+  // Darken the pixels inside a volume and clear the stencil
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glStencilFunc(GL_NOTEQUAL, 0, ~0u);
+  glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glColor4f(0, 0, 0, 0.5f);
+
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  glBegin(GL_QUADS);
+    glVertex2f(-1, -1);
+    glVertex2f( 1, -1);
+    glVertex2f( 1,  1);
+    glVertex2f(-1,  1);
+  glEnd();
+
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+
+  glPopAttrib();
+}
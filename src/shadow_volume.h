@@ -0,0 +1,25 @@
+// shadow_volume.h
+
+#ifndef SHADOW_VOLUME_H
+#define SHADOW_VOLUME_H
+
+#include <vector>
+
+#include "md2_model.h"
+#include "thread_pool.h"
+
+namespace Md2
+{
+  // Build the shadow volumes of the objects from the vertices of their last
+  // drawn frame.  Triangles are classified, then silhouettes extruded, in
+  // chunks spread over the pool across all the objects.  Objects whose pose
+  // and light haven't changed since their last build are skipped.
+  void build_shadow_volumes(const std::vector<Object *> &objects, ThreadPool &pool);
+
+  // Z-fail stencil passes over the volumes, then darken the shadowed
+  // pixels.  Expects the whole scene to be in the depth buffer and leaves
+  // the stencil buffer cleared.
+  void render_shadow_volumes(const std::vector<Object *> &objects);
+}
+
+#endif
@@ -0,0 +1,389 @@
+// vertex_animation.cpp
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "anorms.h"
+#include "gl_state.h"
+#include "mem_stats.h"
+#include "trace.h"
+#include "vertex_animation.h"
+
+extern vec3 light_pos;
+
+namespace
+{
+  // Texture units of the baked frames and of the normals, the skin being
+  // on unit 0 and the shadow map on unit 1
+  const int POSITION_UNIT = 2;
+  const int NORMAL_UNIT = 3;
+
+  // Attributes: per corner, then per instance
+  enum { ATTRIB_CORNER, ATTRIB_PLACE, ATTRIB_ANIM };
+
+  // AMBIENT is prepended at build time
+  const char *VERTEX_SHADER =
+    "uniform sampler2D positions;\n"
+    "uniform sampler2D normals;\n"
+    "uniform float time;\n"
+    "uniform vec3 light;\n"
+    "uniform vec3 bias;\n"
+    "uniform vec3 extent;\n"
+    "in vec3 corner;\n"     // vertex column, s, t
+    "in vec4 place;\n"      // position, scale
+    "in vec3 anim;\n"       // first frame, frames, phase
+    "out vec2 tex_coord;\n"
+    "out float shade;\n"
+    "void main()\n"
+    "{\n"
+    "  float t = mod(time + anim.z, anim.y);\n"
+    "  float f = floor(t);\n"
+    "  float interp = t - f;\n"
+    "  int column = int(corner.x);\n"
+    "  vec4 a = texelFetch(positions, ivec2(column, int(anim.x + f)), 0);\n"
+    "  vec4 b = texelFetch(positions, ivec2(column, int(anim.x + mod(f + 1.0, anim.y))), 0);\n"
+    "  vec3 position = bias + extent * mix(a.xyz, b.xyz, interp);\n"
+    "  float index = (interp < 0.5 ? a.w : b.w) * 65535.0 + 0.5;\n"
+    "  vec3 normal = texelFetch(normals, ivec2(int(index), 0), 0).xyz * 2.0 - 1.0;\n"
+    "  shade = AMBIENT + (1.0 - AMBIENT) * max(dot(normal, light), 0.0);\n"
+    "  tex_coord = corner.yz;\n"
+    "  gl_Position = gl_ModelViewProjectionMatrix * vec4(position * place.w + place.xyz, 1.0);\n"
+    "}\n";
+
+  const char *FRAGMENT_SHADER =
+    "uniform sampler2D skin;\n"
+    "in vec2 tex_coord;\n"
+    "in float shade;\n"
+    "void main()\n"
+    "{\n"
+    "  gl_FragColor = vec4(texture(skin, tex_coord).rgb * shade, 1.0);\n"
+    "}\n";
+
+  GLuint compile(GLenum type, const std::string &source)
+  {
+    GLuint shader = glCreateShader(type);
+    const char *str = source.c_str();
+    GLint ok;
+
+    glShaderSource(shader, 1, &str, nullptr);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+
+    if (!ok)
+    {
+      GLint length;
+      glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+      std::vector<char> log(length + 1);
+      glGetShaderInfoLog(shader, length, nullptr, log.data());
+      std::cerr << "Vertex animation shader: " << log.data() << std::endl;
+      glDeleteShader(shader);
+      return 0;
+    }
+    return shader;
+  }
+
+  // Texture of 16 bit texels, read as is with texelFetch
+  GLuint create_texture(int width, int height, GLenum internal, GLenum format,
+                        const GLushort *texels)
+  {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    gl_state.bind_texture(texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0, format, GL_UNSIGNED_SHORT, texels);
+    return texture;
+  }
+
+  GLushort unorm16(float v)
+  {
+    return static_cast<GLushort>(std::min(std::max(v, 0.0f), 1.0f) * 65535 + 0.5f);
+  }
+}
+
+/***************************************************************************\
+ * VertexAnimation::VertexAnimation                                        *
+\***************************************************************************/
+VertexAnimation::VertexAnimation()
+: program(0), time_loc(-1), light_loc(-1), bias_loc(-1), extent_loc(-1),
+  normal_tex(0), position_tex(0), corner_buffer(0), instance_buffer(0),
+  lo(0, 0, 0), hi(0, 0, 0), num_corners(0), num_instances(0), texture_bytes(0),
+  instance_bytes(0)
+{
+}
+
+/***************************************************************************\
+ * VertexAnimation::init                                                   *
+\***************************************************************************/
+bool VertexAnimation::init()
+{
+  release();
+
+  if (!gl_supports(3, 3, "GL_ARB_instanced_arrays") || !gl_supports(3, 0, "GL_EXT_gpu_shader4") ||
+      !build_program())
+  {
+    release();
+    return false;
+  }
+
+  // The anorms, looked up by the index baked with each vertex
+  std::vector<GLushort> texels;
+  for (const vec3 &n : Md2::anorms)
+  {
+    texels.push_back(unorm16(n.x * 0.5f + 0.5f));
+    texels.push_back(unorm16(n.y * 0.5f + 0.5f));
+    texels.push_back(unorm16(n.z * 0.5f + 0.5f));
+  }
+  normal_tex = create_texture(Md2::NUM_ANORMS, 1, GL_RGB16, GL_RGB, texels.data());
+  MemStats::account(MemStats::TEXTURE_GPU, texels.size() * sizeof(GLushort));
+
+  glGenBuffers(1, &instance_buffer);
+  return true;
+}
+
+/*-------------------------------------------------------------------------*\
+ * VertexAnimation::build_program                                          *
+\*-------------------------------------------------------------------------*/
+bool VertexAnimation::build_program()
+{
+  std::string defines = "#version 130\n";
+  defines += "#define AMBIENT " + std::to_string(Md2::LIGHT_AMBIENT) + "\n";
+
+  GLuint vs = compile(GL_VERTEX_SHADER, defines + VERTEX_SHADER);
+  GLuint fs = compile(GL_FRAGMENT_SHADER, defines + FRAGMENT_SHADER);
+  GLint ok = 0;
+
+  if (vs && fs)
+  {
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    // The corners on attribute 0, which the compatibility profile needs
+    // enabled to draw anything
+    glBindAttribLocation(program, ATTRIB_CORNER, "corner");
+    glBindAttribLocation(program, ATTRIB_PLACE, "place");
+    glBindAttribLocation(program, ATTRIB_ANIM, "anim");
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  }
+
+  if (vs) glDeleteShader(vs);
+  if (fs) glDeleteShader(fs);
+
+  if (!ok)
+    return false;
+
+  gl_state.use_program(program);
+  glUniform1i(glGetUniformLocation(program, "skin"), 0);
+  glUniform1i(glGetUniformLocation(program, "positions"), POSITION_UNIT);
+  glUniform1i(glGetUniformLocation(program, "normals"), NORMAL_UNIT);
+  time_loc = glGetUniformLocation(program, "time");
+  light_loc = glGetUniformLocation(program, "light");
+  bias_loc = glGetUniformLocation(program, "bias");
+  extent_loc = glGetUniformLocation(program, "extent");
+  gl_state.use_program(0);
+
+  return true;
+}
+
+/***************************************************************************\
+ * VertexAnimation::release                                                *
+\***************************************************************************/
+void VertexAnimation::release()
+{
+  release_bake();
+  set_instances(std::vector<Instance>());
+
+  if (program)
+    glDeleteProgram(program);
+  if (normal_tex)
+  {
+    glDeleteTextures(1, &normal_tex);
+    MemStats::account(MemStats::TEXTURE_GPU, -static_cast<long>(Md2::NUM_ANORMS * 3 * sizeof(GLushort)));
+  }
+  if (instance_buffer)
+    glDeleteBuffers(1, &instance_buffer);
+  program = normal_tex = instance_buffer = 0;
+}
+
+/*-------------------------------------------------------------------------*\
+ * VertexAnimation::release_bake                                           *
+\*-------------------------------------------------------------------------*/
+void VertexAnimation::release_bake()
+{
+  if (position_tex)
+    glDeleteTextures(1, &position_tex);
+  if (corner_buffer)
+    glDeleteBuffers(1, &corner_buffer);
+  MemStats::account(MemStats::TEXTURE_GPU, -static_cast<long>(texture_bytes));
+  MemStats::account(MemStats::GPU_BUFFERS, -static_cast<long>(num_corners * 3 * sizeof(GLfloat)));
+  position_tex = corner_buffer = 0;
+  texture_bytes = 0;
+  num_corners = 0;
+}
+
+/***************************************************************************\
+ * VertexAnimation::bake                                                   *
+\***************************************************************************/
+bool VertexAnimation::bake(const Md2::Model *model)
+{
+  Trace::Scope trace("VertexAnimation::bake");
+  release_bake();
+
+  int frames = model->get_num_frames();
+  int vertices = model->get_num_vertices();
+  GLint max_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+  if (!ready() || frames == 0 || vertices == 0 || frames > max_size || vertices > max_size)
+    return false;
+
+  std::vector<vec3> positions(static_cast<size_t>(frames) * vertices);
+  std::vector<unsigned char> normals(positions.size());
+  for (int f = 0; f < frames; f++)
+    model->read_frame(f, &positions[f * vertices], &normals[f * vertices]);
+
+  // Quantized to the bounds of the whole animation
+  lo = hi = positions[0];
+  for (const vec3 &p : positions)
+  {
+    lo = vec3(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+    hi = vec3(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+  }
+  vec3 extent(std::max(hi.x - lo.x, 1e-6f), std::max(hi.y - lo.y, 1e-6f), std::max(hi.z - lo.z, 1e-6f));
+
+  std::vector<GLushort> texels(positions.size() * 4);
+  for (size_t i = 0; i < positions.size(); i++)
+  {
+    texels[i * 4]     = unorm16((positions[i].x - lo.x) / extent.x);
+    texels[i * 4 + 1] = unorm16((positions[i].y - lo.y) / extent.y);
+    texels[i * 4 + 2] = unorm16((positions[i].z - lo.z) / extent.z);
+    texels[i * 4 + 3] = normals[i];
+  }
+  hi = lo + extent;
+
+  position_tex = create_texture(vertices, frames, GL_RGBA16, GL_RGBA, texels.data());
+  texture_bytes = texels.size() * sizeof(GLushort);
+  MemStats::account(MemStats::TEXTURE_GPU, texture_bytes);
+
+  // Corners of the full detail mesh: the column of their vertex, and their
+  // texture coordinates
+  const std::vector<Md2::Triangle> &triangles = model->get_triangles();
+  const std::vector<vec2> &tex_coords = model->get_tex_coords();
+  std::vector<GLfloat> corners;
+  corners.reserve(tex_coords.size() * 3);
+  for (size_t i = 0; i < tex_coords.size(); i++)
+  {
+    corners.push_back(triangles[i / 3].vertex[i % 3]);
+    corners.push_back(tex_coords[i].x);
+    corners.push_back(tex_coords[i].y);
+  }
+  num_corners = tex_coords.size();
+
+  glGenBuffers(1, &corner_buffer);
+  gl_state.bind_buffer(corner_buffer);
+  glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(GLfloat), corners.data(), GL_STATIC_DRAW);
+  MemStats::account(MemStats::GPU_BUFFERS, corners.size() * sizeof(GLfloat));
+
+  return true;
+}
+
+/***************************************************************************\
+ * VertexAnimation::set_instances                                          *
+\***************************************************************************/
+void VertexAnimation::set_instances(const std::vector<Instance> &instances)
+{
+  MemStats::account(MemStats::GPU_BUFFERS, -static_cast<long>(instance_bytes));
+  instance_bytes = 0;
+  num_instances = 0;
+
+  if (!instance_buffer || instances.empty())
+    return;
+
+  // place (4 floats) then anim (3 floats)
+  std::vector<GLfloat> data;
+  data.reserve(instances.size() * 7);
+  for (const Instance &instance : instances)
+  {
+    data.push_back(instance.position.x);
+    data.push_back(instance.position.y);
+    data.push_back(instance.position.z);
+    data.push_back(instance.scale);
+    data.push_back(instance.start);
+    data.push_back(std::max(instance.frames, 1));
+    data.push_back(instance.phase);
+  }
+
+  gl_state.bind_buffer(instance_buffer);
+  glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(GLfloat), data.data(), GL_STATIC_DRAW);
+  instance_bytes = data.size() * sizeof(GLfloat);
+  MemStats::account(MemStats::GPU_BUFFERS, instance_bytes);
+  num_instances = instances.size();
+}
+
+/***************************************************************************\
+ * VertexAnimation::draw                                                   *
+ * In the object frame of Md2::Object, whose triangles are clockwise.      *
+\***************************************************************************/
+void VertexAnimation::draw(float time, GLuint skin)
+{
+  if (!ready() || !num_corners || !num_instances)
+    return;
+
+  Trace::Scope trace("VertexAnimation::draw");
+  vec3 light = light_pos;
+  light.normalize();
+
+  glPushMatrix();
+  glRotatef(-90, 1, 0, 0);
+  glRotatef(-90, 0, 0, 1);
+
+  gl_state.use_program(program);
+  glUniform1f(time_loc, time);
+  glUniform3f(light_loc, light.x, light.y, light.z);
+  glUniform3f(bias_loc, lo.x, lo.y, lo.z);
+  glUniform3f(extent_loc, hi.x - lo.x, hi.y - lo.y, hi.z - lo.z);
+
+  glActiveTexture(GL_TEXTURE0 + POSITION_UNIT);
+  glBindTexture(GL_TEXTURE_2D, position_tex);
+  glActiveTexture(GL_TEXTURE0 + NORMAL_UNIT);
+  glBindTexture(GL_TEXTURE_2D, normal_tex);
+  glActiveTexture(GL_TEXTURE0);
+  gl_state.bind_texture(skin);
+
+  gl_state.disable(GL_BLEND);
+  gl_state.set_depth_func(GL_LESS);
+  gl_state.set_front_face(GL_CW);
+
+  // Generic attributes only
+  gl_state.client_state(GL_VERTEX_ARRAY, false);
+  gl_state.client_state(GL_TEXTURE_COORD_ARRAY, false);
+  gl_state.client_state(GL_COLOR_ARRAY, false);
+
+  gl_state.bind_buffer(corner_buffer);
+  glVertexAttribPointer(ATTRIB_CORNER, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(ATTRIB_CORNER);
+
+  const GLsizei stride = 7 * sizeof(GLfloat);
+  gl_state.bind_buffer(instance_buffer);
+  glVertexAttribPointer(ATTRIB_PLACE, 4, GL_FLOAT, GL_FALSE, stride, nullptr);
+  glVertexAttribPointer(ATTRIB_ANIM, 3, GL_FLOAT, GL_FALSE, stride,
+                        reinterpret_cast<const GLvoid *>(4 * sizeof(GLfloat)));
+  glEnableVertexAttribArray(ATTRIB_PLACE);
+  glEnableVertexAttribArray(ATTRIB_ANIM);
+  glVertexAttribDivisor(ATTRIB_PLACE, 1);
+  glVertexAttribDivisor(ATTRIB_ANIM, 1);
+
+  glDrawArraysInstanced(GL_TRIANGLES, 0, num_corners, num_instances);
+
+  glVertexAttribDivisor(ATTRIB_PLACE, 0);
+  glVertexAttribDivisor(ATTRIB_ANIM, 0);
+  glDisableVertexAttribArray(ATTRIB_CORNER);
+  glDisableVertexAttribArray(ATTRIB_PLACE);
+  glDisableVertexAttribArray(ATTRIB_ANIM);
+  gl_state.client_state(GL_VERTEX_ARRAY, true);
+  gl_state.use_program(0);
+
+  glPopMatrix();
+}
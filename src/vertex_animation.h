@@ -0,0 +1,76 @@
+// vertex_animation.h
+
+#ifndef VERTEX_ANIMATION_H
+#define VERTEX_ANIMATION_H
+
+#include <vector>
+
+#include <GL/gl.h>
+
+#include "md2_model.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// class VertexAnimation -- crowds animated on the GPU.
+//
+// bake() packs every frame of a model into an RGBA16 texture: one row per
+// frame, one column per vertex, the positions normalized to the bounds of
+// the whole animation and the anorms index in alpha.  draw() then renders
+// all the instances in a single instanced draw: the vertex shader finds
+// the two frames and the interpolation from the time and the animation of
+// its instance, fetches them from the texture and lights the vertex, so
+// the CPU does no per-vertex (nor per-instance) work.  The crowd neither
+// casts shadows nor goes through the occlusion culling.  Needs GL 3.3 (or
+// GLSL 1.30 and instanced arrays).
+//
+/////////////////////////////////////////////////////////////////////////////
+
+class VertexAnimation
+{
+public:
+  struct Instance
+  {
+    vec3 position;  // in the object frame, after scaling
+    float scale;
+    int start;      // first frame of the animation
+    int frames;     // its number of frames
+    float phase;    // time offset, in frames
+  };
+private:
+  GLuint program;
+  GLint  time_loc;
+  GLint  light_loc;
+  GLint  bias_loc;
+  GLint  extent_loc;
+
+  GLuint normal_tex;      // anorms, remapped to [0, 1]
+  GLuint position_tex;    // baked frames
+  GLuint corner_buffer;   // vertex column and texture coordinates per corner
+  GLuint instance_buffer;
+
+  vec3 lo, hi;            // bounds of the baked positions
+  int num_corners;
+  int num_instances;
+  size_t texture_bytes;
+  size_t instance_bytes;
+
+  bool build_program();
+  void release_bake();
+public:
+  VertexAnimation();
+
+  // Returns false if the GL implementation can't do it
+  bool init();
+  void release();
+  bool ready() const { return program != 0; }
+
+  bool bake(const Md2::Model *model);
+  void set_instances(const std::vector<Instance> &instances);
+
+  // 'time' in frames; 'skin' is the texture of the baked model
+  void draw(float time, GLuint skin);
+
+  int get_num_instances() const { return num_instances; }
+};
+
+#endif
@@ -0,0 +1,235 @@
+// keyframe_test.cpp
+//
+// Model::compress against its error bound: synthetic MD2 models (breathing,
+// jittering, static and single frame animations) are compressed at several
+// bounds, and every position of every frame read back must stay within the
+// bound on each axis, with the normals unchanged and no more memory than
+// the MD2 vertices.  Prints the checks that fail and exits with their
+// number (0: all passed):
+//
+//   keyframe_test
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "md2_model.h"
+#include "mem_stats.h"
+
+namespace
+{
+  const int MD2_IDENT = 'I' + ('D'<<8) + ('P'<<16) + ('2'<<24);
+  const int MD2_VERSION = 8;
+
+  int failures = 0;
+  int checks = 0;
+
+#pragma pack(push, 1)
+  struct FrameHeader
+  {
+    float scale[3];
+    float translate[3];
+    char  name[16];
+  };
+#pragma pack(pop)
+
+  // Deterministic pseudo random numbers in [0, n)
+  unsigned seed = 12345;
+  int random(int n)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) % n;
+  }
+
+  void check(bool ok, const std::string &what)
+  {
+    checks++;
+    if (!ok)
+    {
+      failures++;
+      std::cerr << "FAIL: " << what << std::endl;
+    }
+  }
+
+  enum Motion
+  {
+    BREATHING,  // a cylinder whose radius changes along the animation
+    JITTER,     // each vertex moves by a byte at most around its rest place
+    STATIC,     // every frame the same
+    SINGLE      // one frame per animation
+  };
+
+  /*-----------------------------------------------------------------------*\
+   * build_md2                                                             *
+   * A grid of 'cols' x 'rows' vertices wrapped on a cylinder, 'anims'     *
+   * animations of 'frames' frames each, quantized over a box of 'size'.   *
+  \*-----------------------------------------------------------------------*/
+  std::vector<unsigned char> build_md2(Motion motion, int cols, int rows, int anims, int frames,
+                                       float size)
+  {
+    const int num_verts = cols * rows;
+    const int num_tris = 2 * (cols - 1) * (rows - 1);
+    const int num_frames = anims * frames;
+
+    Md2::Header header;
+    std::memset(&header, 0, sizeof(header));
+    header.ident = MD2_IDENT;
+    header.version = MD2_VERSION;
+    header.skinwidth = header.skinheight = 64;
+    header.framesize = sizeof(FrameHeader) + sizeof(Md2::CompressedVertex) * num_verts;
+    header.num_skins = 1;
+    header.num_vertices = num_verts;
+    header.num_st = num_verts;
+    header.num_tris = num_tris;
+    header.num_frames = num_frames;
+    header.offset_skins = sizeof(Md2::Header);
+    header.offset_st = header.offset_skins + sizeof(Md2::Skin);
+    header.offset_tris = header.offset_st + sizeof(Md2::TexCoord) * num_verts;
+    header.offset_frames = header.offset_tris + sizeof(Md2::Triangle) * num_tris;
+    header.offset_glcmds = header.offset_frames + header.framesize * num_frames;
+    header.offset_end = header.offset_glcmds;
+
+    std::vector<unsigned char> file(header.offset_end, 0);
+    std::memcpy(&file[0], &header, sizeof(header));
+    std::strcpy(reinterpret_cast<Md2::Skin *>(&file[header.offset_skins])->name, "skin.pcx");
+
+    Md2::TexCoord *st = reinterpret_cast<Md2::TexCoord *>(&file[header.offset_st]);
+    Md2::Triangle *tris = reinterpret_cast<Md2::Triangle *>(&file[header.offset_tris]);
+    for (int r = 0; r < rows; r++)
+      for (int c = 0; c < cols; c++)
+      {
+        st[r * cols + c].s = static_cast<short>(c * 63 / (cols - 1));
+        st[r * cols + c].t = static_cast<short>(r * 63 / (rows - 1));
+      }
+    for (int q = 0; q < (cols - 1) * (rows - 1); q++)
+    {
+      unsigned short a = static_cast<unsigned short>((q / (cols - 1)) * cols + q % (cols - 1));
+      unsigned short b = a + 1, c = a + cols, d = a + cols + 1;
+      Md2::Triangle &t0 = tris[2 * q], &t1 = tris[2 * q + 1];
+      t0.vertex[0] = a; t0.vertex[1] = b; t0.vertex[2] = c;
+      t1.vertex[0] = b; t1.vertex[1] = d; t1.vertex[2] = c;
+      std::copy(t0.vertex, t0.vertex + 3, t0.st);
+      std::copy(t1.vertex, t1.vertex + 3, t1.st);
+    }
+
+    for (int f = 0; f < num_frames; f++)
+    {
+      unsigned char *ptr = &file[header.offset_frames + f * header.framesize];
+      FrameHeader *fh = reinterpret_cast<FrameHeader *>(ptr);
+      Md2::CompressedVertex *verts = reinterpret_cast<Md2::CompressedVertex *>(ptr + sizeof(FrameHeader));
+      int anim = f / frames, index = f % frames;
+
+      // Each frame its own box, as MD2 exporters write them
+      for (int k = 0; k < 3; k++)
+      {
+        fh->scale[k] = size / 255 * (motion == STATIC ? 1 : 1 + 0.01f * index);
+        fh->translate[k] = -size / 2 + (motion == STATIC ? 0 : 0.1f * k * index);
+      }
+      char name[16];
+      if (motion == SINGLE)
+        std::snprintf(name, sizeof(name), "pose%c", 'a' + f % 26);
+      else
+        std::snprintf(name, sizeof(name), "anim%c%03d", 'a' + anim % 26, index + 1);
+      std::memcpy(fh->name, name, std::strlen(name));  // zeroed, at most 15 characters
+
+      float phase = 6.2831853f * index / frames;
+      for (int r = 0; r < rows; r++)
+        for (int c = 0; c < cols; c++)
+        {
+          float angle = 6.2831853f * c / (cols - 1);
+          float radius = 0.3f + (motion == BREATHING ? 0.1f * std::sin(phase + r * 0.2f + anim) : 0);
+          float p[3] = { radius * std::cos(angle), radius * std::sin(angle), -0.45f + 0.9f * r / (rows - 1) };
+
+          Md2::CompressedVertex &v = verts[r * cols + c];
+          for (int k = 0; k < 3; k++)
+          {
+            int byte = static_cast<int>((p[k] + 0.5f) * 255);
+            if (motion == JITTER && index > 0)
+              byte += random(3) - 1;
+            v.v[k] = static_cast<unsigned char>(std::min(255, std::max(0, byte)));
+          }
+          v.normalIndex = static_cast<unsigned char>((r * cols + c + f) % 162);
+        }
+    }
+
+    return file;
+  }
+
+  /*-----------------------------------------------------------------------*\
+   * test_model                                                            *
+   * Compress a fresh copy of the model at each bound and read it back.    *
+  \*-----------------------------------------------------------------------*/
+  void test_model(const std::vector<unsigned char> &file, const std::string &name,
+                  const std::vector<float> &bounds)
+  {
+    FileSpan data(file.data(), file.size());
+
+    for (float bound : bounds)
+    {
+      std::string what = name + " at " + std::to_string(bound);
+
+      size_t keyframes = MemStats::get_resident(MemStats::KEYFRAMES);
+      Md2::Model model(name, data);
+      const size_t num_vertices = model.get_num_vertices();
+      const int num_frames = model.get_num_frames();
+
+      std::vector<vec3> original(num_vertices * num_frames), decoded(original.size());
+      std::vector<unsigned char> normals(original.size()), decoded_normals(original.size());
+      for (int f = 0; f < num_frames; f++)
+        model.read_frame(f, &original[f * num_vertices], &normals[f * num_vertices]);
+
+      check(model.compress(bound), what + ": compress");
+      check(model.is_compressed(), what + ": is_compressed");
+      check(!model.compress(bound), what + ": compress twice");
+
+      for (int f = 0; f < num_frames; f++)
+        model.read_frame(f, &decoded[f * num_vertices], &decoded_normals[f * num_vertices]);
+
+      // The bound on each axis of every vertex of every frame
+      float max_error = 0;
+      size_t outside = 0;
+      for (size_t k = 0; k < original.size(); k++)
+      {
+        vec3 d = decoded[k] - original[k];
+        float error = std::max(std::fabs(d.x), std::max(std::fabs(d.y), std::fabs(d.z)));
+        max_error = std::max(max_error, error);
+        if (!(error <= bound))
+          outside++;
+      }
+      check(outside == 0, what + ": " + std::to_string(outside) + " positions off by up to " +
+            std::to_string(max_error));
+      check(model.get_keyframe_error() == max_error, what + ": get_keyframe_error " +
+            std::to_string(model.get_keyframe_error()) + ", measured " + std::to_string(max_error));
+      check(normals == decoded_normals, what + ": normals");
+
+      // No bigger than the MD2 vertices (position bytes and normal index),
+      // up to the read padding of each animation
+      size_t packed = MemStats::get_resident(MemStats::KEYFRAMES) - keyframes;
+      size_t native = num_frames * num_vertices * sizeof(Md2::CompressedVertex);
+      check(packed <= native + 16 * num_frames, what + ": " + std::to_string(packed) +
+            " bytes, MD2 vertices " + std::to_string(native));
+    }
+
+    // Not compressed: no bound
+    Md2::Model model(name, data);
+    check(!model.compress(0), name + ": compress(0)");
+  }
+}
+
+int main()
+{
+  const std::vector<float> bounds = { 1e-6f, 1e-4f, 1e-3f, 0.01f, 0.05f, 0.1f, 0.5f, 1, 5 };
+
+  test_model(build_md2(BREATHING, 20, 20, 4, 12, 64), "breathing", bounds);
+  test_model(build_md2(BREATHING, 3, 2, 2, 5, 2), "small", bounds);
+  test_model(build_md2(JITTER, 24, 16, 3, 10, 64), "jitter", bounds);
+  test_model(build_md2(STATIC, 16, 16, 2, 16, 1000), "static", bounds);
+  test_model(build_md2(SINGLE, 8, 8, 1, 6, 32), "single frames", bounds);
+
+  std::cout << "keyframe_test: " << checks - failures << "/" << checks << " checks passed" << std::endl;
+  return failures;
+}
@@ -0,0 +1,253 @@
+// matrix_test.cpp
+//
+// The SSE matrix kernels against their scalar versions: products, batched
+// point transforms and projections (points with w near 0 included), and
+// the inverse, on fixed, random and singular matrices.  Prints the checks
+// that fail and exits with their number (0: all passed):
+//
+//   matrix_test
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+
+namespace
+{
+  const float TOLERANCE = 1e-5f;
+  int failures = 0;
+  int checks = 0;
+
+  // Deterministic pseudo random numbers in [lo, hi)
+  unsigned seed = 12345;
+  float random(float lo, float hi)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    return lo + (hi - lo) * (seed >> 8) / float(1 << 24);
+  }
+
+  // Relative to the magnitude; infinities and NaNs must match
+  bool same(float a, float b)
+  {
+    if (!std::isfinite(a) || !std::isfinite(b))
+      return (std::isnan(a) && std::isnan(b)) || a == b;
+    return std::fabs(a - b) <= TOLERANCE * std::max(1.0f, std::max(std::fabs(a), std::fabs(b)));
+  }
+
+  void check(bool ok, const std::string &what)
+  {
+    checks++;
+    if (!ok)
+    {
+      failures++;
+      std::cerr << "FAIL: " << what << std::endl;
+    }
+  }
+
+  bool same(const matrix &a, const matrix &b)
+  {
+    for (int i = 0; i < 16; i++)
+      if (!same(a.m[i], b.m[i]))
+        return false;
+    return true;
+  }
+
+  bool same(const vec3 &a, const vec3 &b)
+  {
+    return same(a.x, b.x) && same(a.y, b.y) && same(a.z, b.z);
+  }
+
+  bool same(const vec4 &a, const vec4 &b)
+  {
+    return same(a.x, b.x) && same(a.y, b.y) && same(a.z, b.z) && same(a.w, b.w);
+  }
+
+  // Projections near w = 0: the scalar 1 / w then multiply and the SSE
+  // divide only agree to the precision of w, so on every axis within 1e-3
+  // relative, or the same infinity or NaN
+  bool near_pole(float a, float b)
+  {
+    if (!std::isfinite(a) || !std::isfinite(b))
+      return same(a, b);
+    return std::fabs(a - b) <= 1e-3f * std::max(1.0f, std::fabs(b));
+  }
+
+  bool near_pole(const vec3 &a, const vec3 &b)
+  {
+    return near_pole(a.x, b.x) && near_pole(a.y, b.y) && near_pole(a.z, b.z);
+  }
+
+  matrix random_matrix()
+  {
+    matrix r;
+    for (int i = 0; i < 16; i++)
+      r.m[i] = random(-4, 4);
+    return r;
+  }
+
+  // gluPerspective(45, 4/3, 0.1, 1000) after a camera translation
+  matrix perspective()
+  {
+    float f = 1 / std::tan(22.5f * 3.14159265f / 180), n = 0.1f, far = 1000;
+    matrix projection(vec4(f / (4.0f / 3), 0, 0, 0),
+                      vec4(0, f, 0, 0),
+                      vec4(0, 0, (far + n) / (n - far), 2 * far * n / (n - far)),
+                      vec4(0, 0, -1, 0));
+    matrix view(vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(0, 0, 1, -8), vec4(0, 0, 0, 1));
+    return projection * view;
+  }
+
+  // Planar projection from a point light (rank 3, as draw_model builds)
+  matrix planar_shadow()
+  {
+    vec4 plane(0, 1, 0, 2.4f), light(1, 4, 2, 1);
+    float d = plane.dot(light);
+    return matrix(vec4(d - light.x * plane.x, -light.x * plane.y, -light.x * plane.z, -light.x * plane.w),
+                  vec4(-light.y * plane.x, d - light.y * plane.y, -light.y * plane.z, -light.y * plane.w),
+                  vec4(-light.z * plane.x, -light.z * plane.y, d - light.z * plane.z, -light.z * plane.w),
+                  vec4(-light.w * plane.x, -light.w * plane.y, -light.w * plane.z, d - light.w * plane.w));
+  }
+
+  void test_matrix(const matrix &a, const std::string &name)
+  {
+    const size_t N = 64;
+
+    // Products, both ways, with another matrix and with itself
+    matrix b = random_matrix();
+    check(same(a * b, a.multiply_scalar(b)), name + ": a * b");
+    check(same(b * a, b.multiply_scalar(a)), name + ": b * a");
+    check(same(a * a, a.multiply_scalar(a)), name + ": a * a");
+
+    // Points, the last ones making w 0 or nearly for project_points
+    std::vector<vec3> points(N);
+    for (vec3 &p : points)
+      p = vec3(random(-10, 10), random(-10, 10), random(-10, 10));
+    if (a.m[3] != 0 || a.m[7] != 0 || a.m[11] != 0)
+    {
+      // w = m3 x + m7 y + m11 z + m15: solve for x (or y, z) on a few points
+      const float offsets[] = { 0, 1e-7f, -1e-7f, 1e-4f };
+      for (int i = 0; i < 4; i++)
+      {
+        vec3 &p = points[N - 1 - i];
+        if (a.m[3] != 0)
+          p.x = (offsets[i] - a.m[7] * p.y - a.m[11] * p.z - a.m[15]) / a.m[3];
+        else if (a.m[7] != 0)
+          p.y = (offsets[i] - a.m[3] * p.x - a.m[11] * p.z - a.m[15]) / a.m[7];
+        else
+          p.z = (offsets[i] - a.m[3] * p.x - a.m[7] * p.y - a.m[15]) / a.m[11];
+      }
+    }
+
+    std::vector<vec3> sse(N), scalar(N);
+    a.transform_points(points.data(), sse.data(), N);
+    a.transform_points_scalar(points.data(), scalar.data(), N);
+    for (size_t i = 0; i < N; i++)
+      check(same(sse[i], scalar[i]), name + ": transform_points " + std::to_string(i));
+
+    a.project_points(points.data(), sse.data(), N);
+    a.project_points_scalar(points.data(), scalar.data(), N);
+    for (size_t i = 0; i < N; i++)
+    {
+      vec4 h = a * vec4(points[i].x, points[i].y, points[i].z, 1);
+      if (std::fabs(h.w) < 1e-3f)
+        check(near_pole(sse[i], scalar[i]), name + ": project_points near w = 0, " + std::to_string(i));
+      else
+        check(same(sse[i], scalar[i]), name + ": project_points " + std::to_string(i));
+    }
+
+    // In place
+    std::vector<vec3> in_place(points);
+    a.project_points(in_place.data(), in_place.data(), N);
+    a.project_points_scalar(points.data(), scalar.data(), N);
+    for (size_t i = 0; i < N; i++)
+      check(same(in_place[i], scalar[i]) || near_pole(in_place[i], scalar[i]),
+            name + ": project_points in place " + std::to_string(i));
+
+    // Homogeneous vectors, w = 0 (directions) included
+    std::vector<vec4> vectors(N), sse4(N), scalar4(N);
+    for (size_t i = 0; i < N; i++)
+      vectors[i] = vec4(random(-10, 10), random(-10, 10), random(-10, 10), i % 4 ? random(-2, 2) : 0);
+    a.transform(vectors.data(), sse4.data(), N);
+    a.transform_scalar(vectors.data(), scalar4.data(), N);
+    for (size_t i = 0; i < N; i++)
+      check(same(sse4[i], scalar4[i]), name + ": transform " + std::to_string(i));
+  }
+
+  // The inverse through the SSE product, against the scalar one
+  void test_inverse(const matrix &a, bool invertible, const std::string &name)
+  {
+    matrix inv, untouched;
+    for (int i = 0; i < 16; i++)
+      inv.m[i] = untouched.m[i] = 7;
+
+    bool ok = a.inverse(inv);
+    check(ok == invertible, name + ": inverse " + (invertible ? "found" : "refused"));
+    if (!ok)
+    {
+      check(same(inv, untouched), name + ": singular inverse leaves 'out' untouched");
+      return;
+    }
+
+    matrix identity;
+    check(same(a * inv, a.multiply_scalar(inv)), name + ": a * inverse, SSE and scalar");
+    for (int i = 0; i < 16; i++)
+    {
+      checks++;
+      if (std::fabs((a * inv).m[i] - identity.m[i]) > 1e-3f || std::fabs((inv * a).m[i] - identity.m[i]) > 1e-3f)
+      {
+        failures++;
+        std::cerr << "FAIL: " << name << ": a * inverse is not the identity" << std::endl;
+        break;
+      }
+    }
+  }
+}
+
+int main()
+{
+  matrix identity;
+  matrix view(vec4(0, -1, 0, 3), vec4(1, 0, 0, -2), vec4(0, 0, 1, 5), vec4(0, 0, 0, 1));
+  // Small integers keep the cofactors exact, so the determinant is exactly 0
+  // (inverse only refuses |det| < 1e-12, not a rounded near singular one)
+  matrix singular = random_matrix();
+  for (int i = 0; i < 16; i++)
+    singular.m[i] = std::floor(singular.m[i]);
+  for (int i = 0; i < 4; i++)
+    singular.m[4 * i + 2] = 2 * singular.m[4 * i + 1];  // third row = 2 * second
+  matrix zero;
+  for (int i = 0; i < 16; i++)
+    zero.m[i] = 0;
+
+  test_matrix(identity, "identity");
+  test_matrix(view, "affine");
+  test_matrix(perspective(), "perspective");
+  test_matrix(planar_shadow(), "planar shadow");
+  test_matrix(singular, "singular");
+  for (int i = 0; i < 16; i++)
+    test_matrix(random_matrix(), "random " + std::to_string(i));
+
+  test_inverse(identity, true, "identity");
+  test_inverse(view, true, "affine");
+  test_inverse(perspective(), true, "perspective");
+  test_inverse(planar_shadow(), false, "planar shadow");
+  test_inverse(singular, false, "singular");
+  test_inverse(zero, false, "zero");
+  for (int i = 0; i < 16; i++)
+  {
+    matrix a = random_matrix();
+    for (int j = 0; j < 4; j++)
+      a.m[5 * j] += 10;  // diagonally dominant, well conditioned
+    test_inverse(a, true, "random " + std::to_string(i));
+  }
+
+#ifdef __SSE__
+  std::cout << "matrix_test (SSE): ";
+#else
+  std::cout << "matrix_test (scalar only): ";
+#endif
+  std::cout << checks - failures << "/" << checks << " checks passed" << std::endl;
+  return failures;
+}
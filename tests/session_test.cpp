@@ -0,0 +1,166 @@
+// session_test.cpp
+//
+// Session log round trip: a log written by Session::Writer reads back the
+// same events and ends cleanly; truncated records, unknown event types and
+// other versions are reported instead of passing for the end of the log.
+// Prints the checks that fail and exits with their number (0: all passed):
+//
+//   session_test
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "session.h"
+
+namespace
+{
+  int failures = 0;
+  int checks = 0;
+
+  void check(bool ok, const std::string &what)
+  {
+    checks++;
+    if (!ok)
+    {
+      failures++;
+      std::cerr << "FAIL: " << what << std::endl;
+    }
+  }
+
+  std::vector<char> read_file(const std::string &filename)
+  {
+    std::ifstream ifs(filename.c_str(), std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  }
+
+  void write_file(const std::string &filename, const std::vector<char> &bytes)
+  {
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    ofs.write(bytes.data(), bytes.size());
+  }
+
+  // Events read from 'filename' until read() fails
+  std::vector<Session::Event> read_log(const std::string &filename, std::string &error)
+  {
+    std::vector<Session::Event> events;
+    Session::Reader reader;
+    Session::Event ev;
+    if (!reader.open(filename))
+    {
+      error = "open";
+      return events;
+    }
+    while (reader.read(ev))
+      events.push_back(ev);
+    error = reader.get_error();
+    return events;
+  }
+
+  bool same(const vec3 &a, const vec3 &b)
+  {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+  }
+
+  // Type, time and the payload of the type (read() leaves the other
+  // fields as they were)
+  bool same(const Session::Event &a, const Session::Event &b)
+  {
+    if (a.type != b.type || a.time != b.time)
+      return false;
+    switch (a.type)
+    {
+      case Session::EV_FRAME:
+        return true;
+      case Session::EV_CAMERA:
+        return same(a.a, b.a) && same(a.b, b.b);
+      case Session::EV_LIGHT:
+        return same(a.a, b.a);
+      case Session::EV_ANIM:
+      case Session::EV_SKIN:
+        return a.name == b.name;
+      default:
+        return a.value == b.value;
+    }
+  }
+}
+
+int main()
+{
+  const std::string log = "session_test.log", bad = "session_test_bad.log";
+
+  // One event of each type
+  std::vector<Session::Event> events;
+  for (int type = 0; type < Session::EV_COUNT; type++)
+  {
+    Session::Event ev(static_cast<Session::EventType>(type), 0.25f * type);
+    switch (ev.type)
+    {
+      case Session::EV_CAMERA:
+        ev.a = vec3(1, 2, 3);
+        ev.b = vec3(-4, 5, -6);
+        break;
+      case Session::EV_LIGHT:
+        ev.a = vec3(7, 8, 9);
+        break;
+      case Session::EV_ANIM:
+        ev.name = "run";
+        break;
+      case Session::EV_SKIN:
+        ev.name = "players/male/grunt.pcx";
+        break;
+      case Session::EV_FRAME:
+        break;
+      default:
+        ev.value = 10 + type;
+        break;
+    }
+    events.push_back(ev);
+  }
+
+  {
+    Session::Writer writer;
+    check(writer.open(log), "open the writer");
+    for (const Session::Event &ev : events)
+      writer.write(ev);
+  }
+
+  std::string error;
+  std::vector<Session::Event> read = read_log(log, error);
+  check(read.size() == events.size(), "events read back: " + std::to_string(read.size()));
+  for (size_t i = 0; i < read.size() && i < events.size(); i++)
+    check(same(read[i], events[i]), "event " + std::to_string(i));
+  check(error.empty(), "clean end, got '" + error + "'");
+
+  // Cut inside the last record
+  std::vector<char> bytes = read_file(log);
+  std::vector<char> cut(bytes.begin(), bytes.end() - 1);
+  write_file(bad, cut);
+  read = read_log(bad, error);
+  check(read.size() == events.size() - 1, "truncated: events before the cut");
+  check(error.find("truncated") == 0, "truncated: reported, got '" + error + "'");
+
+  // An event type from a newer build
+  std::vector<char> unknown(bytes);
+  unknown.push_back(static_cast<char>(Session::EV_COUNT));
+  write_file(bad, unknown);
+  read = read_log(bad, error);
+  check(read.size() == events.size(), "unknown type: events before it");
+  check(error.find("unknown event type") == 0, "unknown type: reported, got '" + error + "'");
+
+  // Another version is refused at open
+  std::vector<char> version(bytes);
+  version[4]++;
+  write_file(bad, version);
+  read_log(bad, error);
+  check(error == "open", "other version refused");
+
+  std::remove(log.c_str());
+  std::remove(bad.c_str());
+
+  std::cout << "session_test: " << checks - failures << "/" << checks << " checks passed" << std::endl;
+  return failures;
+}
@@ -0,0 +1,204 @@
+// simplify_test.cpp
+//
+// simplify_mesh on a closed sphere and an open height field: each level
+// reaches its triangle count, no kept triangle is turned over or flattened
+// (against the surface orientation and the input triangle it comes from),
+// indices and 'sources' stay in range and the corners keep their order.
+// Prints the checks that fail and exits with their number (0: all passed):
+//
+//   simplify_test
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "simplify.h"
+
+namespace
+{
+  int failures = 0;
+  int checks = 0;
+
+  void check(bool ok, const std::string &what)
+  {
+    checks++;
+    if (!ok)
+    {
+      failures++;
+      std::cerr << "FAIL: " << what << std::endl;
+    }
+  }
+
+  struct Mesh
+  {
+    std::vector<vec3> positions;
+    std::vector<unsigned> indices;
+  };
+
+  vec3 normal(const std::vector<vec3> &positions, const unsigned *v)
+  {
+    return (positions[v[1]] - positions[v[0]]) ^ (positions[v[2]] - positions[v[0]]);
+  }
+
+  /*-----------------------------------------------------------------------*\
+   * sphere                                                                *
+   * Unit icosahedron subdivided 'levels' times, counterclockwise seen     *
+   * from outside.                                                         *
+  \*-----------------------------------------------------------------------*/
+  Mesh sphere(int levels)
+  {
+    const float t = (1 + std::sqrt(5.0f)) / 2;
+    Mesh mesh;
+    mesh.positions = {
+      vec3(-1, t, 0), vec3(1, t, 0), vec3(-1, -t, 0), vec3(1, -t, 0),
+      vec3(0, -1, t), vec3(0, 1, t), vec3(0, -1, -t), vec3(0, 1, -t),
+      vec3(t, 0, -1), vec3(t, 0, 1), vec3(-t, 0, -1), vec3(-t, 0, 1)
+    };
+    mesh.indices = {
+      0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,
+      1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
+      3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,
+      4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1
+    };
+    for (vec3 &p : mesh.positions)
+      p.normalize();
+
+    for (int l = 0; l < levels; l++)
+    {
+      std::map<std::pair<unsigned, unsigned>, unsigned> middles;
+      auto middle = [&](unsigned a, unsigned b)
+      {
+        auto key = a < b ? std::make_pair(a, b) : std::make_pair(b, a);
+        auto iter = middles.find(key);
+        if (iter != middles.end())
+          return iter->second;
+        vec3 p = (mesh.positions[a] + mesh.positions[b]) * 0.5f;
+        mesh.positions.push_back(p.normalize());
+        unsigned index = static_cast<unsigned>(mesh.positions.size() - 1);
+        middles[key] = index;
+        return index;
+      };
+
+      std::vector<unsigned> indices;
+      for (size_t i = 0; i < mesh.indices.size(); i += 3)
+      {
+        unsigned a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+        unsigned ab = middle(a, b), bc = middle(b, c), ca = middle(c, a);
+        indices.insert(indices.end(), { a, ab, ca,  b, bc, ab,  c, ca, bc,  ab, bc, ca });
+      }
+      mesh.indices.swap(indices);
+    }
+    return mesh;
+  }
+
+  /*-----------------------------------------------------------------------*\
+   * height_field                                                          *
+   * A gently rolling 'n' x 'n' grid, counterclockwise seen from above.    *
+  \*-----------------------------------------------------------------------*/
+  Mesh height_field(int n)
+  {
+    Mesh mesh;
+    for (int y = 0; y < n; y++)
+      for (int x = 0; x < n; x++)
+        mesh.positions.push_back(vec3(static_cast<float>(x), static_cast<float>(y),
+                                      0.3f * std::sin(0.4f * x) * std::cos(0.3f * y)));
+    for (int y = 0; y + 1 < n; y++)
+      for (int x = 0; x + 1 < n; x++)
+      {
+        unsigned a = y * n + x, b = a + 1, c = a + n, d = c + 1;
+        mesh.indices.insert(mesh.indices.end(), { a, b, d,  a, d, c });
+      }
+    return mesh;
+  }
+
+  /*-----------------------------------------------------------------------*\
+   * test_mesh                                                             *
+   * Simplify to each target; 'up' gives the outward side at a position.  *
+  \*-----------------------------------------------------------------------*/
+  template <typename Up>
+  void test_mesh(const Mesh &mesh, const std::string &name, const std::vector<size_t> &targets, Up up)
+  {
+    const size_t num_tris = mesh.indices.size() / 3;
+    const size_t num_vertices = mesh.positions.size();
+
+    std::vector<std::vector<unsigned> > sources;
+    std::vector<std::vector<unsigned> > levels =
+      simplify_mesh(mesh.positions.data(), num_vertices, mesh.indices, targets, &sources);
+    std::vector<std::vector<unsigned> > plain =
+      simplify_mesh(mesh.positions.data(), num_vertices, mesh.indices, targets);
+
+    check(levels.size() == targets.size(), name + ": one level per target");
+    check(sources.size() == targets.size(), name + ": one source list per target");
+    check(plain == levels, name + ": same levels without sources");
+
+    for (size_t i = 0; i < levels.size() && i < sources.size(); i++)
+    {
+      const std::vector<unsigned> &indices = levels[i];
+      const std::vector<unsigned> &from = sources[i];
+      const size_t kept = indices.size() / 3;
+      std::string what = name + " to " + std::to_string(targets[i]);
+
+      // An edge collapse removes one triangle on a border, two inside
+      check(indices.size() % 3 == 0, what + ": whole triangles");
+      if (targets[i] >= num_tris)
+        check(kept == num_tris, what + ": " + std::to_string(kept) + " triangles, all kept");
+      else
+        check(kept <= targets[i] && kept + 2 > targets[i],
+              what + ": " + std::to_string(kept) + " triangles");
+
+      check(from.size() == kept, what + ": " + std::to_string(from.size()) + " sources");
+      size_t out_of_range = 0, unordered = 0;
+      for (size_t t = 0; t < from.size(); t++)
+      {
+        if (from[t] >= num_tris)
+          out_of_range++;
+        if (t > 0 && from[t] <= from[t - 1])
+          unordered++;
+      }
+      check(out_of_range == 0, what + ": " + std::to_string(out_of_range) + " sources out of range");
+      check(unordered == 0, what + ": sources in input order");
+
+      size_t bad_index = 0, degenerate = 0, flipped = 0, turned = 0;
+      for (size_t t = 0; t < kept; t++)
+      {
+        const unsigned *v = &indices[t * 3];
+        if (v[0] >= num_vertices || v[1] >= num_vertices || v[2] >= num_vertices)
+        {
+          bad_index++;
+          continue;
+        }
+        if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0])
+          degenerate++;
+
+        vec3 n = normal(mesh.positions, v);
+        vec3 centre = (mesh.positions[v[0]] + mesh.positions[v[1]] + mesh.positions[v[2]]) * (1 / 3.0f);
+        if (!(n.dot(up(centre)) > 0))
+          flipped++;
+        if (t < from.size() && from[t] < num_tris &&
+            !(n.dot(normal(mesh.positions, &mesh.indices[from[t] * 3])) > 0))
+          turned++;
+      }
+      check(bad_index == 0, what + ": " + std::to_string(bad_index) + " vertex indices out of range");
+      check(degenerate == 0, what + ": " + std::to_string(degenerate) + " degenerate triangles");
+      check(flipped == 0, what + ": " + std::to_string(flipped) + " triangles facing inwards");
+      check(turned == 0, what + ": " + std::to_string(turned) + " triangles turned from their source");
+    }
+  }
+}
+
+int main()
+{
+  Mesh ball = sphere(3);
+  test_mesh(ball, "sphere", { 5000, 1280, 1000, 640, 320, 160, 80, 40 },
+            [](const vec3 &p) { return p; });
+
+  Mesh field = height_field(24);
+  test_mesh(field, "height field", { 1058, 800, 500, 250, 100, 50 },
+            [](const vec3 &) { return vec3(0, 0, 1); });
+
+  std::cout << "simplify_test: " << checks - failures << "/" << checks << " checks passed" << std::endl;
+  return failures;
+}
@@ -0,0 +1,128 @@
+// md2bench.cpp
+//
+// Loading and drawing benchmark over player directories (typically made by
+// md2gen).  For each directory prints one CSV line with the mesh sizes, the
+// time spent in Model::Model, in the PCX decoding of the skin and per
+// draw_model call, then the memory held by the model, its skin and its pose
+// (MemStats) and the heap allocations per draw_model call:
+//
+//   md2bench [--iterations N] dir...
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <GL/glut.h>
+
+#include "image.h"
+#include "md2_model.h"
+#include "mem_stats.h"
+#include "vfs.h"
+
+namespace
+{
+  typedef std::chrono::steady_clock Clock;
+
+  double elapsed_ms(Clock::time_point start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  std::vector<std::string> dirs;
+  int iterations = 20;
+
+  glutInit(&argc, argv);
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "--iterations" && i + 1 < argc)
+      iterations = std::max(1, atoi(argv[++i]));
+    else
+      dirs.push_back(arg);
+  }
+
+  if (dirs.empty())
+  {
+    std::cerr << "usage: md2bench [--iterations N] dir...\n";
+    return -1;
+  }
+
+  // A window is needed for the GL context used by draw_model
+  glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH | GLUT_STENCIL);
+  glutInitWindowSize(640, 480);
+  glutCreateWindow("md2bench");
+  glEnable(GL_DEPTH_TEST);
+  glEnableClientState(GL_VERTEX_ARRAY);
+
+  std::cout << "dir,tris,verts,frames,skin,load_ms,skin_ms,draw_ms,mtris_per_s,mpixels_per_s,"
+               "geometry_kib,keyframes_kib,skin_kib,scratch_kib,draw_allocs\n";
+
+  for (const std::string &dir : dirs)
+  {
+    Vfs vfs;
+    if (!vfs.mount(dir))
+    {
+      std::cerr << "md2bench: couldn't mount " << dir << std::endl;
+      continue;
+    }
+
+    // Mapping the files is not part of the measure
+    FileSpan mesh = vfs.open("tris.md2");
+    FileSpan skin = vfs.open("skin.pcx");
+    if (mesh.empty() || skin.empty())
+    {
+      std::cerr << "md2bench: " << dir << " has no tris.md2/skin.pcx\n";
+      continue;
+    }
+
+    size_t geometry = MemStats::get_resident(MemStats::GEOMETRY);
+    size_t keyframes = MemStats::get_resident(MemStats::KEYFRAMES);
+    size_t pixels = MemStats::get_resident(MemStats::TEXTURE_CPU);
+    size_t scratch = MemStats::get_resident(MemStats::SCRATCH);
+
+    Clock::time_point start = Clock::now();
+    Md2::Model model("tris.md2", mesh);
+    double load_ms = elapsed_ms(start);
+
+    start = Clock::now();
+    Image image("skin.pcx", skin);
+    double skin_ms = elapsed_ms(start);
+
+    const Md2::Header *header = reinterpret_cast<const Md2::Header *>(mesh.data);
+    const Md2::Anim &anim = model.get_anims().begin()->second;
+
+    Md2::PoseCache pose;
+    model.set_scale(0.02f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    model.draw_model(anim.start, anim.end, 0.5f, pose);
+    glFinish();
+
+    unsigned long allocations = MemStats::get_allocations();
+    start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+      model.draw_model(anim.start, anim.end, static_cast<float>(i) / iterations, pose);
+    glFinish();
+    double draw_ms = elapsed_ms(start) / iterations;
+    double draw_allocs = static_cast<double>(MemStats::get_allocations() - allocations) / iterations;
+
+    std::cout << dir << ',' << header->num_tris << ',' << header->num_vertices << ','
+              << header->num_frames << ',' << image.get_width() << ','
+              << load_ms << ',' << skin_ms << ',' << draw_ms << ','
+              << header->num_tris / (draw_ms * 1000.0) << ','
+              << image.get_width() * image.get_height() / (skin_ms * 1000.0) << ','
+              << (MemStats::get_resident(MemStats::GEOMETRY) - geometry) / 1024.0 << ','
+              << (MemStats::get_resident(MemStats::KEYFRAMES) - keyframes) / 1024.0 << ','
+              << (MemStats::get_resident(MemStats::TEXTURE_CPU) - pixels) / 1024.0 << ','
+              << (MemStats::get_resident(MemStats::SCRATCH) - scratch) / 1024.0 << ','
+              << draw_allocs << std::endl;
+  }
+
+  return 0;
+}
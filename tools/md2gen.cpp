@@ -0,0 +1,323 @@
+// md2gen.cpp
+//
+// Synthetic MD2/PCX generator for scalability tests.  Writes a player
+// directory (tris.md2 + skin.pcx) with the requested sizes:
+//
+//   md2gen [--tris N] [--verts N] [--frames N] [--anims N] [--skin SIZE] dir
+//
+// The mesh is a grid wrapped on a cylinder which breathes differently in
+// each animation.  Animations are named "stand", "run", then "animaa",
+// "animab"... and their frames carry a 4 digit index, which the model
+// loader splits back into the same animations.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "md2_model.h"
+
+namespace
+{
+  const int MD2_IDENT = 'I' + ('D'<<8) + ('P'<<16) + ('2'<<24);
+  const int MD2_VERSION = 8;
+
+#pragma pack(push, 1)
+  struct PCX_Header
+  {
+    unsigned char manufacturer;
+    unsigned char version;
+    unsigned char encoding;
+    unsigned char bitsPerPixel;
+
+    unsigned short xmin, ymin;
+    unsigned short xmax, ymax;
+    unsigned short horzRes, vertRes;
+
+    unsigned char palette[48];
+    unsigned char reserved;
+    unsigned char numColorPlanes;
+
+    unsigned short bytesPerScanLine;
+    unsigned short paletteType;
+    unsigned short horzSize, vertSize;
+
+    unsigned char padding[54];
+  };
+
+  struct FrameHeader
+  {
+    float scale[3];
+    float translate[3];
+    char  name[16];
+  };
+#pragma pack(pop)
+
+  struct Options
+  {
+    int tris;
+    int verts;
+    int frames;
+    int anims;
+    int skin;
+    std::string dirname;
+  };
+
+  std::string anim_name(int i)
+  {
+    if (i == 0) return "stand";
+    if (i == 1) return "run";
+
+    i -= 2;
+    std::string name = "anim";
+    name += static_cast<char>('a' + (i / 26) % 26);
+    name += static_cast<char>('a' + i % 26);
+    return name;
+  }
+
+  template <typename T> void put(std::ofstream &ofs, const T *data, size_t count)
+  {
+    ofs.write(reinterpret_cast<const char *>(data), sizeof(T) * count);
+  }
+
+  /*-----------------------------------------------------------------------*\
+   * write_md2                                                             *
+  \*-----------------------------------------------------------------------*/
+  bool write_md2(const Options &opt, const std::string &filename)
+  {
+    // Vertex grid: 'cols' around the cylinder, 'rows' along its axis
+    int cols = std::max(2, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(opt.verts)))));
+    int rows = std::max(2, (opt.verts + cols - 1) / cols);
+    int num_verts = cols * rows;
+    int quads = (cols - 1) * (rows - 1);
+
+    Md2::Header header;
+    std::memset(&header, 0, sizeof(header));
+
+    header.ident = MD2_IDENT;
+    header.version = MD2_VERSION;
+    header.skinwidth = opt.skin;
+    header.skinheight = opt.skin;
+    header.framesize = sizeof(FrameHeader) + sizeof(Md2::CompressedVertex) * num_verts;
+    header.num_skins = 1;
+    header.num_vertices = num_verts;
+    header.num_st = num_verts;
+    header.num_tris = opt.tris;
+    header.num_glcmds = 0;
+    header.num_frames = opt.frames;
+    header.offset_skins = sizeof(Md2::Header);
+    header.offset_st = header.offset_skins + sizeof(Md2::Skin);
+    header.offset_tris = header.offset_st + sizeof(Md2::TexCoord) * num_verts;
+    header.offset_frames = header.offset_tris + sizeof(Md2::Triangle) * opt.tris;
+    header.offset_glcmds = header.offset_frames + header.framesize * opt.frames;
+    header.offset_end = header.offset_glcmds;
+
+    Md2::Skin skin;
+    std::memset(&skin, 0, sizeof(skin));
+    std::strcpy(skin.name, "skin.pcx");
+
+    std::vector<Md2::TexCoord> st(num_verts);
+    for (int r = 0; r < rows; r++)
+      for (int c = 0; c < cols; c++)
+      {
+        st[r * cols + c].s = static_cast<short>(c * (opt.skin - 1) / (cols - 1));
+        st[r * cols + c].t = static_cast<short>(r * (opt.skin - 1) / (rows - 1));
+      }
+
+    // Two triangles per quad, wrapping around when more triangles than
+    // quads are requested
+    std::vector<Md2::Triangle> tris(opt.tris);
+    for (int i = 0; i < opt.tris; i++)
+    {
+      int q = (i / 2) % quads;
+      unsigned short a = static_cast<unsigned short>((q / (cols - 1)) * cols + q % (cols - 1));
+      unsigned short b = a + 1, c = a + cols, d = a + cols + 1;
+      Md2::Triangle &t = tris[i];
+
+      if (i % 2 == 0)
+      { t.vertex[0] = a; t.vertex[1] = b; t.vertex[2] = c; }
+      else
+      { t.vertex[0] = b; t.vertex[1] = d; t.vertex[2] = c; }
+
+      std::copy(t.vertex, t.vertex + 3, t.st);
+    }
+
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    if (ofs.fail())
+      return false;
+
+    put(ofs, &header, 1);
+    put(ofs, &skin, 1);
+    put(ofs, st.data(), st.size());
+    put(ofs, tris.data(), tris.size());
+
+    // Frames: radius and height vary per animation and per frame; every
+    // frame is quantized over the same box so the loader sees real data
+    int frames_per_anim = std::max(1, opt.frames / opt.anims);
+    std::vector<Md2::CompressedVertex> verts(num_verts);
+
+    for (int f = 0; f < opt.frames; f++)
+    {
+      int anim = std::min(f / frames_per_anim, opt.anims - 1);
+      int index = f - anim * frames_per_anim;
+      float phase = 6.2831853f * index / frames_per_anim;
+
+      FrameHeader fh;
+      std::memset(&fh, 0, sizeof(fh));
+      for (int k = 0; k < 3; k++)
+      {
+        fh.scale[k] = 64.0f / 255.0f;
+        fh.translate[k] = -32.0f;
+      }
+      char digits[8];
+      std::snprintf(digits, sizeof(digits), "%04d", index % 10000);
+      std::string name = anim_name(anim) + digits;
+      std::strncpy(fh.name, name.c_str(), sizeof(fh.name) - 1);
+
+      for (int r = 0; r < rows; r++)
+        for (int c = 0; c < cols; c++)
+        {
+          float angle = 6.2831853f * c / (cols - 1);
+          float radius = 16.0f + 8.0f * std::sin(phase + r * 0.2f + anim);
+          float x = radius * std::cos(angle);
+          float y = radius * std::sin(angle);
+          float z = -30.0f + 60.0f * r / (rows - 1);
+
+          Md2::CompressedVertex &v = verts[r * cols + c];
+          v.v[0] = static_cast<unsigned char>((x + 32.0f) * 255.0f / 64.0f);
+          v.v[1] = static_cast<unsigned char>((y + 32.0f) * 255.0f / 64.0f);
+          v.v[2] = static_cast<unsigned char>((z + 32.0f) * 255.0f / 64.0f);
+          v.normalIndex = 0;
+        }
+
+      put(ofs, &fh, 1);
+      put(ofs, verts.data(), verts.size());
+    }
+
+    return !ofs.fail();
+  }
+
+  /*-----------------------------------------------------------------------*\
+   * write_pcx                                                             *
+   * 8 bits, RLE encoded, 256 colors palette.                              *
+  \*-----------------------------------------------------------------------*/
+  bool write_pcx(int size, const std::string &filename)
+  {
+    PCX_Header header;
+    std::memset(&header, 0, sizeof(header));
+
+    header.manufacturer = 0x0a;
+    header.version = 5;
+    header.encoding = 1;
+    header.bitsPerPixel = 8;
+    header.xmax = size - 1;
+    header.ymax = size - 1;
+    header.horzRes = 72;
+    header.vertRes = 72;
+    header.numColorPlanes = 1;
+    header.bytesPerScanLine = size;
+    header.paletteType = 1;
+
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    if (ofs.fail())
+      return false;
+
+    put(ofs, &header, 1);
+
+    // Checker board over a gradient, so both runs and literals occur
+    std::vector<unsigned char> line(size), rle;
+    rle.reserve(size * 2);
+
+    for (int y = 0; y < size; y++)
+    {
+      for (int x = 0; x < size; x++)
+        line[x] = static_cast<unsigned char>((((x / 16) ^ (y / 16)) & 1) ? 255 - (x * 128 / size)
+                                                                           : (y * 128 / size));
+
+      rle.clear();
+      for (int x = 0; x < size; )
+      {
+        int run = 1;
+        while (x + run < size && run < 63 && line[x + run] == line[x])
+          run++;
+
+        if (run > 1 || line[x] >= 0xc0)
+          rle.push_back(static_cast<unsigned char>(0xc0 | run));
+        rle.push_back(line[x]);
+        x += run;
+      }
+      put(ofs, rle.data(), rle.size());
+    }
+
+    unsigned char palette[769];
+    palette[0] = 0x0c;
+    for (int i = 0; i < 256; i++)
+    {
+      palette[1 + i * 3 + 0] = static_cast<unsigned char>(i);
+      palette[1 + i * 3 + 1] = static_cast<unsigned char>(255 - i);
+      palette[1 + i * 3 + 2] = static_cast<unsigned char>((i * 7) & 0xff);
+    }
+    put(ofs, palette, sizeof(palette));
+
+    return !ofs.fail();
+  }
+
+  void usage()
+  {
+    std::cerr << "usage: md2gen [--tris N] [--verts N] [--frames N] [--anims N] [--skin SIZE] dir\n";
+    exit(-1);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  Options opt = { 1000, 0, 200, 10, 256, "" };
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg[0] != '-')
+      opt.dirname = arg;
+    else if (i + 1 >= argc)
+      usage();
+    else if (arg == "--tris")   opt.tris = atoi(argv[++i]);
+    else if (arg == "--verts")  opt.verts = atoi(argv[++i]);
+    else if (arg == "--frames") opt.frames = atoi(argv[++i]);
+    else if (arg == "--anims")  opt.anims = atoi(argv[++i]);
+    else if (arg == "--skin")   opt.skin = atoi(argv[++i]);
+    else
+      usage();
+  }
+
+  if (opt.dirname.empty())
+    usage();
+
+  // About two triangles per vertex on a closed grid
+  if (opt.verts <= 0)
+    opt.verts = opt.tris / 2 + 2;
+
+  if (opt.tris <= 0 || opt.frames <= 0 || opt.anims <= 0 || opt.anims > opt.frames ||
+      opt.verts > 65535 || opt.skin < 2 || opt.skin > 4096 || opt.skin % 2)
+  {
+    std::cerr << "md2gen: invalid sizes (at most 65535 vertices, even skin size up to 4096)\n";
+    return -1;
+  }
+
+  mkdir(opt.dirname.c_str(), 0755);
+
+  if (!write_md2(opt, opt.dirname + "/tris.md2") ||
+      !write_pcx(opt.skin, opt.dirname + "/skin.pcx"))
+  {
+    std::cerr << "md2gen: couldn't write to " << opt.dirname << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
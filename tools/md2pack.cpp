@@ -0,0 +1,144 @@
+// md2pack.cpp
+//
+// Keyframe compression report over player directories.  For each directory
+// and each error bound prints one CSV line with the mesh sizes, the
+// keyframe memory before and after Model::compress, next to the size of
+// the MD2 vertices (4 bytes each, position and normal index), the largest
+// error on an axis measured against the original positions, and the time
+// to decode every frame once from either form (best of a few passes):
+//
+//   md2pack [--error E]... dir...
+//
+// The errors are in model units (default 0.05, 0.1, 0.25 and 0.5).
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "md2_model.h"
+#include "mem_stats.h"
+#include "vfs.h"
+
+namespace
+{
+  typedef std::chrono::steady_clock Clock;
+
+  double elapsed_ms(Clock::time_point start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  // Every frame of 'model', one after the other
+  void read_frames(const Md2::Model &model, std::vector<vec3> &positions,
+                   std::vector<unsigned char> &normals)
+  {
+    size_t num_vertices = model.get_num_vertices();
+    positions.resize(num_vertices * model.get_num_frames());
+    normals.resize(positions.size());
+    for (int i = 0; i < model.get_num_frames(); i++)
+      model.read_frame(i, &positions[i * num_vertices], &normals[i * num_vertices]);
+  }
+
+  // Best time of a few decodings of every frame, into buffers already
+  // touched so that page faults don't count
+  double time_frames(const Md2::Model &model, std::vector<vec3> &positions,
+                     std::vector<unsigned char> &normals)
+  {
+    const int PASSES = 5;
+    double best = 0;
+    for (int pass = 0; pass <= PASSES; pass++)
+    {
+      Clock::time_point start = Clock::now();
+      read_frames(model, positions, normals);
+      double ms = elapsed_ms(start);
+      if (pass == 1 || (pass > 1 && ms < best))
+        best = ms;
+    }
+    return best;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  std::vector<std::string> dirs;
+  std::vector<float> errors;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "--error" && i + 1 < argc)
+      errors.push_back(atof(argv[++i]));
+    else
+      dirs.push_back(arg);
+  }
+
+  if (dirs.empty())
+  {
+    std::cerr << "usage: md2pack [--error E]... dir...\n";
+    return -1;
+  }
+  if (errors.empty())
+    errors = { 0.05f, 0.1f, 0.25f, 0.5f };
+
+  std::cout << "dir,verts,frames,anims,error_bound,keyframes_kib,native_kib,packed_kib,ratio,"
+               "native_ratio,max_error,decode_ms,packed_decode_ms\n";
+
+  for (const std::string &dir : dirs)
+  {
+    Vfs vfs;
+    if (!vfs.mount(dir))
+    {
+      std::cerr << "md2pack: couldn't mount " << dir << std::endl;
+      continue;
+    }
+
+    FileSpan mesh = vfs.open("tris.md2");
+    if (mesh.empty())
+    {
+      std::cerr << "md2pack: " << dir << " has no tris.md2\n";
+      continue;
+    }
+
+    for (float bound : errors)
+    {
+      size_t keyframes = MemStats::get_resident(MemStats::KEYFRAMES);
+      Md2::Model model("tris.md2", mesh);
+      size_t raw = MemStats::get_resident(MemStats::KEYFRAMES) - keyframes;
+
+      std::vector<vec3> original, decoded;
+      std::vector<unsigned char> normals;
+      double decode_ms = time_frames(model, original, normals);
+
+      if (!model.compress(bound))
+      {
+        std::cerr << "md2pack: can't compress " << dir << " at " << bound << std::endl;
+        continue;
+      }
+      size_t packed = MemStats::get_resident(MemStats::KEYFRAMES) - keyframes;
+      size_t native = static_cast<size_t>(model.get_num_frames()) * model.get_num_vertices() *
+                      sizeof(Md2::CompressedVertex);
+
+      double packed_decode_ms = time_frames(model, decoded, normals);
+
+      float max_error = 0;
+      for (size_t k = 0; k < original.size(); k++)
+      {
+        vec3 d = decoded[k] - original[k];
+        max_error = std::max(max_error, std::max(std::fabs(d.x), std::max(std::fabs(d.y), std::fabs(d.z))));
+      }
+
+      std::cout << dir << ',' << model.get_num_vertices() << ',' << model.get_num_frames() << ','
+                << model.get_anims().size() << ',' << bound << ','
+                << raw / 1024.0 << ',' << native / 1024.0 << ',' << packed / 1024.0 << ','
+                << static_cast<double>(raw) / std::max<size_t>(packed, 1) << ','
+                << static_cast<double>(native) / std::max<size_t>(packed, 1) << ','
+                << max_error << ',' << decode_ms << ',' << packed_decode_ms << std::endl;
+    }
+  }
+
+  return 0;
+}
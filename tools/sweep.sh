@@ -0,0 +1,48 @@
+#!/bin/sh
+# sweep.sh -- generate synthetic players of growing size with md2gen, run
+# md2bench over them and plot throughput against size (when gnuplot is
+# available).
+#
+#   tools/sweep.sh [outdir]      (after `make tools`)
+
+set -e
+
+BUILD=${BUILD:-build}
+OUT=${1:-sweep}
+
+mkdir -p "$OUT"
+
+# triangles, frames, skin size
+for size in "500 50 256" "2000 200 512" "10000 500 1024" \
+            "30000 1000 2048" "100000 2000 4096"
+do
+  set -- $size
+  dir="$OUT/t$1_f$2_s$3"
+  [ -d "$dir" ] || "$BUILD/md2gen" --tris $1 --frames $2 --anims 10 --skin $3 "$dir"
+  dirs="$dirs $dir"
+done
+
+"$BUILD/md2bench" $dirs | tee "$OUT/results.csv"
+
+if command -v gnuplot > /dev/null
+then
+  gnuplot <<PLOT
+set terminal png size 1024,768
+set output "$OUT/throughput.png"
+set datafile separator ","
+set key autotitle columnhead
+set logscale x
+set multiplot layout 3,1
+set xlabel "triangles"
+set ylabel "Mtris/s"
+plot "$OUT/results.csv" using 2:9 with linespoints title "draw_model"
+set xlabel "frames x vertices"
+set ylabel "ms"
+plot "$OUT/results.csv" using (\$3*\$4):6 with linespoints title "Model::Model"
+set xlabel "skin pixels"
+set ylabel "Mpixels/s"
+plot "$OUT/results.csv" using (\$5*\$5):10 with linespoints title "readPCX8bits"
+unset multiplot
+PLOT
+  echo "plot: $OUT/throughput.png"
+fi